@@ -0,0 +1,762 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* The NFC adapters: setting them up, re-arming them after a tag has gone
+ * away, and stopping and restarting them according to their poll policy.
+ * All of this runs on the thread that talks to neard.
+ */
+
+#include "gtlm-nfc.h"
+#include "gtlm-nfc-private.h"
+#include <gio/gio.h>
+
+typedef struct _GTlmNfcAdapterSetup _AdapterSetup;
+
+/* neard's names for GTlmNfcPollMode */
+static const gchar* const _poll_mode_names[] = {
+    [GTLM_NFC_POLL_MODE_INITIATOR] = "Initiator",
+    [GTLM_NFC_POLL_MODE_TARGET] = "Target",
+    [GTLM_NFC_POLL_MODE_DUAL] = "Dual",
+};
+
+typedef struct {
+    GTlmNfcPollMode mode;
+    guint idle_timeout;
+} _PollPolicy;
+
+static _PollPolicy
+_get_poll_policy (GTlmNfc* self, const gchar* adapter_path)
+{
+    _PollPolicy* policy = g_hash_table_lookup(self->priv->poll_policies, adapter_path);
+    if (policy != NULL)
+        return *policy;
+
+    _PollPolicy default_policy = { self->priv->poll_mode, self->priv->idle_timeout };
+    return default_policy;
+}
+
+static void
+_adapter_state_set_polling (GTlmNfcAdapter* adapter, gboolean polling)
+{
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&adapter->self->priv->stats_lock);
+    if (polling == TRUE && adapter->polling == FALSE)
+        adapter->polling_since = now;
+    else if (polling == FALSE && adapter->polling == TRUE)
+        adapter->polling_total += now - adapter->polling_since;
+    adapter->polling = polling;
+    g_mutex_unlock(&adapter->self->priv->stats_lock);
+}
+
+void gtlm_nfc_adapter_update(GTlmNfcAdapter* adapter,
+                             const gchar* property_name,
+                             GVariant* value)
+{
+    if (g_strcmp0(property_name, "Powered") == 0 &&
+            g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)) {
+        adapter->powered = g_variant_get_boolean(value);
+    } else if (g_strcmp0(property_name, "Polling") == 0 &&
+            g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)) {
+        _adapter_state_set_polling(adapter, g_variant_get_boolean(value));
+    } else if (g_strcmp0(property_name, "Mode") == 0 &&
+            g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+        g_free(adapter->mode);
+        adapter->mode = g_variant_dup_string(value, NULL);
+    }
+}
+
+static void
+_adapter_state_load_cached (GTlmNfcAdapter* adapter, const gchar* property_name)
+{
+    GVariant* value = g_dbus_proxy_get_cached_property(adapter->proxy, property_name);
+    if (value == NULL) {
+        g_debug("%s property is absent on an adapter", property_name);
+        return;
+    }
+    gtlm_nfc_adapter_update(adapter, property_name, value);
+    g_variant_unref(value);
+}
+
+static GTlmNfcAdapter*
+_adapter_state_new (GTlmNfc* self, GDBusProxy* proxy)
+{
+    GTlmNfcAdapter* adapter = g_slice_new0(GTlmNfcAdapter);
+    adapter->self = self;
+    adapter->proxy = g_object_ref(proxy);
+    adapter->created = g_get_monotonic_time();
+
+    // initial values come from the object manager's GetManagedObjects reply,
+    // later changes from interface-proxy-properties-changed
+    _adapter_state_load_cached(adapter, "Powered");
+    _adapter_state_load_cached(adapter, "Polling");
+    _adapter_state_load_cached(adapter, "Mode");
+    return adapter;
+}
+
+static void
+_adapter_state_free (GTlmNfcAdapter* adapter)
+{
+    if (adapter->idle_source != NULL) {
+        g_source_destroy(adapter->idle_source);
+        g_source_unref(adapter->idle_source);
+    }
+    g_object_unref(adapter->proxy);
+    g_free(adapter->mode);
+    g_slice_free(GTlmNfcAdapter, adapter);
+}
+
+struct _GTlmNfcAdapterSetup {
+    GTlmNfc* self;
+    gchar* adapter_path;
+    gboolean polling;
+    // whether adapters-ready waits for this setup
+    gboolean counted;
+};
+
+static gboolean
+_emit_adapters_ready (gpointer user_data)
+{
+    GTlmNfc* self = GTLM_NFC(user_data);
+
+    if (self->priv->adapters_pending == 0) {
+        g_debug("All adapters are set up");
+        gtlm_nfc_emit_signal(self, SIG_ADAPTERS_READY, NULL, NULL, NULL, 0);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* Setups can finish without a round trip to neard, while GTlmNfc is still
+ * being constructed, so adapters-ready is always emitted from an idle source.
+ */
+static void
+_adapter_setup_done (GTlmNfc* self, GTlmNfcAdapter* adapter)
+{
+    gboolean counted = adapter->setup->counted;
+
+    adapter->setup = NULL;
+    if (counted == FALSE || --self->priv->adapters_pending > 0)
+        return;
+
+    GSource* source = g_idle_source_new();
+    g_source_set_priority(source, G_PRIORITY_DEFAULT);
+    g_source_set_callback(source, _emit_adapters_ready, g_object_ref(self), g_object_unref);
+    g_source_attach(source, g_main_context_get_thread_default());
+    g_source_unref(source);
+}
+
+static void
+_adapter_setup_free (_AdapterSetup* setup)
+{
+    // the adapter may have gone away, or come back, in the meantime
+    GTlmNfcAdapter* adapter = g_hash_table_lookup(setup->self->priv->adapters,
+                                                 setup->adapter_path);
+    if (adapter != NULL && adapter->setup == setup)
+        _adapter_setup_done(setup->self, adapter);
+
+    g_object_unref(setup->self);
+    g_free(setup->adapter_path);
+    g_slice_free(_AdapterSetup, setup);
+}
+
+static void
+_on_adapter_poll_loop_started (GObject      *source_object,
+                               GAsyncResult *res,
+                               gpointer      user_data)
+{
+    _AdapterSetup* setup = user_data;
+    GError* error = NULL;
+
+    GVariant* response = g_dbus_connection_call_finish (G_DBUS_CONNECTION(source_object),
+                                                        res,
+                                                        &error);
+    if (response == NULL) {
+        g_debug("Error starting NFC poll loop: %s", error->message);
+        g_error_free (error);
+    } else {
+        g_variant_unref(response);
+        g_debug("Started NFC poll loop");
+    }
+    _adapter_setup_free(setup);
+}
+
+static void
+_adapter_setup_start_poll_loop (_AdapterSetup* setup)
+{
+    if (setup->polling == TRUE) {
+        g_debug("Adapter already in polling mode");
+        _adapter_setup_free(setup);
+        return;
+    }
+
+    _PollPolicy policy = _get_poll_policy(setup->self, setup->adapter_path);
+    g_dbus_connection_call (setup->self->priv->system_bus,
+                            "org.neard",
+                            setup->adapter_path,
+                            "org.neard.Adapter",
+                            "StartPollLoop",
+                            g_variant_new("(s)", _poll_mode_names[policy.mode]),
+                            NULL,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            _on_adapter_poll_loop_started,
+                            setup);
+}
+
+static void
+_on_adapter_powered_on (GObject      *source_object,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+    _AdapterSetup* setup = user_data;
+    GError* error = NULL;
+
+    GVariant* response = g_dbus_connection_call_finish (G_DBUS_CONNECTION(source_object),
+                                                        res,
+                                                        &error);
+    if (response == NULL) {
+        g_debug("Error swithing NFC adapter on: %s", error->message);
+        g_error_free (error);
+        _adapter_setup_free(setup);
+        return;
+    }
+    g_variant_unref(response);
+    g_debug("Switched NFC adapter on");
+
+    _adapter_setup_start_poll_loop(setup);
+}
+
+/* Powers an adapter on if need be and starts polling on it. This does not
+ * wait for neard. With @counted, adapters-ready waits for the adapter.
+ */
+static void
+_power_on_nfc_adapter (GTlmNfc *self, GTlmNfcAdapter *adapter, gboolean counted)
+{
+    if (adapter->setup != NULL) {
+        // a re-arm in flight still has to be waited for by a setup
+        if (counted == TRUE && adapter->setup->counted == FALSE) {
+            adapter->setup->counted = TRUE;
+            self->priv->adapters_pending++;
+        }
+        return;
+    }
+
+    _AdapterSetup* setup = g_slice_new0(_AdapterSetup);
+    setup->self = g_object_ref(self);
+    setup->adapter_path = g_strdup(g_dbus_proxy_get_object_path(adapter->proxy));
+    setup->polling = adapter->polling;
+    setup->counted = counted;
+    adapter->setup = setup;
+    if (counted == TRUE)
+        self->priv->adapters_pending++;
+
+    if (adapter->powered == TRUE) {
+        g_debug("Adapter already switched on");
+        _adapter_setup_start_poll_loop(setup);
+        return;
+    }
+
+    // switch power on
+    g_dbus_connection_call (self->priv->system_bus,
+                            "org.neard",
+                            setup->adapter_path,
+                            "org.freedesktop.DBus.Properties",
+                            "Set",
+                            g_variant_new("(ssv)",
+                                          "org.neard.Adapter",
+                                          "Powered",
+                                          g_variant_new_boolean(TRUE)
+                                         ),
+                            NULL,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            _on_adapter_powered_on,
+                            setup);
+}
+
+/* Powers an adapter on and starts polling on it. The setups of all adapters
+ * are in flight at the same time; adapters-ready is emitted once none is left.
+ */
+void gtlm_nfc_adapter_setup(GTlmNfc* self, GTlmNfcAdapter* adapter)
+{
+    _power_on_nfc_adapter(self, adapter, TRUE);
+}
+
+void gtlm_nfc_adapter_rearm_complete(GTlmNfc* self, GTlmNfcAdapter* adapter)
+{
+    if (adapter->rearm_start == 0)
+        return;
+
+    gint64 dead_time = g_get_monotonic_time() - adapter->rearm_start;
+    adapter->rearm_start = 0;
+    g_mutex_lock(&self->priv->stats_lock);
+    adapter->rearm_last = dead_time;
+    adapter->rearm_max = MAX(adapter->rearm_max, dead_time);
+    adapter->rearm_total += dead_time;
+    adapter->rearm_count++;
+    g_mutex_unlock(&self->priv->stats_lock);
+
+    g_debug("Adapter %s re-armed after %" G_GINT64_FORMAT " us",
+            g_dbus_proxy_get_object_path(adapter->proxy), dead_time);
+    gtlm_nfc_emit_signal(self, SIG_ADAPTER_REARMED,
+                         g_dbus_proxy_get_object_path(adapter->proxy), NULL, NULL, dead_time);
+}
+
+typedef struct {
+    GTlmNfc* self;
+    gchar* adapter_path;
+} _AdapterRearm;
+
+static void
+_on_adapter_rearmed (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+    _AdapterRearm* rearm = user_data;
+    GError* error = NULL;
+
+    GVariant* response = g_dbus_connection_call_finish (G_DBUS_CONNECTION(source_object),
+                                                        res,
+                                                        &error);
+    GTlmNfcAdapter* adapter = g_hash_table_lookup(rearm->self->priv->adapters,
+                                                 rearm->adapter_path);
+    if (adapter != NULL)
+        adapter->rearm_pending = FALSE;
+
+    if (response == NULL) {
+        // neard refuses a second StartPollLoop if the adapter is already
+        // polling; the Polling property change completes the re-arm then
+        g_debug("Error restarting NFC poll loop: %s", error->message);
+        g_error_free (error);
+    } else {
+        g_variant_unref(response);
+        if (adapter != NULL)
+            gtlm_nfc_adapter_rearm_complete(rearm->self, adapter);
+    }
+
+    g_object_unref(rearm->self);
+    g_free(rearm->adapter_path);
+    g_slice_free(_AdapterRearm, rearm);
+}
+
+/* Restarts polling on an adapter after its tag has gone away. This only
+ * issues StartPollLoop and does not wait for the reply, so that the caller
+ * can deliver tag-lost while the request is travelling to neard.
+ */
+void gtlm_nfc_adapter_rearm(GTlmNfc* self, GTlmNfcAdapter* adapter)
+{
+    // the dead time starts when the tag is lost, not when neard is asked
+    gint64 now = g_get_monotonic_time();
+
+    // a dormant adapter stays idle, one with another tag on it is still
+    // busy, and a re-arm in flight is already being timed
+    if (adapter->dormant == TRUE || adapter->n_tags > 0 ||
+            adapter->rearm_pending == TRUE)
+        return;
+
+    adapter->rearm_start = now;
+    if (adapter->powered == FALSE) {
+        // the Polling property change completes the re-arm
+        _power_on_nfc_adapter(self, adapter, FALSE);
+        return;
+    }
+    if (adapter->polling == TRUE) {
+        gtlm_nfc_adapter_rearm_complete(self, adapter);
+        return;
+    }
+
+    _AdapterRearm* rearm = g_slice_new(_AdapterRearm);
+    rearm->self = g_object_ref(self);
+    rearm->adapter_path = g_strdup(g_dbus_proxy_get_object_path(adapter->proxy));
+    adapter->rearm_pending = TRUE;
+
+    _PollPolicy policy = _get_poll_policy(self, rearm->adapter_path);
+    g_dbus_connection_call (self->priv->system_bus,
+                            "org.neard",
+                            rearm->adapter_path,
+                            "org.neard.Adapter",
+                            "StartPollLoop",
+                            g_variant_new("(s)", _poll_mode_names[policy.mode]),
+                            NULL,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            _on_adapter_rearmed,
+                            rearm);
+}
+
+static void
+_on_adapter_poll_loop_stopped (GObject      *source_object,
+                               GAsyncResult *res,
+                               gpointer      user_data)
+{
+    GError* error = NULL;
+
+    GVariant* response = g_dbus_connection_call_finish (G_DBUS_CONNECTION(source_object),
+                                                        res,
+                                                        &error);
+    if (response == NULL) {
+        g_debug("Error stopping NFC poll loop: %s", error->message);
+        g_error_free (error);
+    } else {
+        g_variant_unref(response);
+        g_debug("Stopped NFC poll loop");
+    }
+}
+
+/* Stops polling on an adapter without waiting for neard to report it, so
+ * that an adapter started again right away is told to poll again.
+ */
+static void
+_stop_nfc_adapter (GTlmNfc* self, GTlmNfcAdapter* adapter)
+{
+    adapter->rearm_start = 0;
+    if (adapter->polling == FALSE)
+        return;
+
+    _adapter_state_set_polling(adapter, FALSE);
+    g_dbus_connection_call (self->priv->system_bus,
+                            "org.neard",
+                            g_dbus_proxy_get_object_path(adapter->proxy),
+                            "org.neard.Adapter",
+                            "StopPollLoop",
+                            NULL,
+                            NULL,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            _on_adapter_poll_loop_stopped,
+                            NULL);
+}
+
+/* Stops polling on an adapter once nothing has happened on it for the idle
+ * timeout of its poll policy; gtlm_nfc_activate() starts it again.
+ */
+static gboolean
+_on_adapter_idle (gpointer user_data)
+{
+    GTlmNfcAdapter* adapter = user_data;
+
+    g_source_unref(adapter->idle_source);
+    adapter->idle_source = NULL;
+
+    // a tag that is still on the adapter counts as activity
+    if (adapter->n_tags > 0) {
+        gtlm_nfc_adapter_touch(adapter);
+        return G_SOURCE_REMOVE;
+    }
+
+    g_debug("No NFC activity on %s, stopping its poll loop",
+            g_dbus_proxy_get_object_path(adapter->proxy));
+    adapter->dormant = TRUE;
+    _stop_nfc_adapter(adapter->self, adapter);
+    return G_SOURCE_REMOVE;
+}
+
+/* Restarts the idle timeout of an adapter; called on every sign of NFC
+ * activity on it
+ */
+void gtlm_nfc_adapter_touch(GTlmNfcAdapter* adapter)
+{
+    if (adapter->idle_source != NULL) {
+        g_source_destroy(adapter->idle_source);
+        g_source_unref(adapter->idle_source);
+        adapter->idle_source = NULL;
+    }
+
+    _PollPolicy policy = _get_poll_policy(adapter->self,
+                                          g_dbus_proxy_get_object_path(adapter->proxy));
+    if (policy.idle_timeout == 0 || adapter->dormant == TRUE ||
+            adapter->self->priv->activation != ACTIVATION_DONE)
+        return;
+
+    adapter->idle_source = g_timeout_source_new_seconds(policy.idle_timeout);
+    g_source_set_callback(adapter->idle_source, _on_adapter_idle, adapter, NULL);
+    g_source_attach(adapter->idle_source, g_main_context_get_thread_default());
+}
+
+void gtlm_nfc_adapters_touch(GTlmNfc* self)
+{
+    GHashTableIter iter;
+    GTlmNfcAdapter* adapter;
+
+    g_hash_table_iter_init(&iter, self->priv->adapters);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&adapter))
+        gtlm_nfc_adapter_touch(adapter);
+}
+
+/* Brings an adapter in line with its poll policy after the policy changed */
+static void
+_apply_poll_policy (GTlmNfc* self, GTlmNfcAdapter* adapter)
+{
+    _PollPolicy policy = _get_poll_policy(self, g_dbus_proxy_get_object_path(adapter->proxy));
+
+    // neard only takes a new mode from StartPollLoop
+    if (adapter->dormant == FALSE && adapter->polling == TRUE &&
+            g_strcmp0(adapter->mode, _poll_mode_names[policy.mode]) != 0) {
+        g_debug("Switching %s to %s mode",
+                g_dbus_proxy_get_object_path(adapter->proxy), _poll_mode_names[policy.mode]);
+        _stop_nfc_adapter(self, adapter);
+        gtlm_nfc_adapter_setup(self, adapter);
+    }
+    gtlm_nfc_adapter_touch(adapter);
+}
+
+GTlmNfcAdapter* gtlm_nfc_adapter_index(GTlmNfc* self, GDBusProxy* proxy)
+{
+    GTlmNfcAdapter* adapter = _adapter_state_new(self, proxy);
+    g_mutex_lock(&self->priv->stats_lock);
+    g_hash_table_replace(self->priv->adapters,
+                         g_strdup(g_dbus_proxy_get_object_path(proxy)),
+                         adapter);
+    g_mutex_unlock(&self->priv->stats_lock);
+    return adapter;
+}
+
+GTlmNfcAdapter* gtlm_nfc_adapter_lookup_for_tag(GTlmNfc* self, GDBusProxy* tag)
+{
+    GVariant* adapter_v = g_dbus_proxy_get_cached_property(tag, "Adapter");
+    if (adapter_v == NULL || !g_variant_is_of_type(adapter_v, G_VARIANT_TYPE_OBJECT_PATH)) {
+        g_debug("Adapter property is absent on a tag");
+        if (adapter_v != NULL)
+            g_variant_unref(adapter_v);
+        return NULL;
+    }
+    const gchar* adapter_path = g_variant_get_string(adapter_v, NULL);
+    g_debug("Tag belongs to adapter %s", adapter_path);
+    GTlmNfcAdapter* adapter = g_hash_table_lookup(self->priv->adapters, adapter_path);
+    if (adapter == NULL)
+        g_debug ("Adapter %s is not known", adapter_path);
+    g_variant_unref(adapter_v);
+    return adapter;
+}
+
+static void
+_poll_policy_free (gpointer policy)
+{
+    g_slice_free(_PollPolicy, policy);
+}
+
+void gtlm_nfc_adapters_init(GTlmNfc* self)
+{
+    self->priv->adapters = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                 g_free, (GDestroyNotify)_adapter_state_free);
+    self->priv->poll_policies = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                      g_free, _poll_policy_free);
+}
+
+/* An adapter that goes away in the middle of its setup no longer holds up
+ * adapters-ready
+ */
+void gtlm_nfc_adapter_remove(GTlmNfc* self, const gchar* adapter_path)
+{
+    GTlmNfcAdapter* adapter = g_hash_table_lookup(self->priv->adapters, adapter_path);
+    if (adapter != NULL && adapter->setup != NULL)
+        _adapter_setup_done(self, adapter);
+    g_mutex_lock(&self->priv->stats_lock);
+    g_hash_table_remove(self->priv->adapters, adapter_path);
+    g_mutex_unlock(&self->priv->stats_lock);
+}
+
+void gtlm_nfc_adapters_wake(GTlmNfc* self)
+{
+    GHashTableIter iter;
+    GTlmNfcAdapter* adapter;
+    g_hash_table_iter_init(&iter, self->priv->adapters);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&adapter)) {
+        if (adapter->dormant == TRUE) {
+            g_debug("Restarting the poll loop on %s",
+                    g_dbus_proxy_get_object_path(adapter->proxy));
+            adapter->dormant = FALSE;
+            gtlm_nfc_adapter_setup(self, adapter);
+        }
+    }
+    gtlm_nfc_adapters_touch(self);
+}
+
+typedef struct {
+    GTlmNfc* self;
+    gchar* adapter_path;
+    _PollPolicy policy;
+} _SetPollPolicy;
+
+static void
+_set_poll_policy_free (_SetPollPolicy* set)
+{
+    g_object_unref(set->self);
+    g_free(set->adapter_path);
+    g_slice_free(_SetPollPolicy, set);
+}
+
+static gboolean
+_set_poll_policy (gpointer user_data)
+{
+    _SetPollPolicy* set = user_data;
+    GTlmNfc* self = set->self;
+
+    if (set->adapter_path == NULL) {
+        self->priv->poll_mode = set->policy.mode;
+        self->priv->idle_timeout = set->policy.idle_timeout;
+    } else {
+        g_hash_table_replace(self->priv->poll_policies,
+                             g_strdup(set->adapter_path),
+                             g_slice_dup(_PollPolicy, &set->policy));
+    }
+
+    GHashTableIter iter;
+    const gchar* adapter_path;
+    GTlmNfcAdapter* adapter;
+    g_hash_table_iter_init(&iter, self->priv->adapters);
+    while (g_hash_table_iter_next(&iter, (gpointer*)&adapter_path, (gpointer*)&adapter)) {
+        if (set->adapter_path == NULL || g_strcmp0(set->adapter_path, adapter_path) == 0)
+            _apply_poll_policy(self, adapter);
+    }
+
+    _set_poll_policy_free(set);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * gtlm_nfc_set_poll_policy:
+ * @tlm_nfc: an instance of GTlmNfc object
+ * @adapter_path: (allow-none): an identifier of the adapter (as passed to
+ * #GTlmNfc::adapter-rearmed), or %NULL to set the policy of all adapters that
+ * have none of their own
+ * @mode: the mode to poll in
+ * @idle_timeout: the number of seconds without NFC activity on the adapter
+ * after which polling is stopped, or 0 to keep polling
+ *
+ * Sets how an adapter polls for tags. Tags appearing on or disappearing from
+ * the adapter, writes and gtlm_nfc_activate() count as activity. Once polling
+ * has been stopped, it is started again by the next gtlm_nfc_activate(), within
+ * a single round trip to neard. An adapter that is polling in another mode is
+ * switched over right away.
+ *
+ * The policy for @adapter_path is kept if the adapter goes away, and applies
+ * again when it comes back. Until this is called, all adapters poll as
+ * initiators with #GTlmNfc:idle-timeout.
+ */
+void gtlm_nfc_set_poll_policy(GTlmNfc* tlm_nfc,
+                              const gchar* adapter_path,
+                              GTlmNfcPollMode mode,
+                              guint idle_timeout)
+{
+    g_return_if_fail (G_IS_TLM_NFC (tlm_nfc));
+    g_return_if_fail (mode <= GTLM_NFC_POLL_MODE_DUAL);
+
+    _SetPollPolicy* set = g_slice_new(_SetPollPolicy);
+    set->self = g_object_ref(gtlm_nfc_get_engine(tlm_nfc));
+    set->adapter_path = g_strdup(adapter_path);
+    set->policy.mode = mode;
+    set->policy.idle_timeout = idle_timeout;
+    gtlm_nfc_invoke_engine(set->self, _set_poll_policy, set, (GDestroyNotify)_set_poll_policy_free);
+}
+
+/**
+ * gtlm_nfc_get_polling_time:
+ * @tlm_nfc: an instance of GTlmNfc object
+ * @adapter_path: an identifier of the adapter (as passed to #GTlmNfc::adapter-rearmed)
+ * @polling_usec: (out) (allow-none): the time the adapter spent polling
+ * @total_usec: (out) (allow-none): the time since the adapter was found
+ *
+ * Reports how much of its time an adapter spent polling for tags, according
+ * to neard, to help tune poll policies (see gtlm_nfc_set_poll_policy()). All
+ * times are in microseconds.
+ *
+ * Returns: %TRUE if the adapter is known, %FALSE otherwise.
+ */
+gboolean gtlm_nfc_get_polling_time(GTlmNfc* tlm_nfc,
+                                   const gchar* adapter_path,
+                                   gint64* polling_usec,
+                                   gint64* total_usec)
+{
+    g_return_val_if_fail (G_IS_TLM_NFC (tlm_nfc), FALSE);
+
+    GTlmNfc* engine = gtlm_nfc_get_engine(tlm_nfc);
+    g_mutex_lock(&engine->priv->stats_lock);
+    GTlmNfcAdapter* adapter = g_hash_table_lookup(engine->priv->adapters, adapter_path);
+    if (adapter == NULL) {
+        g_mutex_unlock(&engine->priv->stats_lock);
+        return FALSE;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    if (polling_usec) {
+        *polling_usec = adapter->polling_total;
+        if (adapter->polling == TRUE)
+            *polling_usec += now - adapter->polling_since;
+    }
+    if (total_usec)
+        *total_usec = now - adapter->created;
+    g_mutex_unlock(&engine->priv->stats_lock);
+    return TRUE;
+}
+
+/**
+ * gtlm_nfc_get_rearm_time:
+ * @tlm_nfc: an instance of GTlmNfc object
+ * @adapter_path: an identifier of the adapter (as passed to #GTlmNfc::adapter-rearmed)
+ * @last_usec: (out) (allow-none): the dead time of the most recent re-arm
+ * @max_usec: (out) (allow-none): the longest dead time seen so far
+ * @average_usec: (out) (allow-none): the average dead time
+ * @count: (out) (allow-none): the number of re-arms measured
+ *
+ * Reports how long an adapter was unable to detect a new tag after the
+ * previous one went away, measured from the removal of the tag to the moment
+ * neard reports the adapter as polling again. All times are in microseconds.
+ *
+ * Returns: %TRUE if the adapter is known, %FALSE otherwise.
+ */
+gboolean gtlm_nfc_get_rearm_time(GTlmNfc* tlm_nfc,
+                                 const gchar* adapter_path,
+                                 gint64* last_usec,
+                                 gint64* max_usec,
+                                 gint64* average_usec,
+                                 guint* count)
+{
+    g_return_val_if_fail (G_IS_TLM_NFC (tlm_nfc), FALSE);
+
+    GTlmNfc* engine = gtlm_nfc_get_engine(tlm_nfc);
+    g_mutex_lock(&engine->priv->stats_lock);
+    GTlmNfcAdapter* adapter = g_hash_table_lookup(engine->priv->adapters, adapter_path);
+    if (adapter == NULL) {
+        g_mutex_unlock(&engine->priv->stats_lock);
+        return FALSE;
+    }
+
+    if (last_usec)
+        *last_usec = adapter->rearm_last;
+    if (max_usec)
+        *max_usec = adapter->rearm_max;
+    if (average_usec)
+        *average_usec = adapter->rearm_count > 0 ?
+                        adapter->rearm_total / adapter->rearm_count : 0;
+    if (count)
+        *count = adapter->rearm_count;
+    g_mutex_unlock(&engine->priv->stats_lock);
+    return TRUE;
+}
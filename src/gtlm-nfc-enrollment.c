@@ -0,0 +1,428 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "gtlm-nfc.h"
+#include "gtlm-nfc-private.h"
+#include "gtlm-nfc-payload.h"
+#include <gio/gio.h>
+
+/* A batch enrollment, see gtlm_nfc_enroll_async(). It is owned by the
+ * engine, and only touched from the engine's thread; the credentials are
+ * encoded by the caller, before the enrollment reaches the engine.
+ */
+typedef struct {
+    gchar* username;
+    GVariant* arguments;
+    gsize message_size;
+} _Credential;
+
+struct _GTlmNfcEnrollment {
+    GTlmNfc* self;
+    GTask* task;
+    GQueue credentials;
+    gint timeout_msec;
+    gboolean verify;
+    GTlmNfcEnrollProgressCallback progress_callback;
+    gpointer progress_user_data;
+    GMainContext* context;
+    GSource* cancelled_source;
+    /* the tag being written to, or %NULL */
+    gchar* tag_path;
+    gboolean finished;
+    guint written;
+    guint failed;
+    gint64 start_time;
+};
+
+typedef struct _GTlmNfcEnrollment _Enrollment;
+
+static void
+_credential_free (_Credential* credential)
+{
+    g_free(credential->username);
+    g_variant_unref(credential->arguments);
+    g_slice_free(_Credential, credential);
+}
+
+static void
+_enrollment_free (_Enrollment* enrollment)
+{
+    _Credential* credential;
+
+    while ((credential = g_queue_pop_head(&enrollment->credentials)) != NULL)
+        _credential_free(credential);
+    if (enrollment->task != NULL)
+        g_object_unref(enrollment->task);
+    if (enrollment->cancelled_source != NULL) {
+        g_source_destroy(enrollment->cancelled_source);
+        g_source_unref(enrollment->cancelled_source);
+    }
+    g_main_context_unref(enrollment->context);
+    g_free(enrollment->tag_path);
+    g_slice_free(_Enrollment, enrollment);
+}
+
+/* A progress report on its way to the caller's main context */
+typedef struct {
+    GTlmNfcEnrollProgress progress;
+    GTlmNfc* tlm_nfc;
+    GTlmNfcEnrollProgressCallback callback;
+    gpointer user_data;
+    gchar* tag_path;
+    gchar* username;
+    GError* error;
+} _ProgressReport;
+
+static gboolean
+_report_progress (gpointer user_data)
+{
+    _ProgressReport* report = user_data;
+
+    report->callback(report->tlm_nfc, &report->progress, report->user_data);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_progress_report_free (_ProgressReport* report)
+{
+    g_object_unref(report->tlm_nfc);
+    g_free(report->tag_path);
+    g_free(report->username);
+    if (report->error != NULL)
+        g_error_free(report->error);
+    g_slice_free(_ProgressReport, report);
+}
+
+static void
+_enrollment_progress (_Enrollment* enrollment,
+                      const gchar* username,
+                      const GError* error)
+{
+    if (enrollment->progress_callback == NULL)
+        return;
+
+    _ProgressReport* report = g_slice_new0(_ProgressReport);
+    report->tlm_nfc = g_object_ref(g_task_get_source_object(enrollment->task));
+    report->callback = enrollment->progress_callback;
+    report->user_data = enrollment->progress_user_data;
+    report->tag_path = g_strdup(enrollment->tag_path);
+    report->username = g_strdup(username);
+    report->error = error != NULL ? g_error_copy(error) : NULL;
+
+    GTlmNfcEnrollProgress* progress = &report->progress;
+    progress->tag_path = report->tag_path;
+    progress->username = report->username;
+    progress->error = report->error;
+    progress->written = enrollment->written;
+    progress->failed = enrollment->failed;
+    progress->remaining = g_queue_get_length(&enrollment->credentials);
+    progress->elapsed_usec = g_get_monotonic_time() - enrollment->start_time;
+    if (progress->elapsed_usec > 0)
+        progress->tags_per_minute = enrollment->written * 60.0 * G_USEC_PER_SEC /
+                                    progress->elapsed_usec;
+
+    g_main_context_invoke_full(enrollment->context,
+                               G_PRIORITY_DEFAULT,
+                               _report_progress,
+                               report,
+                               (GDestroyNotify)_progress_report_free);
+}
+
+/* Completes the enrollment's task with @error, or successfully if it is
+ * %NULL. A write that is still in flight frees the enrollment when it
+ * returns.
+ */
+void gtlm_nfc_enrollment_finish(_Enrollment* enrollment, GError* error)
+{
+    GTlmNfc* self = enrollment->self;
+
+    if (self->priv->enrollment == enrollment)
+        self->priv->enrollment = NULL;
+    enrollment->finished = TRUE;
+
+    if (error != NULL)
+        g_task_return_error(enrollment->task, error);
+    else
+        g_task_return_boolean(enrollment->task, TRUE);
+    g_clear_object(&enrollment->task);
+
+    if (enrollment->tag_path == NULL)
+        _enrollment_free(enrollment);
+}
+
+static gboolean
+_on_enrollment_cancelled (GCancellable* cancellable, gpointer user_data)
+{
+    _Enrollment* enrollment = user_data;
+
+    // a write in flight is cancelled as well, and frees the enrollment
+    // when it returns
+    gtlm_nfc_enrollment_finish(enrollment,
+                               g_error_new(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                           "Enrollment was cancelled"));
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_on_enroll_write_done (GObject      *source_object,
+                       GAsyncResult *res,
+                       gpointer      user_data)
+{
+    _Enrollment* enrollment = user_data;
+    GError* error = NULL;
+
+    gboolean written = g_task_propagate_boolean(G_TASK(res), &error);
+    if (enrollment->finished == TRUE) {
+        g_clear_error(&error);
+        _enrollment_free(enrollment);
+        return;
+    }
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_clear_pointer(&enrollment->tag_path, g_free);
+        gtlm_nfc_enrollment_finish(enrollment, error);
+        return;
+    }
+
+    // the credentials stay at the head of the queue until they are written,
+    // so they go to the next tag if this one could not be written
+    _Credential* credential = g_queue_peek_head(&enrollment->credentials);
+    if (written == TRUE) {
+        g_queue_pop_head(&enrollment->credentials);
+        enrollment->written++;
+        g_debug("Enrolled %s on tag %s", credential->username, enrollment->tag_path);
+        _enrollment_progress(enrollment, credential->username, NULL);
+        _credential_free(credential);
+    } else {
+        enrollment->failed++;
+        g_debug("Error enrolling %s on tag %s: %s", credential->username,
+                enrollment->tag_path, error->message);
+        _enrollment_progress(enrollment, credential->username, error);
+    }
+    g_clear_pointer(&enrollment->tag_path, g_free);
+    g_clear_error(&error);
+
+    if (g_cancellable_set_error_if_cancelled(g_task_get_cancellable(enrollment->task),
+                                             &error) == TRUE)
+        gtlm_nfc_enrollment_finish(enrollment, error);
+    else if (g_queue_is_empty(&enrollment->credentials))
+        gtlm_nfc_enrollment_finish(enrollment, NULL);
+}
+
+/* Writes the next credentials to a tag that has just become ready. Tags
+ * that become ready on other adapters while a write is in flight are left
+ * alone.
+ */
+void gtlm_nfc_enrollment_tag_ready(_Enrollment* enrollment, const gchar* tag_path)
+{
+    if (enrollment->tag_path != NULL) {
+        g_debug("Still enrolling on tag %s, skipping tag %s", enrollment->tag_path,
+                tag_path);
+        return;
+    }
+
+    _Credential* credential = g_queue_peek_head(&enrollment->credentials);
+    enrollment->tag_path = g_strdup(tag_path);
+
+    // written like any other write, so that it is checked and verified the
+    // same way
+    gtlm_nfc_issue_write(enrollment->self,
+                         enrollment->tag_path,
+                         credential->arguments,
+                         credential->message_size,
+                         enrollment->timeout_msec,
+                         enrollment->verify,
+                         g_task_new(NULL, g_task_get_cancellable(enrollment->task),
+                                    _on_enroll_write_done, enrollment));
+}
+
+static gboolean
+_start_enrollment (gpointer user_data)
+{
+    _Enrollment* enrollment = user_data;
+    GTlmNfc* self = enrollment->self;
+
+    gtlm_nfc_activate_engine(self);
+
+    if (self->priv->enrollment != NULL || self->priv->activation == ACTIVATION_SHUT_DOWN) {
+        g_task_return_new_error(enrollment->task, G_IO_ERROR,
+                                self->priv->enrollment != NULL ? G_IO_ERROR_BUSY : G_IO_ERROR_CLOSED,
+                                self->priv->enrollment != NULL ?
+                                    "Another enrollment is in progress" :
+                                    "gtlm_nfc_shutdown_async() was called");
+        _enrollment_free(enrollment);
+        return G_SOURCE_REMOVE;
+    }
+
+    GCancellable* cancellable = g_task_get_cancellable(enrollment->task);
+    if (cancellable != NULL) {
+        GMainContext* context = g_main_context_ref_thread_default();
+        enrollment->cancelled_source = g_cancellable_source_new(cancellable);
+        g_source_set_callback(enrollment->cancelled_source,
+                              (GSourceFunc)_on_enrollment_cancelled,
+                              enrollment, NULL);
+        g_source_attach(enrollment->cancelled_source, context);
+        g_main_context_unref(context);
+    }
+    enrollment->start_time = g_get_monotonic_time();
+    self->priv->enrollment = enrollment;
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_discard_enrollment (_Enrollment* enrollment)
+{
+    g_task_return_new_error(enrollment->task, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                            "GTlmNfc was disposed before the enrollment started");
+    _enrollment_free(enrollment);
+}
+
+/**
+ * GTlmNfcEnrollProgress:
+ * @tag_path: the tag that was written to
+ * @username: the username that was written
+ * @error: why the write failed, or %NULL if it succeeded
+ * @written: how many credentials have been written so far
+ * @failed: how many writes have failed so far
+ * @remaining: how many credentials are still to be written
+ * @elapsed_usec: the time since the enrollment started, in microseconds
+ * @tags_per_minute: the number of tags written per minute since the
+ * enrollment started
+ *
+ * A report on a write of a batch enrollment, see gtlm_nfc_enroll_async().
+ */
+/**
+ * GTlmNfcEnrollProgressCallback:
+ * @tlm_nfc: the #GTlmNfc that runs the enrollment
+ * @progress: the progress of the enrollment; only valid during the call
+ * @user_data: the data passed to gtlm_nfc_enroll_async()
+ *
+ * Called after each write of a batch enrollment.
+ */
+
+/**
+ * gtlm_nfc_enroll_async:
+ * @tlm_nfc: an instance of GTlmNfc object
+ * @usernames: a %NULL-terminated array of usernames to write
+ * @passwords: a %NULL-terminated array of passwords, one for each username
+ * @timeout_msec: the timeout in milliseconds for each write, or -1 to use
+ * the default D-Bus timeout
+ * @cancellable: (allow-none): a #GCancellable or %NULL
+ * @progress_callback: (allow-none): a #GTlmNfcEnrollProgressCallback to call
+ * after each write, or %NULL
+ * @progress_user_data: the data to pass to @progress_callback
+ * @callback: a #GAsyncReadyCallback to call when all credentials are written
+ * @user_data: the data to pass to @callback
+ *
+ * Writes a batch of credentials to successive tags: each tag found from now
+ * on gets the next username and password, until all of them are written.
+ * The credentials are encoded before this function returns, so a tag is
+ * written to as soon as it is ready (see #GTlmNfc::tag-ready). If a write fails, the same credentials
+ * are written to the next tag. Tags found while a write is in flight are
+ * skipped. Only one enrollment can be in progress at a time. Writes are
+ * verified if #GTlmNfc:verify-writes is set when this function is called.
+ *
+ * @progress_callback and @callback are called in the thread-default main
+ * context of the thread this function was called from.
+ * gtlm_nfc_enroll_finish() gives the result.
+ */
+void gtlm_nfc_enroll_async(GTlmNfc* tlm_nfc,
+                           const gchar* const* usernames,
+                           const gchar* const* passwords,
+                           gint timeout_msec,
+                           GCancellable* cancellable,
+                           GTlmNfcEnrollProgressCallback progress_callback,
+                           gpointer progress_user_data,
+                           GAsyncReadyCallback callback,
+                           gpointer user_data)
+{
+    g_return_if_fail (G_IS_TLM_NFC (tlm_nfc));
+    g_return_if_fail (usernames != NULL && passwords != NULL);
+    g_return_if_fail (g_strv_length((gchar**)usernames) ==
+                      g_strv_length((gchar**)passwords));
+
+    GTask* task = g_task_new(tlm_nfc, cancellable, callback, user_data);
+    g_task_set_source_tag(task, gtlm_nfc_enroll_async);
+
+    if (usernames[0] == NULL) {
+        g_task_return_boolean(task, TRUE);
+        g_object_unref(task);
+        return;
+    }
+
+    _Enrollment* enrollment = g_slice_new0(_Enrollment);
+    g_queue_init(&enrollment->credentials);
+    enrollment->self = gtlm_nfc_get_engine(tlm_nfc);
+    enrollment->task = task;
+    enrollment->timeout_msec = timeout_msec;
+    enrollment->verify = g_atomic_int_get(&tlm_nfc->priv->verify_writes);
+    enrollment->progress_callback = progress_callback;
+    enrollment->progress_user_data = progress_user_data;
+    enrollment->context = g_main_context_ref_thread_default();
+
+    for (guint i = 0; usernames[i] != NULL; i++) {
+        gsize message_size = 0;
+        GVariant* arguments = gtlm_nfc_new_write_arguments(usernames[i], passwords[i],
+                                                           &message_size);
+        if (arguments == NULL) {
+            g_task_return_new_error(task, GTLM_NFC_ERROR, GTLM_NFC_ERROR_CREDENTIALS_TOO_LONG,
+                                    "Username and password must be at most %d bytes long (%s)",
+                                    GTLM_NFC_PAYLOAD_MAX_FIELD_SIZE, usernames[i]);
+            _enrollment_free(enrollment);
+            return;
+        }
+
+        _Credential* credential = g_slice_new(_Credential);
+        credential->username = g_strdup(usernames[i]);
+        credential->arguments = arguments;
+        credential->message_size = message_size;
+        g_queue_push_tail(&enrollment->credentials, credential);
+    }
+
+    gtlm_nfc_invoke_engine(enrollment->self, _start_enrollment, enrollment,
+                           (GDestroyNotify)_discard_enrollment);
+}
+
+/**
+ * gtlm_nfc_enroll_finish:
+ * @tlm_nfc: an instance of GTlmNfc object
+ * @result: the #GAsyncResult passed to the callback
+ * @error: if non-NULL, set to an error, if one occurs
+ *
+ * Finishes an operation started with gtlm_nfc_enroll_async(). @error is set
+ * to %GTLM_NFC_ERROR_CREDENTIALS_TOO_LONG if any of the credentials do not
+ * fit on a tag, in which case nothing is written, and to
+ * %G_IO_ERROR_BUSY if another enrollment is in progress.
+ *
+ * Returns: %TRUE if all credentials have been written.
+ */
+gboolean gtlm_nfc_enroll_finish(GTlmNfc* tlm_nfc,
+                                GAsyncResult* result,
+                                GError** error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, tlm_nfc), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
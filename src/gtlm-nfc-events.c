@@ -0,0 +1,141 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "gtlm-nfc-events.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/* head and tail count the events pushed and popped so far; each is written
+ * by one side only, and the difference is the number of events in the ring.
+ * Events that find the ring full are only counted, and the count is handed
+ * to the consumer with the next event it takes.
+ * The eventfd counter is raised after every push and reset by the consumer
+ * before it looks at the ring, so a push can never go unnoticed.
+ */
+struct _GTlmNfcEventRing {
+    gint fd;
+    gint head;
+    gint tail;
+    gint dropped;
+
+    GTlmNfcEvent slots[GTLM_NFC_EVENT_RING_SIZE];
+};
+
+GTlmNfcEventRing* gtlm_nfc_event_ring_new(void)
+{
+    gint fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        g_debug("Error creating an eventfd: %s", g_strerror(errno));
+        return NULL;
+    }
+
+    GTlmNfcEventRing* ring = g_new0(GTlmNfcEventRing, 1);
+    ring->fd = fd;
+    return ring;
+}
+
+static void
+_wipe_password (GTlmNfcEvent* event)
+{
+    memset(event->password, 0, sizeof(event->password));
+}
+
+void gtlm_nfc_event_ring_free(GTlmNfcEventRing* ring)
+{
+    guint i;
+
+    for (i = 0; i < GTLM_NFC_EVENT_RING_SIZE; i++)
+        _wipe_password(&ring->slots[i]);
+    close(ring->fd);
+    g_free(ring);
+}
+
+gint gtlm_nfc_event_ring_get_fd(GTlmNfcEventRing* ring)
+{
+    return ring->fd;
+}
+
+void gtlm_nfc_event_ring_push(GTlmNfcEventRing* ring,
+                              GTlmNfcEventType type,
+                              const gchar* path,
+                              const gchar* username,
+                              const gchar* password,
+                              gint64 dead_time)
+{
+    guint head = (guint)ring->head;
+    guint tail = (guint)g_atomic_int_get(&ring->tail);
+
+    if (head - tail == GTLM_NFC_EVENT_RING_SIZE) {
+        g_atomic_int_inc(&ring->dropped);
+        return;
+    }
+
+    GTlmNfcEvent* event = &ring->slots[head % GTLM_NFC_EVENT_RING_SIZE];
+    event->type = type;
+    event->time = g_get_monotonic_time();
+    event->dead_time = dead_time;
+    event->flags = 0;
+    if (g_strlcpy(event->path, path != NULL ? path : "",
+                  sizeof(event->path)) >= sizeof(event->path))
+        event->flags |= GTLM_NFC_EVENT_PATH_TRUNCATED;
+    if (g_strlcpy(event->username, username != NULL ? username : "",
+                  sizeof(event->username)) >= sizeof(event->username))
+        event->flags |= GTLM_NFC_EVENT_USERNAME_TRUNCATED;
+    if (g_strlcpy(event->password, password != NULL ? password : "",
+                  sizeof(event->password)) >= sizeof(event->password))
+        event->flags |= GTLM_NFC_EVENT_PASSWORD_TRUNCATED;
+
+    g_atomic_int_set(&ring->head, (gint)(head + 1));
+
+    guint64 one = 1;
+    if (write(ring->fd, &one, sizeof(one)) < 0)
+        g_debug("Error signalling an event: %s", g_strerror(errno));
+}
+
+gboolean gtlm_nfc_event_ring_pop(GTlmNfcEventRing* ring, GTlmNfcEvent* event)
+{
+    guint tail = (guint)ring->tail;
+    guint head = (guint)g_atomic_int_get(&ring->head);
+
+    if (head == tail) {
+        // reset the eventfd first, then look again for a push that may have
+        // come in before the reset
+        guint64 count;
+        if (read(ring->fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            g_debug("Error reading the event counter: %s", g_strerror(errno));
+        head = (guint)g_atomic_int_get(&ring->head);
+        if (head == tail)
+            return FALSE;
+    }
+
+    GTlmNfcEvent* slot = &ring->slots[tail % GTLM_NFC_EVENT_RING_SIZE];
+    *event = *slot;
+    event->dropped = (guint)g_atomic_int_and((guint*)&ring->dropped, 0);
+    _wipe_password(slot);
+    g_atomic_int_set(&ring->tail, (gint)(tail + 1));
+    return TRUE;
+}
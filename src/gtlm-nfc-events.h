@@ -0,0 +1,61 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GTLM_NFC_EVENTS_H__
+#define __GTLM_NFC_EVENTS_H__
+
+#include "gtlm-nfc.h"
+
+/* Number of events buffered for gtlm_nfc_next_event(); a power of two */
+#define GTLM_NFC_EVENT_RING_SIZE 64
+
+/* A preallocated ring of events with an eventfd that is readable while the
+ * ring is not empty. There is one producer, the thread that talks to neard,
+ * and one consumer; neither takes a lock.
+ */
+typedef struct _GTlmNfcEventRing GTlmNfcEventRing;
+
+G_GNUC_INTERNAL
+GTlmNfcEventRing* gtlm_nfc_event_ring_new(void);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_event_ring_free(GTlmNfcEventRing* ring);
+
+G_GNUC_INTERNAL
+gint gtlm_nfc_event_ring_get_fd(GTlmNfcEventRing* ring);
+
+/* Only the strings that the event type carries are used */
+G_GNUC_INTERNAL
+void gtlm_nfc_event_ring_push(GTlmNfcEventRing* ring,
+                              GTlmNfcEventType type,
+                              const gchar* path,
+                              const gchar* username,
+                              const gchar* password,
+                              gint64 dead_time);
+
+G_GNUC_INTERNAL
+gboolean gtlm_nfc_event_ring_pop(GTlmNfcEventRing* ring, GTlmNfcEvent* event);
+
+#endif /* __GTLM_NFC_EVENTS_H__ */
@@ -0,0 +1,160 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "gtlm-nfc-marshal.h"
+
+typedef void (*_StringStringFunc) (gpointer instance,
+                                   const gchar* arg1,
+                                   const gchar* arg2,
+                                   gpointer data);
+
+typedef void (*_StringInt64Func) (gpointer instance,
+                                  const gchar* arg1,
+                                  gint64 arg2,
+                                  gpointer data);
+
+/* Works out which of the instance and the user data the callback takes
+ * first, as g_signal_connect_swapped() turns them around
+ */
+static void
+_get_data (GClosure* closure,
+           gpointer instance,
+           gpointer* data1,
+           gpointer* data2)
+{
+    if (G_CCLOSURE_SWAP_DATA (closure)) {
+        *data1 = closure->data;
+        *data2 = instance;
+    } else {
+        *data1 = instance;
+        *data2 = closure->data;
+    }
+}
+
+/* A string argument collected from a va_list belongs to the emitter, so it
+ * is copied unless the signal declares it G_SIGNAL_TYPE_STATIC_SCOPE
+ */
+static gchar*
+_collect_string (va_list* args,
+                 GType param_type,
+                 const gchar** value)
+{
+    *value = va_arg (*args, const gchar*);
+    if ((param_type & G_SIGNAL_TYPE_STATIC_SCOPE) != 0 || *value == NULL)
+        return NULL;
+    return g_strdup (*value);
+}
+
+void gtlm_nfc_marshal_VOID__STRING_STRING(GClosure* closure,
+                                          GValue* return_value,
+                                          guint n_param_values,
+                                          const GValue* param_values,
+                                          gpointer invocation_hint,
+                                          gpointer marshal_data)
+{
+    gpointer data1, data2;
+
+    g_return_if_fail (n_param_values == 3);
+
+    _get_data (closure, g_value_peek_pointer (param_values + 0), &data1, &data2);
+    _StringStringFunc callback = (_StringStringFunc) (marshal_data != NULL ?
+        marshal_data : ((GCClosure*) closure)->callback);
+    callback (data1,
+              g_value_get_string (param_values + 1),
+              g_value_get_string (param_values + 2),
+              data2);
+}
+
+void gtlm_nfc_marshal_VOID__STRING_STRINGv(GClosure* closure,
+                                           GValue* return_value,
+                                           gpointer instance,
+                                           va_list args,
+                                           gpointer marshal_data,
+                                           int n_params,
+                                           GType* param_types)
+{
+    gpointer data1, data2;
+    const gchar* arg1;
+    const gchar* arg2;
+    va_list args_copy;
+
+    G_VA_COPY (args_copy, args);
+    gchar* copy1 = _collect_string (&args_copy, param_types[0], &arg1);
+    gchar* copy2 = _collect_string (&args_copy, param_types[1], &arg2);
+    va_end (args_copy);
+
+    _get_data (closure, instance, &data1, &data2);
+    _StringStringFunc callback = (_StringStringFunc) (marshal_data != NULL ?
+        marshal_data : ((GCClosure*) closure)->callback);
+    callback (data1, arg1, arg2, data2);
+
+    g_free (copy1);
+    g_free (copy2);
+}
+
+void gtlm_nfc_marshal_VOID__STRING_INT64(GClosure* closure,
+                                         GValue* return_value,
+                                         guint n_param_values,
+                                         const GValue* param_values,
+                                         gpointer invocation_hint,
+                                         gpointer marshal_data)
+{
+    gpointer data1, data2;
+
+    g_return_if_fail (n_param_values == 3);
+
+    _get_data (closure, g_value_peek_pointer (param_values + 0), &data1, &data2);
+    _StringInt64Func callback = (_StringInt64Func) (marshal_data != NULL ?
+        marshal_data : ((GCClosure*) closure)->callback);
+    callback (data1,
+              g_value_get_string (param_values + 1),
+              g_value_get_int64 (param_values + 2),
+              data2);
+}
+
+void gtlm_nfc_marshal_VOID__STRING_INT64v(GClosure* closure,
+                                          GValue* return_value,
+                                          gpointer instance,
+                                          va_list args,
+                                          gpointer marshal_data,
+                                          int n_params,
+                                          GType* param_types)
+{
+    gpointer data1, data2;
+    const gchar* arg1;
+    va_list args_copy;
+
+    G_VA_COPY (args_copy, args);
+    gchar* copy1 = _collect_string (&args_copy, param_types[0], &arg1);
+    gint64 arg2 = va_arg (args_copy, gint64);
+    va_end (args_copy);
+
+    _get_data (closure, instance, &data1, &data2);
+    _StringInt64Func callback = (_StringInt64Func) (marshal_data != NULL ?
+        marshal_data : ((GCClosure*) closure)->callback);
+    callback (data1, arg1, arg2, data2);
+
+    g_free (copy1);
+}
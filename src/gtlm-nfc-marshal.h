@@ -0,0 +1,71 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GTLM_NFC_MARSHAL_H__
+#define __GTLM_NFC_MARSHAL_H__
+
+#include <glib-object.h>
+
+/* Typed marshallers for the signals of GTlmNfc that GObject has none for,
+ * so that emitting them does not go through the generic, libffi-based
+ * marshaller. The "v" variants are used by g_signal_emit() when it can
+ * skip collecting the arguments into GValues.
+ */
+
+G_GNUC_INTERNAL
+void gtlm_nfc_marshal_VOID__STRING_STRING(GClosure* closure,
+                                          GValue* return_value,
+                                          guint n_param_values,
+                                          const GValue* param_values,
+                                          gpointer invocation_hint,
+                                          gpointer marshal_data);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_marshal_VOID__STRING_STRINGv(GClosure* closure,
+                                           GValue* return_value,
+                                           gpointer instance,
+                                           va_list args,
+                                           gpointer marshal_data,
+                                           int n_params,
+                                           GType* param_types);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_marshal_VOID__STRING_INT64(GClosure* closure,
+                                         GValue* return_value,
+                                         guint n_param_values,
+                                         const GValue* param_values,
+                                         gpointer invocation_hint,
+                                         gpointer marshal_data);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_marshal_VOID__STRING_INT64v(GClosure* closure,
+                                          GValue* return_value,
+                                          gpointer instance,
+                                          va_list args,
+                                          gpointer marshal_data,
+                                          int n_params,
+                                          GType* param_types);
+
+#endif /* __GTLM_NFC_MARSHAL_H__ */
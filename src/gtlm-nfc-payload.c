@@ -0,0 +1,253 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of gtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "gtlm-nfc-payload.h"
+#include <string.h>
+
+/* Tags written by this library carry a compact binary record:
+ *
+ *   byte 0        GTLM_NFC_PAYLOAD_MAGIC
+ *   byte 1        format version
+ *   byte 2        flags, telling whether username and password are present
+ *   byte 3        length of the username
+ *   ...           username, UTF-8, not nul-terminated
+ *   next byte     length of the password
+ *   ...           password, UTF-8, not nul-terminated
+ *
+ * Earlier versions of the library wrote a base64-encoded "(msms)" GVariant
+ * instead. The magic byte is not a base64 character, so both kinds of
+ * payload can be told apart by their first byte.
+ */
+#define GTLM_NFC_PAYLOAD_MAGIC          0xa7
+#define GTLM_NFC_PAYLOAD_VERSION        1
+#define GTLM_NFC_PAYLOAD_HEADER_SIZE    3
+
+#define GTLM_NFC_PAYLOAD_HAS_USERNAME   (1 << 0)
+#define GTLM_NFC_PAYLOAD_HAS_PASSWORD   (1 << 1)
+
+/* neard puts the payload in a single MIME record of this type */
+#define GTLM_NFC_PAYLOAD_RECORD_TYPE    "application/gtlm-nfc"
+
+gsize gtlm_nfc_payload_get_size(const gchar* username,
+                                const gchar* password)
+{
+    gsize username_len = username != NULL ? strlen(username) : 0;
+    gsize password_len = password != NULL ? strlen(password) : 0;
+
+    if (username_len > GTLM_NFC_PAYLOAD_MAX_FIELD_SIZE ||
+            password_len > GTLM_NFC_PAYLOAD_MAX_FIELD_SIZE)
+        return 0;
+    return GTLM_NFC_PAYLOAD_HEADER_SIZE + 2 + username_len + password_len;
+}
+
+/* The record header is a flags byte, the type length, and the payload
+ * length: one byte in a short record, four otherwise.
+ */
+gsize gtlm_nfc_payload_get_message_size(gsize payload_size)
+{
+    gsize header_size = 2 + (payload_size <= G_MAXUINT8 ? 1 : 4);
+
+    return header_size + strlen(GTLM_NFC_PAYLOAD_RECORD_TYPE) + payload_size;
+}
+
+guint8* gtlm_nfc_payload_encode(const gchar* username,
+                                const gchar* password,
+                                gsize* size)
+{
+    gsize username_len = username != NULL ? strlen(username) : 0;
+    gsize password_len = password != NULL ? strlen(password) : 0;
+    gsize payload_size = gtlm_nfc_payload_get_size(username, password);
+
+    if (payload_size == 0)
+        return NULL;
+
+    guint8* out = g_malloc(payload_size);
+    guint8* p = out;
+
+    *p++ = GTLM_NFC_PAYLOAD_MAGIC;
+    *p++ = GTLM_NFC_PAYLOAD_VERSION;
+    *p++ = (username != NULL ? GTLM_NFC_PAYLOAD_HAS_USERNAME : 0) |
+           (password != NULL ? GTLM_NFC_PAYLOAD_HAS_PASSWORD : 0);
+    *p++ = username_len;
+    if (username_len > 0)
+        memcpy(p, username, username_len);
+    p += username_len;
+    *p++ = password_len;
+    if (password_len > 0)
+        memcpy(p, password, password_len);
+    p += password_len;
+
+    *size = p - out;
+    return out;
+}
+
+static guchar*
+_payload_buffer(GTlmNfcPayload* payload, gsize size)
+{
+    if (size <= sizeof(payload->data))
+        return payload->data;
+    payload->heap_data = g_malloc(size);
+    return payload->heap_data;
+}
+
+static gboolean
+_decode_compact(GTlmNfcPayload* payload, const guint8* data, gsize size)
+{
+    if (size < GTLM_NFC_PAYLOAD_HEADER_SIZE + 2) {
+        g_debug("Payload is too short");
+        return FALSE;
+    }
+    if (data[1] != GTLM_NFC_PAYLOAD_VERSION) {
+        g_debug("Unsupported payload version %d", data[1]);
+        return FALSE;
+    }
+
+    guint8 flags = data[2];
+    gsize offset = GTLM_NFC_PAYLOAD_HEADER_SIZE;
+
+    gsize username_len = data[offset++];
+    if (offset + username_len + 1 > size) {
+        g_debug("Username in the payload is truncated");
+        return FALSE;
+    }
+    const gchar* username = (const gchar*)data + offset;
+    offset += username_len;
+
+    gsize password_len = data[offset++];
+    if (offset + password_len > size) {
+        g_debug("Password in the payload is truncated");
+        return FALSE;
+    }
+    const gchar* password = (const gchar*)data + offset;
+
+    if (!g_utf8_validate(username, username_len, NULL) ||
+            !g_utf8_validate(password, password_len, NULL)) {
+        g_debug("Payload is not valid UTF-8");
+        return FALSE;
+    }
+
+    // the strings are stored without terminators, so they are copied once,
+    // into the payload's own buffer
+    payload->size = username_len + password_len + 2;
+    gchar* out = (gchar*)_payload_buffer(payload, payload->size);
+    memcpy(out, username, username_len);
+    out[username_len] = '\0';
+    memcpy(out + username_len + 1, password, password_len);
+    out[username_len + 1 + password_len] = '\0';
+
+    if (flags & GTLM_NFC_PAYLOAD_HAS_USERNAME)
+        payload->username = out;
+    if (flags & GTLM_NFC_PAYLOAD_HAS_PASSWORD)
+        payload->password = out + username_len + 1;
+    return TRUE;
+}
+
+static gboolean
+_decode_legacy(GTlmNfcPayload* payload, const guint8* data, gsize size)
+{
+    // the payload is written as a bytestring, so it carries a trailing nul
+    while (size > 0 && data[size - 1] == '\0')
+        size--;
+
+    guchar* out = _payload_buffer(payload, (size / 4) * 3 + 3);
+
+    gint state = 0;
+    guint save = 0;
+    payload->size = g_base64_decode_step((const gchar*)data, size, out, &state, &save);
+
+    payload->variant = g_variant_ref_sink(g_variant_new_from_data(G_VARIANT_TYPE("(msms)"),
+                                                                  out,
+                                                                  payload->size,
+                                                                  FALSE,
+                                                                  NULL,
+                                                                  NULL));
+    if (!g_variant_is_normal_form(payload->variant)) {
+        g_debug("Couldn't decode Payload data to variant");
+        return FALSE;
+    }
+
+    g_variant_get(payload->variant, "(m&sm&s)", &payload->username, &payload->password);
+    return TRUE;
+}
+
+/* Returns the Payload entry of the argument of an org.neard.NDEFAgent.GetNDEF
+ * call. It shares its data with @parameters, so the payload bytes are never
+ * copied.
+ */
+GVariant* gtlm_nfc_payload_lookup(GVariant* parameters)
+{
+    GVariant* parameters_dict = g_variant_get_child_value(parameters, 0);
+    if (parameters_dict == NULL)
+    {
+        g_debug ("Error getting parameters dict");
+        return NULL;
+    }
+
+    GVariant* payload_v = g_variant_lookup_value(parameters_dict, "Payload",
+                                                 G_VARIANT_TYPE_BYTESTRING);
+    if (payload_v == NULL)
+        g_debug ("Error getting raw Payload data");
+    g_variant_unref(parameters_dict);
+    return payload_v;
+}
+
+/* Decodes a payload read from a tag, in either the compact or the legacy
+ * format. The payload is only borrowed; the username and password point into
+ * @payload's own buffer and stay valid until gtlm_nfc_payload_clear() is
+ * called.
+ */
+gboolean gtlm_nfc_payload_decode(GTlmNfcPayload* payload,
+                                 const guint8* data,
+                                 gsize size)
+{
+    payload->username = NULL;
+    payload->password = NULL;
+    payload->variant = NULL;
+    payload->heap_data = NULL;
+    payload->size = 0;
+
+    if (size > 0 && data[0] == GTLM_NFC_PAYLOAD_MAGIC)
+        return _decode_compact(payload, data, size);
+    return _decode_legacy(payload, data, size);
+}
+
+void gtlm_nfc_payload_clear(GTlmNfcPayload* payload)
+{
+    if (payload->variant != NULL) {
+        g_variant_unref(payload->variant);
+        payload->variant = NULL;
+    }
+    // do not leave decoded credentials lying around on the stack
+    if (payload->heap_data != NULL) {
+        memset(payload->heap_data, 0, payload->size);
+        g_free(payload->heap_data);
+        payload->heap_data = NULL;
+    } else {
+        memset(payload->data, 0, payload->size);
+    }
+    payload->username = NULL;
+    payload->password = NULL;
+    payload->size = 0;
+}
@@ -0,0 +1,77 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GTLM_NFC_PAYLOAD_H__
+#define __GTLM_NFC_PAYLOAD_H__
+
+#include <glib.h>
+
+/* NDEF messages on the tags we support are well below this size, so a
+ * decoded payload normally fits in GTlmNfcPayload's own buffer.
+ */
+#define GTLM_NFC_PAYLOAD_BUFFER_SIZE 512
+
+typedef struct {
+    const gchar* username;
+    const gchar* password;
+
+    /*< private >*/
+    GVariant* variant;
+    guchar* heap_data;
+    gsize size;
+    guchar data[GTLM_NFC_PAYLOAD_BUFFER_SIZE];
+} GTlmNfcPayload;
+
+/* Longest username or password that fits in a payload */
+#define GTLM_NFC_PAYLOAD_MAX_FIELD_SIZE G_MAXUINT8
+
+/* Size of the payload for @username and @password, or 0 if they are too
+ * long
+ */
+G_GNUC_INTERNAL
+gsize gtlm_nfc_payload_get_size(const gchar* username,
+                                const gchar* password);
+
+/* Size of the NDEF message that carries a payload of @payload_size bytes */
+G_GNUC_INTERNAL
+gsize gtlm_nfc_payload_get_message_size(gsize payload_size);
+
+G_GNUC_INTERNAL
+guint8* gtlm_nfc_payload_encode(const gchar* username,
+                                const gchar* password,
+                                gsize* size);
+
+G_GNUC_INTERNAL
+GVariant* gtlm_nfc_payload_lookup(GVariant* parameters);
+
+G_GNUC_INTERNAL
+gboolean gtlm_nfc_payload_decode(GTlmNfcPayload* payload,
+                                 const guint8* data,
+                                 gsize size);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_payload_clear(GTlmNfcPayload* payload);
+
+#endif /* __GTLM_NFC_PAYLOAD_H__ */
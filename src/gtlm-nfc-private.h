@@ -0,0 +1,223 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GTLM_NFC_PRIVATE_H__
+#define __GTLM_NFC_PRIVATE_H__
+
+#include "gtlm-nfc.h"
+
+/* The state of a GTlmNfc that is not part of the API, shared by the units
+ * of the library. It is not installed.
+ */
+struct _GTlmNfcPrivate
+{
+    GDBusObjectManager* neard_manager;
+    GDBusConnection* system_bus;
+    guint agent_registration_id;
+    GHashTable* adapters;
+    guint adapters_pending;
+    GHashTable* tags;
+    gboolean deferred_dispatch;
+    gboolean worker_thread;
+    struct _GTlmNfcWorker* worker;
+    struct _GTlmNfcMailbox* events;
+    GThread* engine_thread;
+    struct _GTlmNfcMailbox* commands;
+    struct _GTlmNfcEventRing* event_ring;
+    gboolean lazy;
+    guint idle_timeout;
+    guint tag_settle_time;
+    gboolean verify_writes;
+    gboolean direct_records;
+    gint activation;
+    GTlmNfcPollMode poll_mode;
+    GHashTable* poll_policies;
+    gboolean shared;
+    GTlmNfc* engine;
+    gboolean fan_out;
+    gboolean ready;
+    gboolean init_pending;
+    GMainContext* init_context;
+    GError* init_error;
+    GList* init_waiters;
+    GMutex subscribers_lock;
+    GList* subscribers;
+    GWeakRef* subscription;
+    gboolean greeted;
+    gboolean adapters_announced;
+    GSource* default_init;
+    guint neard_watch_id;
+    gboolean agent_registered;
+    gint64 recovery_start;
+    struct _GTlmNfcEnrollment* enrollment;
+    GTlmNfcStats stats;
+    GMutex stats_lock;
+};
+
+enum {
+    SIG_TAG_FOUND,
+    SIG_TAG_LOST,
+    SIG_RECORD_FOUND,
+    SIG_NO_RECORD_FOUND,
+    SIG_ADAPTER_REARMED,
+    SIG_ADAPTERS_READY,
+    SIG_TAG_READY,
+
+    SIG_MAX
+};
+
+/* How far the connection to neard has got, see GTlmNfc:lazy and
+ * gtlm_nfc_shutdown_async()
+ */
+enum {
+    ACTIVATION_NONE,
+    ACTIVATION_PENDING,
+    ACTIVATION_DONE,
+    ACTIVATION_SHUT_DOWN
+};
+
+G_GNUC_INTERNAL
+GTlmNfc* gtlm_nfc_get_engine(GTlmNfc* self);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_invoke_engine(GTlmNfc* self,
+                            GSourceFunc func,
+                            gpointer data,
+                            GDestroyNotify discard);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_activate_engine(GTlmNfc* self);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_emit_signal(GTlmNfc* self,
+                          guint signal,
+                          const gchar* path,
+                          const gchar* username,
+                          const gchar* password,
+                          gint64 value);
+
+G_GNUC_INTERNAL
+GVariant* gtlm_nfc_new_write_arguments(const gchar* username,
+                                       const gchar* password,
+                                       gsize* message_size);
+
+/* Writes to a tag that neard has finished reading, checked and verified
+ * like any other write; @task gets the result
+ */
+G_GNUC_INTERNAL
+void gtlm_nfc_issue_write(GTlmNfc* self,
+                          const gchar* tag_path,
+                          GVariant* arguments,
+                          gsize message_size,
+                          gint timeout_msec,
+                          gboolean verify,
+                          GTask* task);
+
+/* An NFC adapter and what its poll policy needs to know about it; the
+ * adapters of a GTlmNfc are indexed by object path. The times are
+ * monotonic, and the statistics are read under the stats lock.
+ */
+typedef struct _GTlmNfcAdapter GTlmNfcAdapter;
+
+struct _GTlmNfcAdapter
+{
+    GTlmNfc* self;
+    GDBusProxy* proxy;
+    gboolean powered;
+    gboolean polling;
+    gchar* mode;
+    guint n_tags;
+
+    /* the setup in flight, if any */
+    struct _GTlmNfcAdapterSetup* setup;
+
+    /* stopped by the idle timeout of its poll policy */
+    gboolean dormant;
+    GSource* idle_source;
+
+    /* time spent polling, as reported by neard */
+    gint64 created;
+    gint64 polling_since;
+    gint64 polling_total;
+
+    /* poll loop re-arm after a tag has gone away */
+    gboolean rearm_pending;
+    gint64 rearm_start;
+    gint64 rearm_last;
+    gint64 rearm_max;
+    gint64 rearm_total;
+    guint rearm_count;
+};
+
+/* gtlm-nfc-adapters.c */
+
+/* Creates the tables of adapters and poll policies */
+G_GNUC_INTERNAL
+void gtlm_nfc_adapters_init(GTlmNfc* self);
+
+G_GNUC_INTERNAL
+GTlmNfcAdapter* gtlm_nfc_adapter_index(GTlmNfc* self, GDBusProxy* proxy);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_adapter_remove(GTlmNfc* self, const gchar* adapter_path);
+
+G_GNUC_INTERNAL
+GTlmNfcAdapter* gtlm_nfc_adapter_lookup_for_tag(GTlmNfc* self, GDBusProxy* tag);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_adapter_update(GTlmNfcAdapter* adapter,
+                             const gchar* property_name,
+                             GVariant* value);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_adapter_setup(GTlmNfc* self, GTlmNfcAdapter* adapter);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_adapter_rearm(GTlmNfc* self, GTlmNfcAdapter* adapter);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_adapter_rearm_complete(GTlmNfc* self, GTlmNfcAdapter* adapter);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_adapter_touch(GTlmNfcAdapter* adapter);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_adapters_touch(GTlmNfc* self);
+
+/* Restarts polling on the adapters stopped for inactivity */
+G_GNUC_INTERNAL
+void gtlm_nfc_adapters_wake(GTlmNfc* self);
+
+/* gtlm-nfc-enrollment.c */
+
+G_GNUC_INTERNAL
+void gtlm_nfc_enrollment_tag_ready(struct _GTlmNfcEnrollment* enrollment,
+                                   const gchar* tag_path);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_enrollment_finish(struct _GTlmNfcEnrollment* enrollment,
+                                GError* error);
+
+#endif /* __GTLM_NFC_PRIVATE_H__ */
@@ -0,0 +1,62 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "gtlm-nfc-proxy.h"
+
+/* Interned once, so that looking up an interface name is a single hash
+ * lookup that does not intern the names of interfaces we do not use.
+ */
+static GQuark _adapter_quark;
+static GQuark _tag_quark;
+static GQuark _record_quark;
+
+static void
+_intern_interface_names (void)
+{
+    static gsize interned = 0;
+
+    if (g_once_init_enter(&interned)) {
+        _adapter_quark = g_quark_from_static_string("org.neard.Adapter");
+        _tag_quark = g_quark_from_static_string("org.neard.Tag");
+        _record_quark = g_quark_from_static_string("org.neard.Record");
+        g_once_init_leave(&interned, 1);
+    }
+}
+
+GTlmNfcProxyKind gtlm_nfc_proxy_get_kind (gpointer interface)
+{
+    if (!G_IS_DBUS_PROXY(interface))
+        return GTLM_NFC_PROXY_OTHER;
+
+    _intern_interface_names();
+    GQuark quark = g_quark_try_string(g_dbus_proxy_get_interface_name(interface));
+    if (quark == _adapter_quark)
+        return GTLM_NFC_PROXY_ADAPTER;
+    if (quark == _tag_quark)
+        return GTLM_NFC_PROXY_TAG;
+    if (quark == _record_quark)
+        return GTLM_NFC_PROXY_RECORD;
+    return GTLM_NFC_PROXY_OTHER;
+}
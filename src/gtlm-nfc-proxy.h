@@ -0,0 +1,45 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GTLM_NFC_PROXY_H__
+#define __GTLM_NFC_PROXY_H__
+
+#include <gio/gio.h>
+
+/* The neard interfaces the library uses. Handlers dispatch on the interned
+ * name of a proxy's interface instead of comparing strings; everything
+ * else neard exports is of kind GTLM_NFC_PROXY_OTHER.
+ */
+typedef enum {
+    GTLM_NFC_PROXY_OTHER = 0,
+    GTLM_NFC_PROXY_ADAPTER,
+    GTLM_NFC_PROXY_TAG,
+    GTLM_NFC_PROXY_RECORD
+} GTlmNfcProxyKind;
+
+G_GNUC_INTERNAL
+GTlmNfcProxyKind gtlm_nfc_proxy_get_kind (gpointer interface);
+
+#endif /* __GTLM_NFC_PROXY_H__ */
@@ -0,0 +1,234 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "gtlm-nfc-worker.h"
+
+/* The mailbox keeps posted messages on a stack, newest first, that producers
+ * push onto with a compare-and-swap. The source detaches the whole stack at
+ * once and reverses it, so neither side ever waits for the other. Only a
+ * post onto an empty stack needs to wake the consumer up.
+ */
+struct _GTlmNfcMailbox {
+    GSource source;
+
+    GTlmNfcMessage* head;
+    GTlmNfcMessageFunc deliver;
+    GTlmNfcMessageFunc discard;
+    gpointer user_data;
+};
+
+static GTlmNfcMessage*
+_mailbox_take (GTlmNfcMailbox* mailbox)
+{
+    GTlmNfcMessage* head;
+    GTlmNfcMessage* messages = NULL;
+
+    do {
+        head = g_atomic_pointer_get(&mailbox->head);
+    } while (!g_atomic_pointer_compare_and_exchange(&mailbox->head, head, NULL));
+
+    while (head != NULL) {
+        GTlmNfcMessage* next = head->next;
+        head->next = messages;
+        messages = head;
+        head = next;
+    }
+    return messages;
+}
+
+static gboolean
+_mailbox_dispatch (GSource* source, GSourceFunc callback, gpointer user_data)
+{
+    GTlmNfcMailbox* mailbox = (GTlmNfcMailbox*)source;
+
+    // re-armed by the next post onto an empty stack
+    g_source_set_ready_time(source, -1);
+
+    GTlmNfcMessage* message = _mailbox_take(mailbox);
+    while (message != NULL) {
+        GTlmNfcMessage* next = message->next;
+        mailbox->deliver(message, mailbox->user_data);
+        message = next;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+_mailbox_finalize (GSource* source)
+{
+    GTlmNfcMailbox* mailbox = (GTlmNfcMailbox*)source;
+
+    GTlmNfcMessage* message = _mailbox_take(mailbox);
+    while (message != NULL) {
+        GTlmNfcMessage* next = message->next;
+        mailbox->discard(message, mailbox->user_data);
+        message = next;
+    }
+}
+
+static GSourceFuncs mailbox_source_funcs = {
+    NULL,
+    NULL,
+    _mailbox_dispatch,
+    _mailbox_finalize
+};
+
+GTlmNfcMailbox* gtlm_nfc_mailbox_new(GMainContext* context,
+                                     GTlmNfcMessageFunc deliver,
+                                     GTlmNfcMessageFunc discard,
+                                     gpointer user_data)
+{
+    GSource* source = g_source_new(&mailbox_source_funcs, sizeof(GTlmNfcMailbox));
+    GTlmNfcMailbox* mailbox = (GTlmNfcMailbox*)source;
+
+    mailbox->deliver = deliver;
+    mailbox->discard = discard;
+    mailbox->user_data = user_data;
+    g_source_set_name(source, "GTlmNfcMailbox");
+    g_source_set_priority(source, G_PRIORITY_DEFAULT);
+    g_source_attach(source, context);
+    return mailbox;
+}
+
+void gtlm_nfc_mailbox_post(GTlmNfcMailbox* mailbox, GTlmNfcMessage* message)
+{
+    GTlmNfcMessage* head;
+
+    do {
+        head = g_atomic_pointer_get(&mailbox->head);
+        message->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange(&mailbox->head, head, message));
+
+    if (head == NULL)
+        g_source_set_ready_time(&mailbox->source, 0);
+}
+
+void gtlm_nfc_mailbox_free(GTlmNfcMailbox* mailbox)
+{
+    g_source_destroy(&mailbox->source);
+    g_source_unref(&mailbox->source);
+}
+
+struct _GTlmNfcWorker {
+    GMainLoop* loop;
+    GThread* thread;
+};
+
+static gpointer
+_worker_thread (gpointer data)
+{
+    // the thread keeps its own reference, as it may outlive the worker
+    GMainLoop* loop = data;
+    GMainContext* context = g_main_loop_get_context(loop);
+
+    g_main_context_push_thread_default(context);
+    g_main_loop_run(loop);
+    g_main_context_pop_thread_default(context);
+    g_main_loop_unref(loop);
+    return NULL;
+}
+
+static gboolean
+_worker_started (gpointer data)
+{
+    return G_SOURCE_REMOVE;
+}
+
+GTlmNfcWorker* gtlm_nfc_worker_new(const gchar* name)
+{
+    GTlmNfcWorker* worker = g_slice_new0(GTlmNfcWorker);
+    GMainContext* context = g_main_context_new();
+
+    worker->loop = g_main_loop_new(context, FALSE);
+    g_main_context_unref(context);
+    worker->thread = g_thread_new(name, _worker_thread, g_main_loop_ref(worker->loop));
+
+    // a quit before the loop runs would be lost
+    gtlm_nfc_worker_invoke_sync(worker, _worker_started, NULL);
+    return worker;
+}
+
+GMainContext* gtlm_nfc_worker_get_context(GTlmNfcWorker* worker)
+{
+    return g_main_loop_get_context(worker->loop);
+}
+
+typedef struct {
+    GSourceFunc func;
+    gpointer data;
+    GMutex lock;
+    GCond cond;
+    gboolean done;
+} _Invocation;
+
+static gboolean
+_invocation_dispatch (gpointer user_data)
+{
+    _Invocation* invocation = user_data;
+
+    invocation->func(invocation->data);
+
+    g_mutex_lock(&invocation->lock);
+    invocation->done = TRUE;
+    g_cond_signal(&invocation->cond);
+    g_mutex_unlock(&invocation->lock);
+    return G_SOURCE_REMOVE;
+}
+
+void gtlm_nfc_worker_invoke_sync(GTlmNfcWorker* worker,
+                                 GSourceFunc func,
+                                 gpointer data)
+{
+    GMainContext* context = gtlm_nfc_worker_get_context(worker);
+
+    if (g_main_context_is_owner(context)) {
+        func(data);
+        return;
+    }
+
+    _Invocation invocation = { func, data };
+    g_mutex_init(&invocation.lock);
+    g_cond_init(&invocation.cond);
+
+    g_main_context_invoke(context, _invocation_dispatch, &invocation);
+    g_mutex_lock(&invocation.lock);
+    while (invocation.done == FALSE)
+        g_cond_wait(&invocation.cond, &invocation.lock);
+    g_mutex_unlock(&invocation.lock);
+
+    g_mutex_clear(&invocation.lock);
+    g_cond_clear(&invocation.cond);
+}
+
+void gtlm_nfc_worker_free(GTlmNfcWorker* worker)
+{
+    g_main_loop_quit(worker->loop);
+    if (g_thread_self() == worker->thread)
+        g_thread_unref(worker->thread);
+    else
+        g_thread_join(worker->thread);
+    g_main_loop_unref(worker->loop);
+    g_slice_free(GTlmNfcWorker, worker);
+}
@@ -0,0 +1,83 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __GTLM_NFC_WORKER_H__
+#define __GTLM_NFC_WORKER_H__
+
+#include <glib.h>
+
+/* A message passed between threads. It is meant to be embedded as the first
+ * member of a larger structure, so queueing it does not allocate.
+ */
+typedef struct _GTlmNfcMessage GTlmNfcMessage;
+
+struct _GTlmNfcMessage {
+    GTlmNfcMessage* next;
+};
+
+typedef void (*GTlmNfcMessageFunc) (GTlmNfcMessage* message, gpointer user_data);
+
+/* A lock-free queue that any number of threads post messages to, and that
+ * is drained by a source attached to one main context. Messages are
+ * delivered in the order they were posted by each thread; the ones still
+ * queued when the mailbox is freed are passed to the discard function.
+ */
+typedef struct _GTlmNfcMailbox GTlmNfcMailbox;
+
+G_GNUC_INTERNAL
+GTlmNfcMailbox* gtlm_nfc_mailbox_new(GMainContext* context,
+                                     GTlmNfcMessageFunc deliver,
+                                     GTlmNfcMessageFunc discard,
+                                     gpointer user_data);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_mailbox_post(GTlmNfcMailbox* mailbox, GTlmNfcMessage* message);
+
+G_GNUC_INTERNAL
+void gtlm_nfc_mailbox_free(GTlmNfcMailbox* mailbox);
+
+/* A thread running a main loop on its own main context */
+typedef struct _GTlmNfcWorker GTlmNfcWorker;
+
+G_GNUC_INTERNAL
+GTlmNfcWorker* gtlm_nfc_worker_new(const gchar* name);
+
+G_GNUC_INTERNAL
+GMainContext* gtlm_nfc_worker_get_context(GTlmNfcWorker* worker);
+
+/* Runs @func on the worker thread and waits for it to return */
+G_GNUC_INTERNAL
+void gtlm_nfc_worker_invoke_sync(GTlmNfcWorker* worker,
+                                 GSourceFunc func,
+                                 gpointer data);
+
+/* Stops the main loop. The thread is joined unless this is called from the
+ * worker thread itself, in which case it exits once the caller returns to
+ * the main loop.
+ */
+G_GNUC_INTERNAL
+void gtlm_nfc_worker_free(GTlmNfcWorker* worker);
+
+#endif /* __GTLM_NFC_WORKER_H__ */
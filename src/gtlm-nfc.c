@@ -24,7 +24,14 @@
  */
 
 #include "gtlm-nfc.h"
+#include "gtlm-nfc-private.h"
+#include "gtlm-nfc-payload.h"
+#include "gtlm-nfc-worker.h"
+#include "gtlm-nfc-events.h"
+#include "gtlm-nfc-proxy.h"
+#include "gtlm-nfc-marshal.h"
 #include <gio/gio.h>
+#include <string.h>
 
 GQuark
 gtlm_nfc_error_quark (void)
@@ -32,8 +39,6 @@ gtlm_nfc_error_quark (void)
     return g_quark_from_static_string ("gtlm-nfc");
 }
 
-#define GTLM_NFC_ERROR   (gtlm_nfc_error_quark())
-
 /**
  * SECTION:gtlm-nfc
  * @short_description: a helper object that provides NFC functionality to user management code
@@ -43,16 +48,93 @@ gtlm_nfc_error_quark (void)
  * and authenticate users through them. It provides signals to listen for tags
  * appearing and disappearing, and for reading and writing username/password pairs 
  * to tags.
+ *
+ * #GTlmNfc implements #GInitable and #GAsyncInitable; create it with
+ * gtlm_nfc_new() or gtlm_nfc_new_async() so that setup errors (no system bus,
+ * neard not running) are reported to the caller. An object created with
+ * plain g_object_new() still sets itself up, once the thread-default main
+ * context it was created in runs, but setup errors are only logged. Once set up, #GTlmNfc
+ * survives neard restarts: tags in range are reported as lost when neard goes
+ * away, and the agent and the adapters are set up again when it comes back.
+ *
+ * As neard takes one NDEF agent per record type, only one #GTlmNfc can
+ * talk to neard at a time. Any number of them can be created in a process
+ * with #GTlmNfc:shared set, in which case they share a single connection to
+ * neard and get their signals from it.
+ *
+ * The functions operating on a #GTlmNfc can be called from any thread. The
+ * work is handed over to the thread that talks to neard: the one whose
+ * thread-default main context #GTlmNfc was created in, or its own thread if
+ * #GTlmNfc:worker-thread is set. Calls from other threads therefore only
+ * complete while that main context is running. Asynchronous calls complete
+ * in the thread-default main context of the thread that made them. The
+ * statistics getters, gtlm_nfc_get_stats(), gtlm_nfc_get_polling_time()
+ * and gtlm_nfc_get_rearm_time(), are the exception: they copy the figures
+ * under a lock and never wait for that main context.
  */
 /**
  * GTlmNfcError:
  * @GTLM_NFC_ERROR_NONE: No error
  * @GTLM_NFC_ERROR_NO_TAG: Issued when attempting to write to an absent tag
+ * @GTLM_NFC_ERROR_CREDENTIALS_TOO_LONG: Issued when a username or password is
+ * too long to be stored on a tag
+ * @GTLM_NFC_ERROR_TAG_READ_ONLY: Issued when attempting to write to a
+ * read-only tag
+ * @GTLM_NFC_ERROR_TAG_TOO_SMALL: Issued when a username and password do not
+ * fit on a tag of its type
+ * @GTLM_NFC_ERROR_VERIFY_FAILED: Issued when a tag does not read back what
+ * was written to it, see #GTlmNfc:verify-writes
  * 
  * This enum provides a list of errors that libtlm-nfc returns.
  * 
  */
 
+/**
+ * GTlmNfcStage:
+ * @GTLM_NFC_STAGE_TAG_TO_AGENT: from neard announcing a tag to neard calling
+ * the NDEF agent with its record, or with #GTlmNfc:direct-records, to
+ * whichever of the agent call and the record object comes first
+ * @GTLM_NFC_STAGE_DECODE: from the agent call to the record being decoded;
+ * with #GTlmNfc:deferred-dispatch this includes waiting for the idle source
+ * @GTLM_NFC_STAGE_DISPATCH: from the record being decoded to #GTlmNfc::record-found
+ * being emitted
+ * @GTLM_NFC_STAGE_HANDLERS: time spent in the #GTlmNfc::record-found handlers;
+ * with #GTlmNfc:worker-thread, the time spent queueing the signal
+ * @GTLM_NFC_STAGE_TOTAL: from neard announcing a tag to the
+ * #GTlmNfc::record-found handlers returning
+ * @GTLM_NFC_N_STAGES: the number of stages
+ *
+ * The stages a tag goes through on its way from neard to the
+ * #GTlmNfc::record-found handlers.
+ */
+/**
+ * GTlmNfcHistogram:
+ * @count: the number of samples
+ * @min_usec: the shortest sample
+ * @max_usec: the longest sample
+ * @total_usec: the sum of all samples
+ * @buckets: sample counts; bucket 0 holds samples below 1 microsecond, and
+ * bucket n holds samples from 2^(n-1) to 2^n - 1 microseconds. The last bucket
+ * also holds all longer samples.
+ *
+ * A latency histogram with fixed, logarithmic buckets.
+ */
+/**
+ * GTlmNfcStats:
+ * @stages: a histogram for each #GTlmNfcStage
+ * @recovery: for each time neard came back after going away, the time until
+ * a tag could be read again, i.e. until the agent was registered with the
+ * new neard and one of its adapters was polling
+ *
+ * Latency statistics of the tag to credential pipeline, see
+ * gtlm_nfc_get_stats().
+ */
+/**
+ * GTLM_NFC_HISTOGRAM_BUCKETS:
+ *
+ * The number of buckets in a #GTlmNfcHistogram.
+ */
+
 /**
  * GTlmNfc:
  *
@@ -65,639 +147,2897 @@ gtlm_nfc_error_quark (void)
  * Opaque #GTlmNfcClass data structure.
  */
 
+static void gtlm_nfc_initable_iface_init (GInitableIface *iface);
+static void gtlm_nfc_async_initable_iface_init (GAsyncInitableIface *iface);
+
 G_DEFINE_TYPE_WITH_CODE (GTlmNfc, gtlm_nfc, 
                          G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE,
+                                                gtlm_nfc_initable_iface_init)
+                         G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE,
+                                                gtlm_nfc_async_initable_iface_init)
                          );
 
+G_DEFINE_BOXED_TYPE (GTlmNfcStats, gtlm_nfc_stats,
+                     gtlm_nfc_stats_copy, gtlm_nfc_stats_free);
+
 enum
 {
-    PROP_0
-    
+    PROP_0,
+    PROP_DEFERRED_DISPATCH,
+    PROP_WORKER_THREAD,
+    PROP_LAZY,
+    PROP_IDLE_TIMEOUT,
+    PROP_TAG_SETTLE_TIME,
+    PROP_VERIFY_WRITES,
+    PROP_DIRECT_RECORDS,
+    PROP_SHARED,
+    PROP_STATS,
+    PROP_AVERAGE_LATENCY,
+    PROP_MAX_LATENCY,
+
+    N_PROPERTIES
 };
 
-enum {
-    SIG_TAG_FOUND,
-    SIG_TAG_LOST,
-    SIG_RECORD_FOUND,
-    SIG_NO_RECORD_FOUND,
- 
-    SIG_MAX
-};
+static GParamSpec *properties[N_PROPERTIES];
 
 static guint signals[SIG_MAX];
 
+/* A tag is ready once neard has finished reading it; writes issued before
+ * then wait in @pending_writes. Tags that were present when we started
+ * are ready right away.
+ */
+typedef struct {
+    GTlmNfc* self;
+    GDBusProxy* proxy;
+    gint64 found_time;
+    gboolean ready;
+    GSource* settle_source;
+    GQueue pending_writes;
+    GQueue verifying_writes;
+    gchar* type;
+    gsize capacity;
+    gboolean read_only;
+    /* with #GTlmNfc:direct-records, the records that have reached us one
+     * way and are still to arrive the other way, and the payloads reported
+     * from record objects, for agent calls that do not name the record
+     */
+    GHashTable* reported_records;
+    GHashTable* reported_payloads;
+} _TagState;
+
+/* neard does not tell how much a tag holds, so this is the data area of
+ * the biggest tag of a type in common use: only writes that cannot fit on
+ * any tag of the type are refused, and the tag at hand decides the rest.
+ * Type 3 and Type 4 tags have room for any payload we write.
+ */
+static const struct {
+    const gchar* type;
+    gsize capacity;
+} _tag_capacities[] = {
+    { "Type 1", 454 },      /* Topaz 512 */
+    { "Type 2", 872 },      /* NTAG216 */
+};
 
-static gchar* _encode_username_password(const gchar* username, const gchar* password)
+/* The room an NDEF message takes in a tag's data area: the message TLV,
+ * whose length takes 3 bytes from 255 on, and the terminator TLV
+ */
+static gsize
+_get_tlv_size (gsize message_size)
 {
-    GVariant* v = g_variant_new("(msms)", username, password);
-    
-    gchar* out = g_base64_encode(g_variant_get_data(v), g_variant_get_size(v));
-    g_variant_unref(v);
-    return out;
+    return 1 + (message_size < 0xFF ? 1 : 3) + message_size + 1;
 }
 
-/**
- * gtlm_nfc_write_username_password:
- * @tlm_nfc: an instance of GTlmNfc object
- * @nfc_tag_path: an identificator of the nfc tag (returned by #GTlmNfc::tag-found)
- * @username: username to write
- * @password: password to write
- * @error: if non-NULL, set to an error, if one occurs
- * 
- * This function is used to write a username and password to a tag. The tag path
- * can be obtained by listening to #GTlmNfc::tag-found signals). @error is set to
- * @GTLM_NFC_ERROR_NO_TAG if no such tag exists.
- */
-void gtlm_nfc_write_username_password(GTlmNfc* tlm_nfc,
-                                      const gchar* nfc_tag_path,
-                                      const gchar* username, 
-                                      const gchar* password,
-                                      GError** error)
+static void
+_tag_state_update (_TagState* tag,
+                   const gchar* property_name,
+                   GVariant* value)
 {
-    if (nfc_tag_path == NULL) {
-        *error = g_error_new(GTLM_NFC_ERROR, GTLM_NFC_ERROR_NO_TAG, "No tag is present");
-        return;
+    if (g_strcmp0(property_name, "Type") == 0 &&
+            g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+        g_free(tag->type);
+        tag->type = g_variant_dup_string(value, NULL);
+        tag->capacity = 0;
+        for (guint i = 0; i < G_N_ELEMENTS(_tag_capacities); i++) {
+            if (g_strcmp0(tag->type, _tag_capacities[i].type) == 0)
+                tag->capacity = _tag_capacities[i].capacity;
+        }
+    } else if (g_strcmp0(property_name, "ReadOnly") == 0 &&
+            g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)) {
+        tag->read_only = g_variant_get_boolean(value);
     }
-    
-    GDBusProxy* tag = g_dbus_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-                                         G_DBUS_PROXY_FLAGS_NONE,
-                                         NULL, /* GDBusInterfaceInfo */
-                                         "org.neard",
-                                         nfc_tag_path,
-                                         "org.neard.Tag",
-                                         NULL, /* GCancellable */
-                                         error);
-    if (tag == NULL) {
-        g_debug ("Error creating tag proxy: %s", (*error)->message);
-        return;
-    }    
+}
 
-    //gchar binary_data[] = {0x41, 0x42, 0x43, 0x44};
-    gchar* binary_data = _encode_username_password(username, password);
-    GVariant* payload =  g_variant_new_bytestring(binary_data);
-    g_free(binary_data);
-    
-    GVariant* arguments = g_variant_new_parsed ("({'Type': <'MIME'>, 'MIME': <'application/gtlm-nfc'>, 'Payload' : %v },)", payload);
-    
-    GVariant *result = g_dbus_proxy_call_sync (tag,
-                                        "Write",
-                                        arguments,
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        -1,
-                                        NULL,
-                                        error);
-    
-   if (result == NULL) {
-        g_debug ("Error writing to tag: %s", (*error)->message);
-        g_object_unref(tag);
+static void
+_tag_state_load_cached (_TagState* tag, const gchar* property_name)
+{
+    GVariant* value = g_dbus_proxy_get_cached_property(tag->proxy, property_name);
+    if (value == NULL) {
+        g_debug("%s property is absent on a tag", property_name);
         return;
-    }    
+    }
+    _tag_state_update(tag, property_name, value);
+    g_variant_unref(value);
+}
 
-    g_variant_unref(result);
-    g_object_unref(tag);
+static _TagState*
+_tag_state_new (GTlmNfc* self, GDBusProxy* proxy, gint64 found_time)
+{
+    _TagState* tag = g_slice_new0(_TagState);
+    tag->self = self;
+    tag->proxy = g_object_ref(proxy);
+    tag->found_time = found_time;
+    tag->ready = found_time == 0;
+    g_queue_init(&tag->pending_writes);
+    g_queue_init(&tag->verifying_writes);
+    if (self->priv->direct_records == TRUE) {
+        tag->reported_records = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                      g_free, NULL);
+        tag->reported_payloads = g_hash_table_new_full(g_bytes_hash, g_bytes_equal,
+                                                       (GDestroyNotify)g_bytes_unref, NULL);
+    }
+    _tag_state_load_cached(tag, "Type");
+    _tag_state_load_cached(tag, "ReadOnly");
+    return tag;
 }
 
-static void _decode_username_password(GTlmNfc* self, const gchar* data)
+/* Rejects writes that cannot succeed, before any bus traffic */
+static gboolean
+_check_tag_writable (_TagState* tag, gsize message_size, GError** error)
 {
-    gsize variant_s_size = 0;
-    guchar* variant_s = g_base64_decode(data, &variant_s_size);
-    
-    GVariantType* v_t = g_variant_type_new("(msms)");
-    GVariant* v = g_variant_new_from_data(v_t, variant_s, variant_s_size, FALSE, NULL, NULL);
-    
-    if (v == NULL) {
-        g_debug("Couldn't decode Payload data to variant");
-        g_variant_type_free(v_t);
-        g_free(variant_s);
-        g_signal_emit(self, signals[SIG_NO_RECORD_FOUND], 0);
-        return;
+    if (tag->read_only == TRUE) {
+        g_set_error(error, GTLM_NFC_ERROR, GTLM_NFC_ERROR_TAG_READ_ONLY,
+                    "Tag %s is read-only", g_dbus_proxy_get_object_path(tag->proxy));
+        return FALSE;
     }
-    
-    gchar* username = NULL;
-    gchar* password = NULL;
-    g_variant_get(v, "(msms)", &username, &password);
-    
-    g_signal_emit(self, signals[SIG_RECORD_FOUND], 0, username, password);
-    
-    g_free(username);
-    g_free(password);
-    g_variant_unref(v);
-    g_variant_type_free(v_t);
-    g_free(variant_s);
+    if (tag->capacity > 0 && _get_tlv_size(message_size) > tag->capacity) {
+        g_set_error(error, GTLM_NFC_ERROR, GTLM_NFC_ERROR_TAG_TOO_SMALL,
+                    "%" G_GSIZE_FORMAT " bytes do not fit on a %s tag, which holds at most %"
+                    G_GSIZE_FORMAT, _get_tlv_size(message_size), tag->type, tag->capacity);
+        return FALSE;
+    }
+    return TRUE;
 }
 
+static void _fail_pending_writes (_TagState* tag);
+static void _fail_verifying_writes (_TagState* tag);
+
 static void
-_handle_agent_method_call (GDBusConnection       *connection,
-                    const gchar           *sender,
-                    const gchar           *object_path,
-                    const gchar           *interface_name,
-                    const gchar           *method_name,
-                    GVariant              *parameters,
-                    GDBusMethodInvocation *invocation,
-                    gpointer               user_data)
+_tag_state_free (_TagState* tag)
 {
-    GTlmNfc* self = GTLM_NFC(user_data);
-    gchar *parameters_str;
-
-    parameters_str = g_variant_print (parameters, TRUE);
-    g_debug ("Agent received method call: %s\n\tParameters: %s\n\tSender: %s\n\tObject path: %s\n\tInteface name: %s",
-           method_name, parameters_str, sender, object_path, interface_name);
-    g_free (parameters_str);
-    
-    if (g_strcmp0(method_name, "GetNDEF") != 0) {
-        goto out;
+    if (tag->settle_source != NULL) {
+        g_source_destroy(tag->settle_source);
+        g_source_unref(tag->settle_source);
     }
+    _fail_pending_writes(tag);
+    _fail_verifying_writes(tag);
+    g_object_unref(tag->proxy);
+    g_free(tag->type);
+    if (tag->reported_records != NULL)
+        g_hash_table_unref(tag->reported_records);
+    if (tag->reported_payloads != NULL)
+        g_hash_table_unref(tag->reported_payloads);
+    g_slice_free(_TagState, tag);
+}
 
-    GVariant* parameters_dict = g_variant_get_child_value(parameters, 0);
-    if (parameters_dict == NULL)
-    {
-        g_debug ("Error getting parameters dict");
-        g_signal_emit(self, signals[SIG_NO_RECORD_FOUND], 0);
-        goto out;
+static void
+_histogram_add (GTlmNfcHistogram* histogram, gint64 usec)
+{
+    guint bucket = 0;
+
+    if (usec > 0)
+        bucket = MIN(g_bit_storage((gulong)usec), GTLM_NFC_HISTOGRAM_BUCKETS - 1);
+    if (histogram->count == 0 || usec < histogram->min_usec)
+        histogram->min_usec = usec;
+    histogram->max_usec = MAX(histogram->max_usec, usec);
+    histogram->total_usec += usec;
+    histogram->count++;
+    histogram->buckets[bucket]++;
+}
+
+/* The statistics and the adapter timings are written on the engine's
+ * thread, and read from any thread under stats_lock, so that the getters
+ * do not have to wait for the engine.
+ */
+static void
+_stats_add (GTlmNfc* self, GTlmNfcStage stage, gint64 usec)
+{
+    g_mutex_lock(&self->priv->stats_lock);
+    _histogram_add(&self->priv->stats.stages[stage], usec);
+    g_mutex_unlock(&self->priv->stats_lock);
+}
+
+typedef struct {
+    GTlmNfcMessage message;
+    GTlmNfc* self;
+    guint signal;
+    gchar* path;
+    gchar* username;
+    gchar* password;
+    gint64 value;
+} _Event;
+
+static void
+_emit_signal_now (GTlmNfc* self,
+                  guint signal,
+                  const gchar* path,
+                  const gchar* username,
+                  const gchar* password,
+                  gint64 value)
+{
+    switch (signal) {
+        case SIG_TAG_FOUND:
+        case SIG_TAG_LOST:
+        case SIG_TAG_READY:
+            g_signal_emit(self, signals[signal], 0, path);
+            break;
+        case SIG_RECORD_FOUND:
+            g_signal_emit(self, signals[signal], 0, username, password);
+            break;
+        case SIG_ADAPTER_REARMED:
+            g_signal_emit(self, signals[signal], 0, path, value);
+            break;
+        default:
+            g_signal_emit(self, signals[signal], 0);
+            break;
     }
+}
 
-    gchar* payload_data;
-    
-    if (g_variant_lookup(parameters_dict, "Payload", "^ay", &payload_data) == FALSE) {
-        g_debug ("Error getting raw Payload data");
-        g_signal_emit(self, signals[SIG_NO_RECORD_FOUND], 0);        
-        g_variant_unref(parameters_dict);
-        goto out;
+static void
+_event_free (_Event* event)
+{
+    if (event->password != NULL) {
+        memset(event->password, 0, strlen(event->password));
+        g_free(event->password);
     }
-    g_variant_unref(parameters_dict);
-    
-    _decode_username_password(self, payload_data);
-    g_free(payload_data);
-    
-out:    
-    g_dbus_method_invocation_return_value (invocation, NULL);
+    g_free(event->username);
+    g_free(event->path);
+    g_object_unref(event->self);
+    g_slice_free(_Event, event);
 }
 
-static GVariant *
-_handle_agent_get_property (GDBusConnection  *connection,
-                     const gchar      *sender,
-                     const gchar      *object_path,
-                     const gchar      *interface_name,
-                     const gchar      *property_name,
-                     GError          **error,
-                     gpointer          user_data)
+static void
+_deliver_event (GTlmNfcMessage* message, gpointer user_data)
 {
-    return NULL;
+    _Event* event = (_Event*)message;
+
+    _emit_signal_now(event->self, event->signal,
+                     event->path, event->username, event->password, event->value);
+    _event_free(event);
 }
 
-static gboolean
-_handle_agent_set_property (GDBusConnection  *connection,
-                     const gchar      *sender,
-                     const gchar      *object_path,
-                     const gchar      *interface_name,
-                     const gchar      *property_name,
-                     GVariant         *value,
-                     GError          **error,
-                     gpointer          user_data)
+static void
+_discard_event (GTlmNfcMessage* message, gpointer user_data)
 {
-    return FALSE;
+    _event_free((_Event*)message);
 }
 
+/* Emits a signal from the main context that GTlmNfc was created in */
 static void
-_setup_nfc_adapter(GTlmNfc *self, GDBusProxy *nfc_adapter)
+_queue_signal (GTlmNfc* self,
+               guint signal,
+               const gchar* path,
+               const gchar* username,
+               const gchar* password,
+               gint64 value)
 {
-    GError* error = NULL;
-    gboolean powered;
-    gboolean polling;
-
-    // for some reason the cached properties aren't updated, so we request them directly
-    //GVariant* powered_v = g_dbus_proxy_get_cached_property(nfc_adapter, "Powered");
-    GVariant* powered_resp = g_dbus_connection_call_sync (self->system_bus,
-                                        "org.neard",
-                                        g_dbus_proxy_get_object_path(nfc_adapter) ,
-                                        "org.freedesktop.DBus.Properties",
-                                        "Get",
-                                        g_variant_new("(ss)", 
-                                                      g_dbus_proxy_get_interface_name(nfc_adapter), 
-                                                      "Powered"
-                                                     ),
-                                        NULL,              
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        -1,
-                                        NULL,
-                                        &error);
-    
-    if (powered_resp == NULL) {
-        g_debug("Powered property is absent on an adapter: %s", error->message);
-        g_error_free (error);
+    _Event* event = g_slice_new(_Event);
+    event->self = g_object_ref(self);
+    event->signal = signal;
+    event->path = g_strdup(path);
+    event->username = g_strdup(username);
+    event->password = g_strdup(password);
+    event->value = value;
+    gtlm_nfc_mailbox_post(self->priv->events, &event->message);
+}
+
+static const GTlmNfcEventType _signal_event_types[SIG_MAX] = {
+    [SIG_TAG_FOUND] = GTLM_NFC_EVENT_TAG_FOUND,
+    [SIG_TAG_LOST] = GTLM_NFC_EVENT_TAG_LOST,
+    [SIG_RECORD_FOUND] = GTLM_NFC_EVENT_RECORD_FOUND,
+    [SIG_NO_RECORD_FOUND] = GTLM_NFC_EVENT_NO_RECORD_FOUND,
+    [SIG_ADAPTER_REARMED] = GTLM_NFC_EVENT_ADAPTER_REARMED,
+    [SIG_ADAPTERS_READY] = GTLM_NFC_EVENT_ADAPTERS_READY,
+    [SIG_TAG_READY] = GTLM_NFC_EVENT_TAG_READY,
+};
+
+/* Emits one of our signals; only the arguments that the signal takes are
+ * used. In worker thread mode, the signal is queued instead, and emitted in
+ * the main context that GTlmNfc was created in. Either way, the event also
+ * goes to the ring behind gtlm_nfc_get_event_fd(), if there is one.
+ *
+ * The shared engine emits nothing itself, and passes the signal on to all
+ * the instances using it. Those emit it right away if they were created in
+ * the main context that is running, and queue it otherwise, or if they have
+ * GTlmNfc:deferred-dispatch set and it reports a record.
+ */
+void gtlm_nfc_emit_signal(GTlmNfc* self,
+                          guint signal,
+                          const gchar* path,
+                          const gchar* username,
+                          const gchar* password,
+                          gint64 value)
+{
+    if (self->priv->fan_out == TRUE) {
+        // the engine holds weak references to its instances, which an
+        // instance loses before it is disposed; handlers may create and drop
+        // instances, so no lock is held while they run
+        GList* subscribers = NULL;
+        g_mutex_lock(&self->priv->subscribers_lock);
+        for (GList* iter = self->priv->subscribers; iter != NULL; iter = iter->next) {
+            GTlmNfc* subscriber = g_weak_ref_get(iter->data);
+            if (subscriber != NULL)
+                subscribers = g_list_prepend(subscribers, subscriber);
+        }
+        g_mutex_unlock(&self->priv->subscribers_lock);
+
+        if (signal == SIG_ADAPTERS_READY)
+            self->priv->adapters_announced = TRUE;
+        for (GList* iter = subscribers; iter != NULL; iter = iter->next) {
+            GTlmNfc* subscriber = iter->data;
+            if (signal == SIG_ADAPTERS_READY)
+                subscriber->priv->greeted = TRUE;
+            gtlm_nfc_emit_signal(subscriber, signal, path, username, password, value);
+        }
+        g_list_free_full(subscribers, g_object_unref);
         return;
     }
-    
-    GVariant* powered_v;
-    g_variant_get_child(powered_resp, 0, "v", &powered_v);
-    
-    if (powered_v == NULL || !g_variant_is_of_type(powered_v, G_VARIANT_TYPE_BOOLEAN)) {
-        g_debug("Error retrieving powered property");
+
+    // an instance that has left the shared engine may still be handed the
+    // signals that were being passed on when it left
+    if (self->priv->shared == TRUE && g_atomic_pointer_get(&self->priv->engine) == NULL)
+        return;
+
+    GTlmNfcEventRing* ring = g_atomic_pointer_get(&self->priv->event_ring);
+    if (ring != NULL)
+        gtlm_nfc_event_ring_push(ring, _signal_event_types[signal],
+                                 path, username, password, value);
+
+    if (self->priv->worker_thread == FALSE && self->priv->engine == NULL) {
+        _emit_signal_now(self, signal, path, username, password, value);
         return;
     }
-    
-    powered = g_variant_get_boolean(powered_v);
-    g_variant_unref(powered_resp);
-    
-    //GVariant* polling_v = g_dbus_proxy_get_cached_property(nfc_adapter, "Polling");
-    GVariant* polling_resp = g_dbus_connection_call_sync (self->system_bus,
-                                        "org.neard",
-                                        g_dbus_proxy_get_object_path(nfc_adapter) ,
-                                        "org.freedesktop.DBus.Properties",
-                                        "Get",
-                                        g_variant_new("(ss)", 
-                                                      g_dbus_proxy_get_interface_name(nfc_adapter), 
-                                                      "Polling"
-                                                     ),
-                                        NULL,              
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        -1,
-                                        NULL,
-                                        &error);
-    if (polling_resp == NULL) {
-        g_debug("Polling property is absent on an adapter: %s", error->message);
-        g_error_free (error);
+    // GTlmNfc is being disposed
+    if (self->priv->events == NULL)
+        return;
+
+    gboolean deferred = g_atomic_int_get(&self->priv->deferred_dispatch) == TRUE &&
+        (signal == SIG_RECORD_FOUND || signal == SIG_NO_RECORD_FOUND);
+    if (self->priv->engine != NULL && deferred == FALSE &&
+            g_main_context_is_owner(g_source_get_context((GSource*)self->priv->events))) {
+        _emit_signal_now(self, signal, path, username, password, value);
         return;
     }
-    
-    GVariant* polling_v;
-    g_variant_get_child(polling_resp, 0, "v", &polling_v);
-    
-    if (polling_v == NULL || !g_variant_is_of_type(polling_v, G_VARIANT_TYPE_BOOLEAN)) {
-        g_debug("Error retrieving polling property");
+    _queue_signal(self, signal, path, username, password, value);
+}
+
+static void
+_on_write_done (GObject      *source_object,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+    GTask* task = G_TASK(user_data);
+    GError* error = NULL;
+
+    GVariant *result = g_dbus_proxy_call_finish (G_DBUS_PROXY(source_object),
+                                                 res,
+                                                 &error);
+    if (result == NULL) {
+        g_debug ("Error writing to tag: %s", error->message);
+        g_task_return_error(task, error);
+        g_object_unref(task);
         return;
     }
-    
-    polling = g_variant_get_boolean(polling_v);
-    g_variant_unref(polling_resp);
-    
-    
-    GVariant* response;
-    if (powered == FALSE) {
-        // switch power on
-
-        response = g_dbus_connection_call_sync (self->system_bus,
-                                        "org.neard",
-                                        g_dbus_proxy_get_object_path(nfc_adapter) ,
-                                        "org.freedesktop.DBus.Properties",
-                                        "Set",
-                                        g_variant_new("(ssv)", 
-                                                      g_dbus_proxy_get_interface_name(nfc_adapter), 
-                                                      "Powered",
-                                                      g_variant_new_boolean(TRUE)
-                                                     ),
-                                        NULL,              
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        -1,
-                                        NULL,
-                                        &error);
-        
-        if (response == NULL ) {
-            g_debug("Error swithing NFC adapter on: %s", error->message);
-            g_error_free (error);
-            return;
-        }
-        g_variant_unref(response);
-        g_debug("Switched NFC adapter on");
-    } else
-        g_debug("Adapter already switched on");
-
-    if (polling == FALSE) {
-        // start polling
-        response = g_dbus_proxy_call_sync (nfc_adapter,
-                                        "StartPollLoop",
-                                        g_variant_new("(s)", "Initiator"),
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        -1,
-                                        NULL,
-                                        &error);
-        if (response == NULL)
-        {
-            g_debug("Error starting NFC poll loop: %s", error->message);
-            g_error_free (error);
-            return;
-        }
-        g_variant_unref(response);
-        g_debug("Started NFC poll loop");
 
-    } else
-        g_debug("Adapter already in polling mode");
+    g_variant_unref(result);
+    g_task_return_boolean(task, TRUE);
+    g_object_unref(task);
+}
+
+/* The public functions can be called from any thread. They pass their work
+ * as commands to the thread that talks to neard, through a mailbox drained
+ * by that thread's main context: the context GTlmNfc was created in, or the
+ * worker thread's context in worker thread mode.
+ */
+typedef struct {
+    GTlmNfcMessage message;
+    GSourceFunc func;
+    gpointer data;
+    /* releases @data if the command is dropped without running */
+    GDestroyNotify discard;
+} _Command;
 
+static void
+_run_command (GTlmNfcMessage* message, gpointer user_data)
+{
+    _Command* command = (_Command*)message;
 
+    command->func(command->data);
+    g_slice_free(_Command, command);
 }
 
+/* Drops a command that is still queued when the engine goes away, without
+ * running it: the engine has already been torn down by then
+ */
+static void
+_discard_command (GTlmNfcMessage* message, gpointer user_data)
+{
+    _Command* command = (_Command*)message;
 
-void _on_interface_added(GDBusObjectManager *manager,
-                         GDBusObject        *object,
-                         GDBusInterface     *interface,
-                         gpointer            user_data)
+    g_debug("Dropping a command queued for a disposed GTlmNfc");
+    command->discard(command->data);
+    g_slice_free(_Command, command);
+}
+
+static void
+_start_commands (GTlmNfc* self)
 {
-    GTlmNfc* self = GTLM_NFC(user_data);
-    GDBusProxy* proxy = G_DBUS_PROXY(interface);
-    g_debug("Object %s added interface %s", 
-                    g_dbus_object_get_object_path (object),
-                    g_dbus_proxy_get_interface_name (proxy));
-    
-    if (g_strcmp0(g_dbus_proxy_get_interface_name (proxy),
-                "org.neard.Adapter") == 0) {
-        _setup_nfc_adapter(self, proxy);
+    GMainContext* context = g_main_context_ref_thread_default();
+
+    self->priv->engine_thread = g_thread_self();
+    self->priv->commands = gtlm_nfc_mailbox_new(context, _run_command, _discard_command, NULL);
+    g_main_context_unref(context);
+}
+
+/* The command mailbox exists from construction until dispose, so calls
+ * from other threads are queued even while @self is being set up
+ */
+static gboolean
+_on_engine_thread (GTlmNfc* self)
+{
+    return g_thread_self() == self->priv->engine_thread;
+}
+
+/* Runs @func on the thread that talks to neard: right away if that is the
+ * calling thread, or else once that thread's main context drains the
+ * command mailbox. If the engine is disposed before then, @discard is
+ * called on @data instead.
+ */
+void gtlm_nfc_invoke_engine(GTlmNfc* self,
+                            GSourceFunc func,
+                            gpointer data,
+                            GDestroyNotify discard)
+{
+    if (_on_engine_thread(self)) {
+        func(data);
         return;
     }
-    if (g_strcmp0(g_dbus_proxy_get_interface_name (proxy),
-                "org.neard.Tag") == 0) {
-        g_signal_emit(self, signals[SIG_TAG_FOUND], 0, g_dbus_object_get_object_path (object));
+    if (self->priv->commands == NULL) {
+        discard(data);
         return;
     }
 
-    if (g_strcmp0(g_dbus_proxy_get_interface_name (proxy),
-                "org.neard.Record") == 0) {
-        GVariant* type_v = g_dbus_proxy_get_cached_property(proxy, "Type");
-        if (type_v == NULL || !g_variant_is_of_type(type_v, G_VARIANT_TYPE_STRING)) {
-            g_debug("Type property is absent on a record");
-            g_signal_emit(self, signals[SIG_NO_RECORD_FOUND], 0);
-            return;
-        }
-        const gchar* type = g_variant_get_string(type_v, NULL);
-        g_debug("Record has type %s", type);
-        if (g_strcmp0(type, "MIME") != 0) {
-            g_variant_unref(type_v);
-            g_signal_emit(self, signals[SIG_NO_RECORD_FOUND], 0);
-            return;
-        }
-        g_variant_unref(type_v);
+    _Command* command = g_slice_new0(_Command);
+    command->func = func;
+    command->data = data;
+    command->discard = discard;
+    gtlm_nfc_mailbox_post(self->priv->commands, &command->message);
+}
 
-        GVariant* mimetype_v = g_dbus_proxy_get_cached_property(proxy, "MIME");
-        if (mimetype_v == NULL || !g_variant_is_of_type(type_v, G_VARIANT_TYPE_STRING)) {
-            g_debug("MIME property is absent on a record");
-            g_signal_emit(self, signals[SIG_NO_RECORD_FOUND], 0);
-            return;
-        }
-        const gchar* mimetype = g_variant_get_string(mimetype_v, NULL);
-        g_debug("Record has MIME type %s", mimetype);
-        if (g_strcmp0(mimetype, "application/gtlm-nfc") != 0) {
-            g_variant_unref(mimetype_v);
-            g_signal_emit(self, signals[SIG_NO_RECORD_FOUND], 0);
-            return;
-        }
-        g_variant_unref(mimetype_v);
+/* The instance that talks to neard on behalf of @self */
+GTlmNfc* gtlm_nfc_get_engine(GTlmNfc* self)
+{
+    return self->priv->engine != NULL ? self->priv->engine : self;
+}
+
+typedef struct {
+    GTlmNfc* self;
+    GTask* task;
+    gchar* tag_path;
+    GVariant* arguments;
+    gsize message_size;
+    gint timeout_msec;
+    gboolean hold_back;
+    gboolean verify;
+
+    /* only used while a write is verified, see _issue_write() */
+    _TagState* tag;
+    gboolean written;
+    gboolean done;
+    GSource* verify_source;
+    GSource* cancelled_source;
+} _WriteRequest;
+
+/* How long to wait for neard to read a written tag again if the write has
+ * no timeout of its own; the default D-Bus timeout
+ */
+#define VERIFY_DEFAULT_TIMEOUT 25000
+
+static void
+_write_request_free (_WriteRequest* request)
+{
+    g_free(request->tag_path);
+    g_variant_unref(request->arguments);
+    g_slice_free(_WriteRequest, request);
+}
+
+/* Completes a verified write with @error, or successfully if it is %NULL */
+static void
+_finish_verification (_WriteRequest* request, GError* error)
+{
+    GTask* task = request->task;
+
+    request->done = TRUE;
+    if (request->tag != NULL) {
+        g_queue_remove(&request->tag->verifying_writes, request);
+        request->tag = NULL;
+    }
+    if (request->verify_source != NULL) {
+        g_source_destroy(request->verify_source);
+        g_source_unref(request->verify_source);
+        request->verify_source = NULL;
     }
+    if (request->cancelled_source != NULL) {
+        g_source_destroy(request->cancelled_source);
+        g_source_unref(request->cancelled_source);
+        request->cancelled_source = NULL;
+    }
+
+    if (error != NULL)
+        g_task_return_error(task, error);
+    else
+        g_task_return_boolean(task, TRUE);
+    // @request is the task's data, and may go away with it
+    g_object_unref(task);
 }
 
+/* Compares what neard read from the tag with what was written to it */
 static void
-_setup_nfc_adapters(GTlmNfc *self)
+_check_read_back (_WriteRequest* request, GVariant* read_back)
 {
-    GList* objects = g_dbus_object_manager_get_objects(self->neard_manager);
-    GList* objects_iter = objects;
-    
-    while (objects_iter != NULL) {
+    GVariant* attributes = g_variant_get_child_value(request->arguments, 0);
+    GVariant* written_v = g_variant_lookup_value(attributes, "Payload",
+                                                 G_VARIANT_TYPE_BYTESTRING);
+    gsize written_size = 0, read_size = 0;
+    const guint8* written = g_variant_get_fixed_array(written_v, &written_size, sizeof(guint8));
+    const guint8* read = NULL;
+    if (read_back != NULL)
+        read = g_variant_get_fixed_array(read_back, &read_size, sizeof(guint8));
+    gboolean match = read != NULL && written_size == read_size &&
+                     memcmp(written, read, read_size) == 0;
+
+    g_variant_unref(written_v);
+    g_variant_unref(attributes);
+
+    if (match == FALSE) {
+        g_debug("Tag %s read back %" G_GSIZE_FORMAT " bytes that differ from what was written",
+                request->tag_path, read_size);
+        _finish_verification(request,
+                             g_error_new(GTLM_NFC_ERROR, GTLM_NFC_ERROR_VERIFY_FAILED,
+                                         "Tag %s does not hold what was written to it",
+                                         request->tag_path));
+        return;
+    }
+    g_debug("Verified the write to tag %s", request->tag_path);
+    _finish_verification(request, NULL);
+}
+
+static gboolean
+_on_verify_timeout (gpointer user_data)
+{
+    _WriteRequest* request = user_data;
+
+    _finish_verification(request,
+                         g_error_new(GTLM_NFC_ERROR, GTLM_NFC_ERROR_VERIFY_FAILED,
+                                     "Tag %s was not read back after the write",
+                                     request->tag_path));
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+_on_verify_cancelled (GCancellable* cancellable, gpointer user_data)
+{
+    _WriteRequest* request = user_data;
+
+    _finish_verification(request,
+                         g_error_new(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                     "Write was cancelled before it was verified"));
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_on_verified_write_done (GObject      *source_object,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+    GTask* task = G_TASK(user_data);
+    _WriteRequest* request = g_task_get_task_data(task);
+    GError* error = NULL;
+
+    GVariant *result = g_dbus_proxy_call_finish (G_DBUS_PROXY(source_object),
+                                                 res,
+                                                 &error);
+    if (request->done == TRUE) {
+        // the tag was lost while the write was in flight
+        if (result != NULL)
+            g_variant_unref(result);
+        g_clear_error(&error);
+    } else if (result == NULL) {
+        g_debug ("Error writing to tag: %s", error->message);
+        _finish_verification(request, error);
+    } else {
+        // neard reads the tag again once it has replied
+        g_variant_unref(result);
+        request->written = TRUE;
+        GMainContext* context = g_main_context_ref_thread_default();
+        request->verify_source = g_timeout_source_new(request->timeout_msec >= 0 ?
+                                                      request->timeout_msec :
+                                                      VERIFY_DEFAULT_TIMEOUT);
+        g_source_set_callback(request->verify_source, _on_verify_timeout, request, NULL);
+        g_source_attach(request->verify_source, context);
+
+        GCancellable* cancellable = g_task_get_cancellable(task);
+        if (cancellable != NULL) {
+            request->cancelled_source = g_cancellable_source_new(cancellable);
+            g_source_set_callback(request->cancelled_source,
+                                  (GSourceFunc)_on_verify_cancelled, request, NULL);
+            g_source_attach(request->cancelled_source, context);
+        }
+        g_main_context_unref(context);
+    }
+    g_object_unref(task);
+}
+
+/* Hands what neard has read from @tag, or %NULL if it found no record of
+ * ours, to the writes that wait to be verified. Reads that started before
+ * a write was done are of no use to it.
+ */
+static void
+_verify_read_back (_TagState* tag, GVariant* payload_v)
+{
+    GList* iter = tag->verifying_writes.head;
+
+    while (iter != NULL) {
+        _WriteRequest* request = iter->data;
+        iter = iter->next;
+
+        if (request->written == TRUE)
+            _check_read_back(request, payload_v);
+    }
+}
+
+static void
+_fail_verifying_writes (_TagState* tag)
+{
+    _WriteRequest* request;
+
+    while ((request = g_queue_pop_head(&tag->verifying_writes)) != NULL) {
+        request->tag = NULL;
+        _finish_verification(request,
+                             g_error_new(GTLM_NFC_ERROR, GTLM_NFC_ERROR_NO_TAG,
+                                         "Tag %s was lost before the write could be verified",
+                                         request->tag_path));
+    }
+}
+
+static void
+_issue_write (_TagState* tag, _WriteRequest* request)
+{
+    GError* error = NULL;
+
+    if (_check_tag_writable(tag, request->message_size, &error) == FALSE) {
+        g_debug("Not writing to tag: %s", error->message);
+        g_task_return_error(request->task, error);
+        g_object_unref(request->task);
+        _write_request_free(request);
+        return;
+    }
+
+    if (request->verify == FALSE) {
+        g_dbus_proxy_call (tag->proxy,
+                           "Write",
+                           request->arguments,
+                           G_DBUS_CALL_FLAGS_NONE,
+                           request->timeout_msec,
+                           g_task_get_cancellable(request->task),
+                           _on_write_done,
+                           request->task);
+        _write_request_free(request);
+        return;
+    }
+
+    // the write completes once neard has read the tag again, or the tag is
+    // lost; until then the request lives with the task
+    g_task_set_task_data(request->task, request, (GDestroyNotify)_write_request_free);
+    request->tag = tag;
+    g_queue_push_tail(&tag->verifying_writes, request);
+    g_dbus_proxy_call (tag->proxy,
+                       "Write",
+                       request->arguments,
+                       G_DBUS_CALL_FLAGS_NONE,
+                       request->timeout_msec,
+                       g_task_get_cancellable(request->task),
+                       _on_verified_write_done,
+                       g_object_ref(request->task));
+}
+
+static void
+_fail_pending_writes (_TagState* tag)
+{
+    _WriteRequest* request;
+
+    while ((request = g_queue_pop_head(&tag->pending_writes)) != NULL) {
+        g_task_return_new_error(request->task, GTLM_NFC_ERROR, GTLM_NFC_ERROR_NO_TAG,
+                                "Tag %s was lost before it could be written",
+                                request->tag_path);
+        g_object_unref(request->task);
+        _write_request_free(request);
+    }
+}
+
+static gboolean
+_write_to_tag (gpointer user_data)
+{
+    _WriteRequest* request = user_data;
+    GTask* task = request->task;
+    GTlmNfc* self = request->self;
+
+    gtlm_nfc_activate_engine(self);
+
+    _TagState* tag = g_hash_table_lookup(self->priv->tags, request->tag_path);
+    if (tag == NULL) {
+        g_task_return_new_error(task, GTLM_NFC_ERROR, GTLM_NFC_ERROR_NO_TAG,
+                                "Tag %s is not present", request->tag_path);
+        g_object_unref(task);
+        _write_request_free(request);
+    } else if (tag->ready == FALSE && request->hold_back == TRUE) {
+        // writing while neard is still reading the tag fails (NFC-57)
+        g_debug("Tag %s is not ready, holding back the write", request->tag_path);
+        g_queue_push_tail(&tag->pending_writes, request);
+    } else {
+        _issue_write(tag, request);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_discard_write (_WriteRequest* request)
+{
+    g_task_return_new_error(request->task, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                            "GTlmNfc was disposed before writing to %s", request->tag_path);
+    g_object_unref(request->task);
+    _write_request_free(request);
+}
+
+void gtlm_nfc_issue_write(GTlmNfc* self,
+                          const gchar* tag_path,
+                          GVariant* arguments,
+                          gsize message_size,
+                          gint timeout_msec,
+                          gboolean verify,
+                          GTask* task)
+{
+    _WriteRequest* request = g_slice_new0(_WriteRequest);
+    request->self = self;
+    request->task = task;
+    request->tag_path = g_strdup(tag_path);
+    request->arguments = g_variant_ref(arguments);
+    request->message_size = message_size;
+    request->timeout_msec = timeout_msec;
+    request->verify = verify;
+
+    _TagState* tag = g_hash_table_lookup(self->priv->tags, tag_path);
+    if (tag == NULL) {
+        g_task_return_new_error(task, GTLM_NFC_ERROR, GTLM_NFC_ERROR_NO_TAG,
+                                "Tag %s is not present", tag_path);
+        g_object_unref(task);
+        _write_request_free(request);
+        return;
+    }
+    _issue_write(tag, request);
+}
+
+/* Encodes a username and password into the arguments of the tag's Write
+ * method, and returns the size of the NDEF message in @message_size.
+ * Returns %NULL if they do not fit into a payload.
+ */
+GVariant* gtlm_nfc_new_write_arguments(const gchar* username,
+                                       const gchar* password,
+                                       gsize* message_size)
+{
+    gsize payload_size = 0;
+    guint8* payload_data = gtlm_nfc_payload_encode(username, password, &payload_size);
+    if (payload_data == NULL)
+        return NULL;
+
+    GVariant* payload = g_variant_new_from_data(G_VARIANT_TYPE_BYTESTRING,
+                                                payload_data,
+                                                payload_size,
+                                                TRUE,
+                                                g_free,
+                                                payload_data);
+    *message_size = gtlm_nfc_payload_get_message_size(payload_size);
+    return g_variant_ref_sink(g_variant_new_parsed ("({'Type': <'MIME'>, 'MIME': <'application/gtlm-nfc'>, 'Payload' : %v },)", payload));
+}
+
+static void
+_write_username_password_async (GTlmNfc* tlm_nfc,
+                                 const gchar* nfc_tag_path,
+                                 const gchar* username,
+                                 const gchar* password,
+                                 gint timeout_msec,
+                                 gboolean hold_back,
+                                 GCancellable* cancellable,
+                                 GAsyncReadyCallback callback,
+                                 gpointer user_data)
+{
+    GTask* task = g_task_new(tlm_nfc, cancellable, callback, user_data);
+    g_task_set_source_tag(task, gtlm_nfc_write_username_password_async);
+
+    if (nfc_tag_path == NULL) {
+        g_task_return_new_error(task, GTLM_NFC_ERROR, GTLM_NFC_ERROR_NO_TAG, "No tag is present");
+        g_object_unref(task);
+        return;
+    }
+
+    gsize message_size = 0;
+    GVariant* arguments = gtlm_nfc_new_write_arguments(username, password, &message_size);
+    if (arguments == NULL) {
+        g_task_return_new_error(task, GTLM_NFC_ERROR, GTLM_NFC_ERROR_CREDENTIALS_TOO_LONG,
+                                "Username and password must be at most %d bytes long",
+                                GTLM_NFC_PAYLOAD_MAX_FIELD_SIZE);
+        g_object_unref(task);
+        return;
+    }
+
+    _WriteRequest* request = g_slice_new0(_WriteRequest);
+    request->self = gtlm_nfc_get_engine(tlm_nfc);
+    request->task = task;
+    request->tag_path = g_strdup(nfc_tag_path);
+    request->arguments = arguments;
+    request->message_size = message_size;
+    request->timeout_msec = timeout_msec;
+    request->hold_back = hold_back;
+    // the read-back arrives in the engine's main context, which a blocking
+    // write from the engine's thread keeps from running
+    request->verify = hold_back == TRUE && g_atomic_int_get(&tlm_nfc->priv->verify_writes);
+
+    gtlm_nfc_invoke_engine(request->self, _write_to_tag, request, (GDestroyNotify)_discard_write);
+}
+
+/**
+ * gtlm_nfc_write_username_password_async:
+ * @tlm_nfc: an instance of GTlmNfc object
+ * @nfc_tag_path: an identificator of the nfc tag (returned by #GTlmNfc::tag-found)
+ * @username: username to write
+ * @password: password to write
+ * @timeout_msec: the timeout in milliseconds for the write, or -1 to use the
+ * default D-Bus timeout
+ * @cancellable: (allow-none): a #GCancellable or %NULL
+ * @callback: a #GAsyncReadyCallback to call when the write is done
+ * @user_data: the data to pass to @callback
+ *
+ * Asynchronously writes a username and password to a tag. The tag path
+ * can be obtained by listening to #GTlmNfc::tag-found signals. If neard is
+ * still reading the tag, the write is held back until #GTlmNfc::tag-ready.
+ * The write is issued on the tag proxy that neard's object manager already
+ * holds, so no extra bus round trips are made before the Write call
+ * itself. If #GTlmNfc:verify-writes is set, the write is only finished
+ * once neard has read the tag again and found what was written. When the write
+ * is finished, @callback is called in the thread-default main context of the
+ * thread this function was called from, and
+ * gtlm_nfc_write_username_password_finish() should be used to get the result.
+ */
+void gtlm_nfc_write_username_password_async(GTlmNfc* tlm_nfc,
+                                            const gchar* nfc_tag_path,
+                                            const gchar* username,
+                                            const gchar* password,
+                                            gint timeout_msec,
+                                            GCancellable* cancellable,
+                                            GAsyncReadyCallback callback,
+                                            gpointer user_data)
+{
+    g_return_if_fail (G_IS_TLM_NFC (tlm_nfc));
+
+    _write_username_password_async(tlm_nfc, nfc_tag_path, username, password,
+                                   timeout_msec, TRUE, cancellable,
+                                   callback, user_data);
+}
+
+/**
+ * gtlm_nfc_write_username_password_finish:
+ * @tlm_nfc: an instance of GTlmNfc object
+ * @result: the #GAsyncResult passed to the callback
+ * @error: if non-NULL, set to an error, if one occurs
+ *
+ * Finishes an operation started with gtlm_nfc_write_username_password_async().
+ * @error is set to @GTLM_NFC_ERROR_NO_TAG if no such tag exists, and to
+ * @GTLM_NFC_ERROR_TAG_READ_ONLY or @GTLM_NFC_ERROR_TAG_TOO_SMALL if the
+ * write was rejected without trying it; see gtlm_nfc_get_encoded_size().
+ * With #GTlmNfc:verify-writes, @error is set to
+ * @GTLM_NFC_ERROR_VERIFY_FAILED if the tag did not read back what was
+ * written, and to @GTLM_NFC_ERROR_NO_TAG if it was lost before it could be
+ * read back.
+ *
+ * Returns: %TRUE if the username and password have been written to the tag.
+ */
+gboolean gtlm_nfc_write_username_password_finish(GTlmNfc* tlm_nfc,
+                                                 GAsyncResult* result,
+                                                 GError** error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, tlm_nfc), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+/**
+ * gtlm_nfc_get_encoded_size:
+ * @username: a username
+ * @password: a password
+ *
+ * Tells how much room writing @username and @password takes on a tag,
+ * without any bus traffic. Writes are checked against the tag before they
+ * are sent to neard: one to a read-only tag fails with
+ * %GTLM_NFC_ERROR_TAG_READ_ONLY, and one that is too big for any tag of
+ * its type (more than the 454 bytes of a Topaz 512 for Type 1) with
+ * %GTLM_NFC_ERROR_TAG_TOO_SMALL. Writes that only fit on the bigger tags
+ * of a type are left to neard and the tag. On the tag the message takes 3
+ * more bytes, or 5 from 255 bytes on.
+ *
+ * Returns: the size of the NDEF message in bytes, or 0 if @username or
+ * @password is too long to be written at all.
+ */
+gsize gtlm_nfc_get_encoded_size(const gchar* username,
+                                const gchar* password)
+{
+    gsize payload_size = gtlm_nfc_payload_get_size(username, password);
+
+    if (payload_size == 0)
+        return 0;
+    return gtlm_nfc_payload_get_message_size(payload_size);
+}
+
+static void
+_on_write_sync_done (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+    GAsyncResult** result = user_data;
+    *result = g_object_ref(res);
+}
+
+/**
+ * gtlm_nfc_write_username_password:
+ * @tlm_nfc: an instance of GTlmNfc object
+ * @nfc_tag_path: an identificator of the nfc tag (returned by #GTlmNfc::tag-found)
+ * @username: username to write
+ * @password: password to write
+ * @error: if non-NULL, set to an error, if one occurs
+ * 
+ * This function is used to write a username and password to a tag. The tag path
+ * can be obtained by listening to #GTlmNfc::tag-found signals). @error is set to
+ * @GTLM_NFC_ERROR_NO_TAG if no such tag exists.
+ *
+ * This is a blocking version of gtlm_nfc_write_username_password_async(); it
+ * does not dispatch the caller's main context while the write is in progress.
+ * Called from the thread that talks to neard (e.g. from a signal handler
+ * when #GTlmNfc:worker-thread is not set), it does not wait for
+ * #GTlmNfc::tag-ready, so it should be called from a #GTlmNfc::tag-ready
+ * handler rather than a #GTlmNfc::tag-found one. Such writes are not
+ * verified either, even if #GTlmNfc:verify-writes is set, as neard reads
+ * the tag back through that thread.
+ */
+void gtlm_nfc_write_username_password(GTlmNfc* tlm_nfc,
+                                      const gchar* nfc_tag_path,
+                                      const gchar* username, 
+                                      const gchar* password,
+                                      GError** error)
+{
+    g_return_if_fail (G_IS_TLM_NFC (tlm_nfc));
+
+    GAsyncResult* result = NULL;
+    GMainContext* context = g_main_context_new();
+
+    // waiting for the tag to be ready takes the engine's main context,
+    // which is blocked if that is the calling thread's
+    gboolean hold_back = _on_engine_thread(gtlm_nfc_get_engine(tlm_nfc)) == FALSE;
+
+    g_main_context_push_thread_default(context);
+    _write_username_password_async(tlm_nfc,
+                                   nfc_tag_path,
+                                   username,
+                                   password,
+                                   -1,
+                                   hold_back,
+                                   NULL,
+                                   _on_write_sync_done,
+                                   &result);
+    while (result == NULL)
+        g_main_context_iteration(context, TRUE);
+    g_main_context_pop_thread_default(context);
+
+    gtlm_nfc_write_username_password_finish(tlm_nfc, result, error);
+    g_object_unref(result);
+    g_main_context_unref(context);
+}
+
+/* Neard has finished reading @tag: lets the writes that were held back go
+ * ahead and reports the tag as ready
+ */
+static void
+_mark_tag_ready (GTlmNfc* self, _TagState* tag)
+{
+    _WriteRequest* request;
+
+    if (tag->ready == TRUE)
+        return;
+    tag->ready = TRUE;
+    if (tag->settle_source != NULL) {
+        g_source_destroy(tag->settle_source);
+        g_source_unref(tag->settle_source);
+        tag->settle_source = NULL;
+    }
+
+    const gchar* tag_path = g_dbus_proxy_get_object_path(tag->proxy);
+    g_debug("Tag %s is ready after %" G_GINT64_FORMAT " us", tag_path,
+            g_get_monotonic_time() - tag->found_time);
+    while ((request = g_queue_pop_head(&tag->pending_writes)) != NULL)
+        _issue_write(tag, request);
+    if (self->priv->enrollment != NULL)
+        gtlm_nfc_enrollment_tag_ready(self->priv->enrollment, tag_path);
+    gtlm_nfc_emit_signal(self, SIG_TAG_READY, tag_path, NULL, NULL, 0);
+}
+
+static gboolean
+_on_tag_settled (gpointer user_data)
+{
+    _TagState* tag = user_data;
+
+    g_debug("No records showed up on tag %s", g_dbus_proxy_get_object_path(tag->proxy));
+    _mark_tag_ready(tag->self, tag);
+    return G_SOURCE_REMOVE;
+}
+
+/* Finds the tag that a record (/org/neard/nfcX/tagY/recordZ) belongs to */
+static _TagState*
+_lookup_record_tag (GTlmNfc* self, const gchar* record_path)
+{
+    const gchar* separator = strrchr(record_path, '/');
+    if (separator == NULL)
+        return NULL;
+
+    gchar* tag_path = g_strndup(record_path, separator - record_path);
+    _TagState* tag = g_hash_table_lookup(self->priv->tags, tag_path);
+    g_free(tag_path);
+    return tag;
+}
+
+/* With #GTlmNfc:direct-records, a record reaches us both as a record
+ * object and through the agent, and only the first of them is reported.
+ * Returns %TRUE if @record_path has been reported already.
+ */
+static gboolean
+_record_reported (_TagState* tag, const gchar* record_path)
+{
+    if (tag == NULL || tag->reported_records == NULL || record_path == NULL)
+        return FALSE;
+    if (g_hash_table_remove(tag->reported_records, record_path) == TRUE)
+        return TRUE;
+    g_hash_table_add(tag->reported_records, g_strdup(record_path));
+    return FALSE;
+}
+
+/* Older versions of neard do not tell the agent which record it is called
+ * for. neard publishes the records before it calls the agent, so such a call
+ * can only repeat a record that has been reported from its record object;
+ * it is matched up with it by the payload. Returns the tag the payload was
+ * reported for, or %NULL.
+ */
+static _TagState*
+_take_reported_payload (GTlmNfc* self, GVariant* payload_v)
+{
+    if (self->priv->direct_records == FALSE || payload_v == NULL)
+        return NULL;
+
+    GBytes* payload = g_variant_get_data_as_bytes(payload_v);
+    GHashTableIter iter;
+    _TagState* tag;
+    _TagState* found = NULL;
+    g_hash_table_iter_init(&iter, self->priv->tags);
+    while (found == NULL && g_hash_table_iter_next(&iter, NULL, (gpointer*)&tag)) {
+        if (g_hash_table_remove(tag->reported_payloads, payload) == TRUE)
+            found = tag;
+    }
+    g_bytes_unref(payload);
+    return found;
+}
+
+/* Monotonic timestamps of a record on its way to the record-found handlers;
+ * tag_found is 0 if the tag was already present when we started.
+ */
+typedef struct {
+    gint64 tag_found;
+    gint64 agent_called;
+} _RecordTiming;
+
+static void _decode_username_password(GTlmNfc* self,
+                                      const guint8* data,
+                                      gsize size,
+                                      const _RecordTiming* timing)
+{
+    GTlmNfcPayload payload;
+
+    gboolean decoded = gtlm_nfc_payload_decode(&payload, data, size);
+    gint64 decode_done = g_get_monotonic_time();
+    _stats_add(self, GTLM_NFC_STAGE_DECODE, decode_done - timing->agent_called);
+
+    if (decoded == FALSE) {
+        gtlm_nfc_payload_clear(&payload);
+        gtlm_nfc_emit_signal(self, SIG_NO_RECORD_FOUND, NULL, NULL, NULL, 0);
+        return;
+    }
+
+    // the strings are handed to the handlers without being copied, unless
+    // they have to be passed to another thread
+    gint64 emit_start = g_get_monotonic_time();
+    gtlm_nfc_emit_signal(self, SIG_RECORD_FOUND, NULL, payload.username, payload.password, 0);
+    gint64 emit_done = g_get_monotonic_time();
+
+    _stats_add(self, GTLM_NFC_STAGE_DISPATCH, emit_start - decode_done);
+    _stats_add(self, GTLM_NFC_STAGE_HANDLERS, emit_done - emit_start);
+    if (timing->tag_found > 0)
+        _stats_add(self, GTLM_NFC_STAGE_TOTAL, emit_done - timing->tag_found);
+
+    gtlm_nfc_payload_clear(&payload);
+}
+
+static void
+_dispatch_record(GTlmNfc* self, GVariant* payload_v, const _RecordTiming* timing)
+{
+    if (payload_v == NULL) {
+        gtlm_nfc_emit_signal(self, SIG_NO_RECORD_FOUND, NULL, NULL, NULL, 0);
+        return;
+    }
+
+    gsize size = 0;
+    const guint8* data = g_variant_get_fixed_array(payload_v, &size, sizeof(guint8));
+    _decode_username_password(self, data, size, timing);
+}
+
+/* Finds the tag that a GetNDEF call is about, from the path of its record,
+ * which is returned in @record_path; it points into @parameters.
+ */
+static _TagState*
+_lookup_agent_call_tag (GTlmNfc* self, GVariant* parameters, const gchar** record_path)
+{
+    GVariant* parameters_dict = g_variant_get_child_value(parameters, 0);
+    _TagState* tag = NULL;
+
+    *record_path = NULL;
+    if (g_variant_lookup(parameters_dict, "Record", "&o", record_path))
+        tag = _lookup_record_tag(self, *record_path);
+    g_variant_unref(parameters_dict);
+    return tag;
+}
+
+typedef struct {
+    GTlmNfc* self;
+    GVariant* payload_v;
+    _RecordTiming timing;
+} _DeferredRecord;
+
+static gboolean
+_dispatch_deferred_record(gpointer user_data)
+{
+    _DeferredRecord* record = user_data;
+
+    _dispatch_record(record->self, record->payload_v, &record->timing);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_deferred_record_free(gpointer user_data)
+{
+    _DeferredRecord* record = user_data;
+
+    g_object_unref(record->self);
+    if (record->payload_v != NULL)
+        g_variant_unref(record->payload_v);
+    g_slice_free(_DeferredRecord, record);
+}
+
+static void
+_handle_agent_method_call (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+    GTlmNfc* self = GTLM_NFC(user_data);
+    gchar *parameters_str;
+    const gchar* record_path;
+    _RecordTiming timing;
+
+    timing.agent_called = g_get_monotonic_time();
+
+    parameters_str = g_variant_print (parameters, TRUE);
+    g_debug ("Agent received method call: %s\n\tParameters: %s\n\tSender: %s\n\tObject path: %s\n\tInteface name: %s",
+           method_name, parameters_str, sender, object_path, interface_name);
+    g_free (parameters_str);
+    
+    if (g_strcmp0(method_name, "GetNDEF") != 0) {
+        g_dbus_method_invocation_return_value (invocation, NULL);
+        return;
+    }
+
+    GVariant* payload_v = gtlm_nfc_payload_lookup(parameters);
+    _TagState* tag = _lookup_agent_call_tag(self, parameters, &record_path);
+    gboolean reported = FALSE;
+    if (record_path == NULL) {
+        tag = _take_reported_payload(self, payload_v);
+        reported = tag != NULL;
+    }
+    timing.tag_found = tag != NULL ? tag->found_time : 0;
+    if (timing.tag_found > 0 && tag->reported_records == NULL)
+        _stats_add(self, GTLM_NFC_STAGE_TAG_TO_AGENT, timing.agent_called - timing.tag_found);
+
+    // neard does not handle the next tag until we reply, and the reply
+    // carries no data, so acknowledge before running any signal handlers
+    g_dbus_method_invocation_return_value (invocation, NULL);
+
+    // neard calls the agent once it has read the tag, and again after
+    // writing to it
+    if (tag != NULL) {
+        _verify_read_back(tag, payload_v);
+        _mark_tag_ready(self, tag);
+    }
+
+    if (reported == TRUE || _record_reported(tag, record_path) == TRUE) {
+        g_debug("Record %s has been reported already",
+                record_path != NULL ? record_path : "without a path");
+        if (payload_v != NULL)
+            g_variant_unref(payload_v);
+        return;
+    }
+    if (timing.tag_found > 0 && tag->reported_records != NULL)
+        _stats_add(self, GTLM_NFC_STAGE_TAG_TO_AGENT, timing.agent_called - timing.tag_found);
+
+    if (g_atomic_int_get(&self->priv->deferred_dispatch) == FALSE) {
+        _dispatch_record(self, payload_v, &timing);
+        if (payload_v != NULL)
+            g_variant_unref(payload_v);
+        return;
+    }
+
+    _DeferredRecord* record = g_slice_new(_DeferredRecord);
+    record->self = g_object_ref(self);
+    record->payload_v = payload_v;
+    record->timing = timing;
+
+    GSource* source = g_idle_source_new();
+    g_source_set_priority(source, G_PRIORITY_DEFAULT);
+    g_source_set_callback(source, _dispatch_deferred_record, record, _deferred_record_free);
+    g_source_attach(source, g_main_context_get_thread_default());
+    g_source_unref(source);
+}
+
+static GVariant *
+_handle_agent_get_property (GDBusConnection  *connection,
+                     const gchar      *sender,
+                     const gchar      *object_path,
+                     const gchar      *interface_name,
+                     const gchar      *property_name,
+                     GError          **error,
+                     gpointer          user_data)
+{
+    return NULL;
+}
+
+static gboolean
+_handle_agent_set_property (GDBusConnection  *connection,
+                     const gchar      *sender,
+                     const gchar      *object_path,
+                     const gchar      *interface_name,
+                     const gchar      *property_name,
+                     GVariant         *value,
+                     GError          **error,
+                     gpointer          user_data)
+{
+    return FALSE;
+}
+
+static _TagState*
+_index_tag(GTlmNfc* self, GDBusProxy* proxy, gint64 found_time)
+{
+    _TagState* tag = _tag_state_new(self, proxy, found_time);
+    g_hash_table_replace(self->priv->tags,
+                         g_strdup(g_dbus_proxy_get_object_path(proxy)),
+                         tag);
+    return tag;
+}
+
+/* Records how long it took to recover from a neard restart, once the agent
+ * is registered with the new neard and one of its adapters is polling.
+ */
+static void
+_check_recovered (GTlmNfc* self)
+{
+    if (self->priv->recovery_start == 0 || self->priv->agent_registered == FALSE)
+        return;
+
+    GHashTableIter iter;
+    GTlmNfcAdapter* adapter;
+    g_hash_table_iter_init(&iter, self->priv->adapters);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&adapter)) {
+        if (adapter->polling == FALSE)
+            continue;
+
+        gint64 recovery_time = g_get_monotonic_time() - self->priv->recovery_start;
+        self->priv->recovery_start = 0;
+        g_mutex_lock(&self->priv->stats_lock);
+        _histogram_add(&self->priv->stats.recovery, recovery_time);
+        g_mutex_unlock(&self->priv->stats_lock);
+        g_debug("Recovered from a neard restart after %" G_GINT64_FORMAT " us",
+                recovery_time);
+        return;
+    }
+}
+
+/* Reports the credentials in a record that neard has published, or that
+ * the record has none; with direct-records the payload comes from the
+ * record object, otherwise from the agent call that follows.
+ */
+static void
+_on_record_added (GTlmNfc* self, GDBusProxy* proxy, const gchar* record_path)
+{
+    _RecordTiming timing;
+    timing.agent_called = g_get_monotonic_time();
+    GVariant* type_v = NULL;
+    GVariant* mimetype_v = NULL;
+
+    // with direct-records, the payload is taken from the record object
+    // if neard has put it there, without waiting for the agent call
+    _TagState* tag = _lookup_record_tag(self, record_path);
+    GVariant* payload_v = NULL;
+    if (tag != NULL && tag->reported_records != NULL) {
+        payload_v = g_dbus_proxy_get_cached_property(proxy, "Payload");
+        if (payload_v != NULL && !g_variant_is_of_type(payload_v, G_VARIANT_TYPE_BYTESTRING))
+            g_clear_pointer(&payload_v, g_variant_unref);
+    }
+
+    // neard publishes the records of a tag once it has read them
+    if (tag != NULL) {
+        if (payload_v != NULL)
+            _verify_read_back(tag, payload_v);
+        _mark_tag_ready(self, tag);
+    }
+
+    type_v = g_dbus_proxy_get_cached_property(proxy, "Type");
+    if (type_v == NULL || !g_variant_is_of_type(type_v, G_VARIANT_TYPE_STRING)) {
+        g_debug("Type property is absent on a record");
+        goto no_record;
+    }
+    const gchar* type = g_variant_get_string(type_v, NULL);
+    g_debug("Record has type %s", type);
+    if (g_strcmp0(type, "MIME") != 0)
+        goto no_record;
+
+    mimetype_v = g_dbus_proxy_get_cached_property(proxy, "MIME");
+    if (mimetype_v == NULL || !g_variant_is_of_type(mimetype_v, G_VARIANT_TYPE_STRING)) {
+        g_debug("MIME property is absent on a record");
+        goto no_record;
+    }
+    const gchar* mimetype = g_variant_get_string(mimetype_v, NULL);
+    g_debug("Record has MIME type %s", mimetype);
+    if (g_strcmp0(mimetype, "application/gtlm-nfc") != 0)
+        goto no_record;
+    g_variant_unref(mimetype_v);
+    g_variant_unref(type_v);
+
+    // otherwise the record is reported when neard calls the agent
+    if (payload_v == NULL)
+        return;
+    if (_record_reported(tag, record_path) == TRUE) {
+        g_debug("Record %s has been reported already", record_path);
+        g_variant_unref(payload_v);
+        return;
+    }
+    g_hash_table_add(tag->reported_payloads, g_variant_get_data_as_bytes(payload_v));
+    timing.tag_found = tag->found_time;
+    if (timing.tag_found > 0)
+        _stats_add(self, GTLM_NFC_STAGE_TAG_TO_AGENT,
+                   timing.agent_called - timing.tag_found);
+    _dispatch_record(self, payload_v, &timing);
+    g_variant_unref(payload_v);
+    return;
+
+no_record:
+    if (mimetype_v != NULL)
+        g_variant_unref(mimetype_v);
+    if (type_v != NULL)
+        g_variant_unref(type_v);
+    if (payload_v != NULL)
+        g_variant_unref(payload_v);
+    gtlm_nfc_emit_signal(self, SIG_NO_RECORD_FOUND, NULL, NULL, NULL, 0);
+}
+
+void _on_interface_added(GDBusObjectManager *manager,
+                         GDBusObject        *object,
+                         GDBusInterface     *interface,
+                         gpointer            user_data)
+{
+    GTlmNfc* self = GTLM_NFC(user_data);
+    GDBusProxy* proxy = G_DBUS_PROXY(interface);
+    GTlmNfcProxyKind kind = gtlm_nfc_proxy_get_kind(proxy);
+
+    // a busy neard announces many objects we have no use for
+    if (kind == GTLM_NFC_PROXY_OTHER)
+        return;
+
+    g_debug("Object %s added interface %s", 
+                    g_dbus_object_get_object_path (object),
+                    g_dbus_proxy_get_interface_name (proxy));
+    
+    if (kind == GTLM_NFC_PROXY_ADAPTER) {
+        GTlmNfcAdapter* adapter = gtlm_nfc_adapter_index(self, proxy);
+        gtlm_nfc_adapter_setup(self, adapter);
+        gtlm_nfc_adapter_touch(adapter);
+        _check_recovered(self);
+        return;
+    }
+    if (kind == GTLM_NFC_PROXY_TAG) {
+        _TagState* tag = _index_tag(self, proxy, g_get_monotonic_time());
+        GTlmNfcAdapter* adapter = gtlm_nfc_adapter_lookup_for_tag(self, proxy);
+        if (adapter != NULL) {
+            adapter->n_tags++;
+            gtlm_nfc_adapter_touch(adapter);
+        }
+        gtlm_nfc_emit_signal(self, SIG_TAG_FOUND, g_dbus_object_get_object_path (object), NULL, NULL, 0);
+
+        if (self->priv->tag_settle_time == 0) {
+            _mark_tag_ready(self, tag);
+        } else {
+            GMainContext* context = g_main_context_ref_thread_default();
+            tag->settle_source = g_timeout_source_new(self->priv->tag_settle_time);
+            g_source_set_callback(tag->settle_source, _on_tag_settled, tag, NULL);
+            g_source_attach(tag->settle_source, context);
+            g_main_context_unref(context);
+        }
+        return;
+    }
+
+    if (kind == GTLM_NFC_PROXY_RECORD)
+        _on_record_added(self, proxy, g_dbus_object_get_object_path (object));
+}
+
+static void
+_setup_nfc_adapters(GTlmNfc *self)
+{
+    GList* objects = g_dbus_object_manager_get_objects(self->priv->neard_manager);
+    GList* objects_iter = objects;
+    
+    while (objects_iter != NULL) {
         GList* interfaces = g_dbus_object_get_interfaces(objects_iter->data);
         GList* interfaces_iter = interfaces;
         while (interfaces_iter != NULL) {
             g_debug("Checking managed object %s, interface %s", 
                     g_dbus_object_get_object_path (objects_iter->data),
                     g_dbus_proxy_get_interface_name (interfaces_iter->data));
-            if (g_strcmp0(g_dbus_proxy_get_interface_name (interfaces_iter->data),
-                "org.neard.Adapter") == 0) {
-                _setup_nfc_adapter(self, interfaces_iter->data);
+            switch (gtlm_nfc_proxy_get_kind(interfaces_iter->data)) {
+            case GTLM_NFC_PROXY_ADAPTER:
+                gtlm_nfc_adapter_index(self, interfaces_iter->data);
+                break;
+            case GTLM_NFC_PROXY_TAG:
+                _index_tag(self, interfaces_iter->data, 0);
+                break;
+            default:
+                break;
             }
             g_object_unref(interfaces_iter->data);
             interfaces_iter = interfaces_iter->next;
         }
-        g_list_free(interfaces);
-        g_object_unref(objects_iter->data);
-        objects_iter = objects_iter->next;
+        g_list_free(interfaces);
+        g_object_unref(objects_iter->data);
+        objects_iter = objects_iter->next;
+    }
+    g_list_free(objects);
+
+    // tags can be listed before their adapters, so count them afterwards
+    GHashTableIter tags_iter;
+    _TagState* tag;
+    g_hash_table_iter_init(&tags_iter, self->priv->tags);
+    while (g_hash_table_iter_next(&tags_iter, NULL, (gpointer*)&tag)) {
+        GTlmNfcAdapter* adapter = gtlm_nfc_adapter_lookup_for_tag(self, tag->proxy);
+        if (adapter != NULL)
+            adapter->n_tags++;
+    }
+
+    // all adapters are known now, so that a setup that completes right
+    // away cannot signal adapters-ready while others are still to come
+    GHashTableIter adapters_iter;
+    GTlmNfcAdapter* adapter;
+    g_hash_table_iter_init(&adapters_iter, self->priv->adapters);
+    while (g_hash_table_iter_next(&adapters_iter, NULL, (gpointer*)&adapter))
+        gtlm_nfc_adapter_setup(self, adapter);
+}
+
+
+
+void _on_interface_removed(GDBusObjectManager *manager,
+                         GDBusObject        *object,
+                         GDBusInterface     *interface,
+                         gpointer            user_data)
+{
+    GTlmNfc* self = GTLM_NFC(user_data);
+    GDBusProxy* proxy = G_DBUS_PROXY(interface);
+    GTlmNfcProxyKind kind = gtlm_nfc_proxy_get_kind(proxy);
+
+    if (kind == GTLM_NFC_PROXY_OTHER)
+        return;
+
+    g_debug("Object %s removed interface %s", 
+                    g_dbus_object_get_object_path (object),
+                    g_dbus_proxy_get_interface_name (proxy));    
+
+    if (kind == GTLM_NFC_PROXY_TAG) {
+        GTlmNfcAdapter* adapter = gtlm_nfc_adapter_lookup_for_tag(self, proxy);
+        if (adapter != NULL) {
+            if (adapter->n_tags > 0)
+                adapter->n_tags--;
+            gtlm_nfc_adapter_touch(adapter);
+            // restart polling on the adapter before anyone handles tag-lost
+            gtlm_nfc_adapter_rearm(self, adapter);
+        }
+
+        g_hash_table_remove(self->priv->tags, g_dbus_object_get_object_path (object));
+        gtlm_nfc_emit_signal(self, SIG_TAG_LOST, g_dbus_object_get_object_path (object), NULL, NULL, 0);
+        return;
+    }
+    if (kind == GTLM_NFC_PROXY_RECORD) {
+        // neard reads a tag again after writing to it, with new records
+        _TagState* tag = _lookup_record_tag(self, g_dbus_object_get_object_path (object));
+        if (tag != NULL && tag->reported_records != NULL)
+            g_hash_table_remove(tag->reported_records, g_dbus_object_get_object_path (object));
+        return;
+    }
+    if (kind == GTLM_NFC_PROXY_ADAPTER) {
+        gtlm_nfc_adapter_remove(self, g_dbus_object_get_object_path (object));
+        return;
+    }
+}
+
+
+void _on_object_added(GDBusObjectManager *manager,
+                         GDBusObject        *object,
+                         gpointer            user_data)
+{
+    // only the interfaces we use are logged, as they are checked
+    GList* interfaces = g_dbus_object_get_interfaces(object);
+    GList* interfaces_iter = interfaces;
+    while (interfaces_iter != NULL) {
+        _on_interface_added(manager, object, interfaces_iter->data, user_data);
+        g_object_unref(interfaces_iter->data);
+        interfaces_iter = interfaces_iter->next;
+    }
+    g_list_free(interfaces);
+}
+
+void _on_object_removed(GDBusObjectManager *manager,
+                         GDBusObject        *object,
+                         gpointer            user_data)
+{
+    // the interfaces we use are logged as they are checked
+
+    GList* interfaces = g_dbus_object_get_interfaces(object);
+    GList* interfaces_iter = interfaces;
+    while (interfaces_iter != NULL) {
+        _on_interface_removed(manager, object, interfaces_iter->data, user_data);
+        g_object_unref(interfaces_iter->data);
+        interfaces_iter = interfaces_iter->next;
+    }
+    g_list_free(interfaces);
+}
+
+void _on_property_changed (GDBusObjectManagerClient *manager,
+                                                        GDBusObjectProxy         *object_proxy,
+                                                        GDBusProxy               *interface_proxy,
+                                                        GVariant                 *changed_properties,
+                                                        GStrv                     invalidated_properties,
+                                                        gpointer                  user_data)
+{
+    GTlmNfc* self = GTLM_NFC(user_data);
+    gchar *parameters_str;
+
+    GVariantIter iter;
+    const gchar* property_name;
+    GVariant* value;
+
+    // tags are checked before writing to them (read-only, type)
+    if (gtlm_nfc_proxy_get_kind(interface_proxy) == GTLM_NFC_PROXY_TAG) {
+        _TagState* tag = g_hash_table_lookup(self->priv->tags,
+                                             g_dbus_proxy_get_object_path(interface_proxy));
+        if (tag == NULL)
+            return;
+        g_variant_iter_init(&iter, changed_properties);
+        while (g_variant_iter_next(&iter, "{&sv}", &property_name, &value)) {
+            _tag_state_update(tag, property_name, value);
+            g_variant_unref(value);
+        }
+        return;
+    }
+
+    // otherwise only adapter properties are tracked; skip the others before
+    // paying for printing them
+    if (gtlm_nfc_proxy_get_kind(interface_proxy) != GTLM_NFC_PROXY_ADAPTER)
+        return;
+
+    parameters_str = g_variant_print (changed_properties, TRUE);
+    g_debug("Property of object %s changed:\n%s",
+            g_dbus_object_get_object_path(G_DBUS_OBJECT(object_proxy)), parameters_str);
+    g_debug("Invalidated properties:");
+    while (*invalidated_properties != NULL) {
+        g_debug("%s", *invalidated_properties);
+        invalidated_properties++;
+    }
+    g_free(parameters_str);
+
+    GTlmNfcAdapter* adapter = g_hash_table_lookup(self->priv->adapters,
+                                                 g_dbus_proxy_get_object_path(interface_proxy));
+    if (adapter == NULL)
+        return;
+
+    g_variant_iter_init(&iter, changed_properties);
+    while (g_variant_iter_next(&iter, "{&sv}", &property_name, &value)) {
+        gtlm_nfc_adapter_update(adapter, property_name, value);
+        g_variant_unref(value);
+    }
+
+    if (adapter->polling == TRUE) {
+        gtlm_nfc_adapter_rearm_complete(self, adapter);
+        _check_recovered(self);
+    }
+}
+
+static const GDBusInterfaceVTable agent_interface_vtable =
+{
+    _handle_agent_method_call,
+    _handle_agent_get_property,
+    _handle_agent_set_property
+};
+
+static gboolean
+_register_agent_object(GTlmNfc* self, GError** error)
+{
+    /* Introspection data for the agent object we are exporting */
+    const gchar introspection_xml[] =
+        "<node>"
+        "  <interface name='org.neard.NDEFAgent'>"
+        "    <method name='GetNDEF'>"
+        "      <arg type='a{sv}' name='values' direction='in'/>"
+        "    </method>"
+        "    <method name='Release'>"
+        "    </method>"
+        "  </interface>"
+        "</node>";
+
+    GDBusNodeInfo *introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+      
+    self->priv->agent_registration_id = g_dbus_connection_register_object (self->priv->system_bus,
+                                                       "/org/tlmnfc/agent",
+                                                       introspection_data->interfaces[0],
+                                                       &agent_interface_vtable,
+                                                       self,
+                                                       NULL,
+                                                       error);
+    g_dbus_node_info_unref (introspection_data);
+
+    if (self->priv->agent_registration_id <= 0) {
+        g_prefix_error (error, "Error registering an agent object: ");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void
+_on_agent_reregistered (GObject      *source_object,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+    GTlmNfc* self = GTLM_NFC(user_data);
+    GError* error = NULL;
+
+    GVariant* response = g_dbus_connection_call_finish (G_DBUS_CONNECTION(source_object),
+                                                        res,
+                                                        &error);
+    if (response == NULL) {
+        g_debug("Error registering an agent with the restarted neard: %s", error->message);
+        g_error_free (error);
+    } else {
+        g_variant_unref(response);
+        self->priv->agent_registered = TRUE;
+        _check_recovered(self);
+    }
+    g_object_unref(self);
+}
+
+/* A restarted neard has forgotten our agent, so it is registered again.
+ * Adapters need no special handling: the object manager drops them when
+ * neard goes away and announces them again once it is back, which sets
+ * them up the same way as hotplugged ones.
+ */
+static void
+_on_neard_owner_changed (GDBusConnection *connection,
+                         const gchar     *sender_name,
+                         const gchar     *object_path,
+                         const gchar     *interface_name,
+                         const gchar     *signal_name,
+                         GVariant        *parameters,
+                         gpointer         user_data)
+{
+    GTlmNfc* self = GTLM_NFC(user_data);
+    const gchar* old_owner;
+    const gchar* new_owner;
+
+    g_variant_get(parameters, "(&s&s&s)", NULL, &old_owner, &new_owner);
+    if (old_owner[0] != '\0') {
+        g_debug("neard has gone away");
+        self->priv->agent_registered = FALSE;
+        self->priv->recovery_start = 0;
+    }
+    if (new_owner[0] == '\0')
+        return;
+
+    g_debug("neard has come back, registering the agent again");
+    self->priv->recovery_start = g_get_monotonic_time();
+    g_dbus_connection_call (self->priv->system_bus,
+                            "org.neard",
+                            "/org/neard",
+                            "org.neard.AgentManager",
+                            "RegisterNDEFAgent",
+                            g_variant_new("(os)",
+                                          "/org/tlmnfc/agent",
+                                          "application/gtlm-nfc"),
+                            NULL,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            _on_agent_reregistered,
+                            g_object_ref(self));
+}
+
+/* This is subscribed before the object manager is created, so that it sees
+ * a restarted neard before the object manager starts fetching its objects.
+ */
+static void
+_watch_neard (GTlmNfc* self)
+{
+    self->priv->neard_watch_id = g_dbus_connection_signal_subscribe (self->priv->system_bus,
+                                                               "org.freedesktop.DBus",
+                                                               "org.freedesktop.DBus",
+                                                               "NameOwnerChanged",
+                                                               "/org/freedesktop/DBus",
+                                                               "org.neard",
+                                                               G_DBUS_SIGNAL_FLAGS_NONE,
+                                                               _on_neard_owner_changed,
+                                                               self,
+                                                               NULL);
+}
+
+static void
+_setup_neard_manager(GTlmNfc* self)
+{
+    // subscribe to interface added/removed signals
+    g_signal_connect (G_DBUS_OBJECT_MANAGER(self->priv->neard_manager),
+                    "interface-added",
+                    G_CALLBACK (_on_interface_added),
+                    self);
+    g_signal_connect (G_DBUS_OBJECT_MANAGER(self->priv->neard_manager),
+                    "interface-removed",
+                    G_CALLBACK (_on_interface_removed),
+                    self);
+    g_signal_connect (G_DBUS_OBJECT_MANAGER(self->priv->neard_manager),
+                    "object-added",
+                    G_CALLBACK (_on_object_added),
+                    self);
+    g_signal_connect (G_DBUS_OBJECT_MANAGER(self->priv->neard_manager),
+                    "object-removed",
+                    G_CALLBACK (_on_object_removed),
+                    self);
+    
+    
+    g_signal_connect (G_DBUS_OBJECT_MANAGER(self->priv->neard_manager),
+                    "interface-proxy-properties-changed",
+                    G_CALLBACK (_on_property_changed),
+                    self);
+    
+    self->priv->activation = ACTIVATION_DONE;
+    self->priv->agent_registered = TRUE;
+    _setup_nfc_adapters(self);
+    gtlm_nfc_adapters_touch(self);
+}
+
+/* Connects to neard: registers the agent and sets up the adapters */
+static gboolean
+_connect_engine (GTlmNfc       *self,
+                 GCancellable  *cancellable,
+                 GError       **error)
+{
+    self->priv->activation = ACTIVATION_PENDING;
+
+    self->priv->system_bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, cancellable, error);
+    if (self->priv->system_bus == NULL) {
+        g_prefix_error (error, "Error getting a system bus: ");
+        return FALSE;
+    }
+
+    if (_register_agent_object(self, error) == FALSE)
+        return FALSE;
+    _watch_neard(self);
+
+    GVariant* agent_register_response = g_dbus_connection_call_sync (self->priv->system_bus,
+                                         "org.neard",
+                                         "/org/neard",
+                                         "org.neard.AgentManager",
+                                        "RegisterNDEFAgent",
+                                        g_variant_new("(os)", 
+                                                      "/org/tlmnfc/agent", 
+                                                      "application/gtlm-nfc"),
+                                        NULL,              
+                                        G_DBUS_CALL_FLAGS_NONE,
+                                        -1,
+                                        cancellable,
+                                        error);
+    if (agent_register_response == NULL) {
+        g_prefix_error (error, "Error registering an agent with neard: ");
+        return FALSE;
+    }
+    g_variant_unref(agent_register_response);
+
+    self->priv->neard_manager = g_dbus_object_manager_client_new_sync (self->priv->system_bus,
+                                         G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_NONE,
+                                         "org.neard",
+                                         "/",
+                                         NULL, NULL, NULL,
+                                         cancellable,
+                                         error);
+    if (self->priv->neard_manager == NULL) {
+        g_prefix_error (error, "Error creating neard object manager: ");
+        return FALSE;
+    }
+
+    _setup_neard_manager(self);
+    return TRUE;
+}
+
+static gboolean
+_init_engine (GTlmNfc       *self,
+              GCancellable  *cancellable,
+              GError       **error)
+{
+    if (self->priv->lazy == TRUE)
+        return TRUE;
+    return _connect_engine(self, cancellable, error);
+}
+
+/* In worker thread mode, everything that talks to neard is set up on the
+ * worker thread, so that neard's replies, signals and agent calls are all
+ * dispatched there.
+ */
+static void
+_start_worker (GTlmNfc* self)
+{
+    GMainContext* context = g_main_context_ref_thread_default();
+
+    self->priv->worker = gtlm_nfc_worker_new("gtlm-nfc");
+    self->priv->events = gtlm_nfc_mailbox_new(context, _deliver_event, _discard_event, NULL);
+    g_main_context_unref(context);
+}
+
+typedef struct {
+    GTlmNfc* self;
+    GCancellable* cancellable;
+    GError** error;
+    gboolean result;
+} _InitEngine;
+
+static gboolean
+_init_engine_on_worker (gpointer user_data)
+{
+    _InitEngine* init = user_data;
+
+    init->result = _init_engine(init->self, init->cancellable, init->error);
+    return G_SOURCE_REMOVE;
+}
+
+/* The engine used by all instances in the process that have GTlmNfc:shared
+ * set. It is an instance without GTlmNfc:shared that talks to neard for
+ * them, and passes its signals on to them.
+ */
+static GMutex _shared_engine_lock;
+static GCond _shared_engine_cond;
+static GWeakRef _shared_engine;
+
+static GTlmNfc*
+_new_shared_engine (GTlmNfc* self)
+{
+    GTlmNfc* engine = g_object_new(G_TYPE_TLM_NFC,
+                                   "shared", FALSE,
+                                   "worker-thread", self->priv->worker_thread,
+                                   "lazy", self->priv->lazy,
+                                   "idle-timeout", self->priv->idle_timeout,
+                                   "tag-settle-time", self->priv->tag_settle_time,
+                                   "direct-records", self->priv->direct_records,
+                                   NULL);
+    engine->priv->fan_out = TRUE;
+    return engine;
+}
+
+/* Takes over the reference to @engine. Called with the lock held, so that
+ * the engine cannot lose its last instance in the meantime.
+ */
+static void
+_subscribe (GTlmNfc* self, GTlmNfc* engine)
+{
+    GMainContext* context = g_main_context_ref_thread_default();
+
+    self->priv->engine = engine;
+    self->priv->events = gtlm_nfc_mailbox_new(context, _deliver_event, _discard_event, NULL);
+    g_main_context_unref(context);
+
+    self->priv->subscription = g_new0(GWeakRef, 1);
+    g_weak_ref_init(self->priv->subscription, self);
+    g_mutex_lock(&engine->priv->subscribers_lock);
+    engine->priv->subscribers = g_list_prepend(engine->priv->subscribers,
+                                               self->priv->subscription);
+    g_mutex_unlock(&engine->priv->subscribers_lock);
+}
+
+/* Stops passing the engine's signals on to @self. Returns %TRUE if @self
+ * was the last instance using the engine; new instances will then set up an
+ * engine of their own.
+ */
+static gboolean
+_leave_shared_engine (GTlmNfc* self)
+{
+    GTlmNfc* engine = self->priv->engine;
+
+    g_mutex_lock(&_shared_engine_lock);
+    g_mutex_lock(&engine->priv->subscribers_lock);
+    engine->priv->subscribers = g_list_remove(engine->priv->subscribers,
+                                              self->priv->subscription);
+    gboolean last = engine->priv->subscribers == NULL;
+    g_mutex_unlock(&engine->priv->subscribers_lock);
+    g_weak_ref_clear(self->priv->subscription);
+    g_clear_pointer(&self->priv->subscription, g_free);
+
+    if (last == TRUE) {
+        GTlmNfc* current = g_weak_ref_get(&_shared_engine);
+        if (current == engine)
+            g_weak_ref_set(&_shared_engine, NULL);
+        if (current != NULL)
+            g_object_unref(current);
+    }
+    g_mutex_unlock(&_shared_engine_lock);
+    return last;
+}
+
+/* Leaves the engine, and lets go of it; returns whether @self was the last
+ * instance using it
+ */
+static gboolean
+_unsubscribe (GTlmNfc* self)
+{
+    GTlmNfc* engine = self->priv->engine;
+
+    gboolean last = _leave_shared_engine(self);
+    g_atomic_pointer_set(&self->priv->engine, NULL);
+    g_object_unref(engine);
+    return last;
+}
+
+/* An instance that joins an engine which is already set up has missed
+ * adapters-ready. It is queued, as it would otherwise be emitted before the
+ * caller had a chance to connect to it. Runs on the engine's thread, like
+ * the passing on of signals, so an instance that got adapters-ready that
+ * way is not greeted again, and one that joined before the engine got that
+ * far is left to get it that way.
+ */
+static gboolean
+_greet_subscriber (gpointer user_data)
+{
+    GTlmNfc* self = GTLM_NFC(user_data);
+    GTlmNfc* engine = g_atomic_pointer_get(&self->priv->engine);
+
+    if (engine != NULL && self->priv->greeted == FALSE &&
+            engine->priv->adapters_announced == TRUE &&
+            engine->priv->activation == ACTIVATION_DONE &&
+            engine->priv->adapters_pending == 0) {
+        self->priv->greeted = TRUE;
+        _queue_signal(self, SIG_ADAPTERS_READY, NULL, NULL, NULL, 0);
+    }
+    g_object_unref(self);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_greet (GTlmNfc* self, GTlmNfc* engine)
+{
+    gtlm_nfc_invoke_engine(engine, _greet_subscriber, g_object_ref(self), g_object_unref);
+}
+
+/* Records the outcome of setting up the shared engine, and hands it to the
+ * instances that have been waiting for it
+ */
+static void
+_finish_shared_engine_init (GTlmNfc* engine, const GError* error)
+{
+    g_mutex_lock(&_shared_engine_lock);
+    engine->priv->init_pending = FALSE;
+    engine->priv->ready = error == NULL;
+    if (error != NULL) {
+        engine->priv->init_error = g_error_copy(error);
+        g_weak_ref_set(&_shared_engine, NULL);
+    }
+    g_clear_pointer(&engine->priv->init_context, g_main_context_unref);
+    GList* waiters = engine->priv->init_waiters;
+    engine->priv->init_waiters = NULL;
+    g_cond_broadcast(&_shared_engine_cond);
+    g_mutex_unlock(&_shared_engine_lock);
+
+    for (GList* iter = waiters; iter != NULL; iter = iter->next) {
+        GTask* task = G_TASK(iter->data);
+        if (error == NULL) {
+            g_task_return_boolean(task, TRUE);
+        } else {
+            _unsubscribe(g_task_get_source_object(task));
+            g_task_return_error(task, g_error_copy(error));
+        }
+        g_object_unref(task);
+    }
+    g_list_free(waiters);
+}
+
+/* Waits, with the lock held, for another instance to finish setting up
+ * @engine. If that is a gtlm_nfc_new_async() call made from the calling
+ * thread's main context, the context is run meanwhile, as the setup could
+ * not complete otherwise. The lock is let go of while it runs, so the
+ * caller must have subscribed to @engine already, and everything is looked
+ * at again afterwards.
+ */
+static gboolean
+_wait_for_shared_engine (GTlmNfc* engine, GError** error)
+{
+    GMainContext* context = g_main_context_ref_thread_default();
+
+    while (engine->priv->init_pending == TRUE) {
+        if (engine->priv->init_context == context && g_main_context_acquire(context)) {
+            g_mutex_unlock(&_shared_engine_lock);
+            g_main_context_iteration(context, TRUE);
+            g_main_context_release(context);
+            g_mutex_lock(&_shared_engine_lock);
+        } else {
+            g_cond_wait(&_shared_engine_cond, &_shared_engine_lock);
+        }
+    }
+    g_main_context_unref(context);
+
+    if (engine->priv->ready == FALSE) {
+        g_propagate_error(error, g_error_copy(engine->priv->init_error));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean
+_init_shared (GTlmNfc       *self,
+              GCancellable  *cancellable,
+              GError       **error)
+{
+    g_mutex_lock(&_shared_engine_lock);
+    GTlmNfc* engine = g_weak_ref_get(&_shared_engine);
+
+    if (engine != NULL) {
+        _subscribe(self, engine);
+        gboolean ready = _wait_for_shared_engine(engine, error);
+        if (ready == TRUE)
+            _greet(self, engine);
+        g_mutex_unlock(&_shared_engine_lock);
+        if (ready == FALSE)
+            _unsubscribe(self);
+        return ready;
     }
-    g_list_free(objects);
-    
+
+    // other instances wait for the engine to be set up, but the lock is
+    // not held meanwhile
+    engine = _new_shared_engine(self);
+    engine->priv->init_pending = TRUE;
+    g_weak_ref_set(&_shared_engine, engine);
+    _subscribe(self, engine);
+    g_mutex_unlock(&_shared_engine_lock);
+
+    GError* init_error = NULL;
+    g_initable_init(G_INITABLE(engine), cancellable, &init_error);
+    _finish_shared_engine_init(engine, init_error);
+    if (init_error != NULL) {
+        _unsubscribe(self);
+        g_propagate_error(error, init_error);
+        return FALSE;
+    }
+    return TRUE;
 }
 
+static void
+_on_shared_engine_ready (GObject      *source_object,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+    GTlmNfc* engine = GTLM_NFC(source_object);
+    GError* error = NULL;
 
+    g_async_initable_init_finish(G_ASYNC_INITABLE(engine), res, &error);
+    _finish_shared_engine_init(engine, error);
+    if (error != NULL)
+        g_error_free(error);
+}
 
-void _on_interface_removed(GDBusObjectManager *manager,
-                         GDBusObject        *object,
-                         GDBusInterface     *interface,
-                         gpointer            user_data)
+/* Instances created while the engine is being set up wait for it */
+static void
+_init_shared_async (GTlmNfc* self, GTask* task)
 {
-    GTlmNfc* self = GTLM_NFC(user_data);
-    GDBusProxy* proxy = G_DBUS_PROXY(interface);
-    g_debug("Object %s removed interface %s", 
-                    g_dbus_object_get_object_path (object),
-                    g_dbus_proxy_get_interface_name (proxy));    
+    g_mutex_lock(&_shared_engine_lock);
+    GTlmNfc* engine = g_weak_ref_get(&_shared_engine);
+
+    if (engine != NULL && engine->priv->ready == TRUE) {
+        _subscribe(self, engine);
+        _greet(self, engine);
+        g_mutex_unlock(&_shared_engine_lock);
+        g_task_return_boolean(task, TRUE);
+        g_object_unref(task);
+        return;
+    }
 
-    if (g_strcmp0(g_dbus_proxy_get_interface_name (proxy),
-                "org.neard.Tag") == 0) {
-        g_signal_emit(self, signals[SIG_TAG_LOST], 0, g_dbus_object_get_object_path (object));
-    
-        GVariant* adapter_v = g_dbus_proxy_get_cached_property(proxy, "Adapter");
-        if (adapter_v == NULL || !g_variant_is_of_type(adapter_v, G_VARIANT_TYPE_OBJECT_PATH)) {
-            g_debug("Adapter property is absent on a tag");
-            return;
-        }
-        const gchar* adapter_path = g_variant_get_string(adapter_v, NULL);
-        g_debug("Tag belongs to adapter %s", adapter_path);
-        GError* error = NULL;
-        GDBusProxy* adapter = g_dbus_proxy_new_for_bus_sync(G_BUS_TYPE_SYSTEM,
-                                         G_DBUS_PROXY_FLAGS_NONE,
-                                         NULL, /* GDBusInterfaceInfo */
-                                         "org.neard",
-                                         adapter_path,
-                                         "org.neard.Adapter",
-                                         NULL, /* GCancellable */
-                                         &error);
-        if (adapter == NULL) {
-            g_debug ("Error creating adapter proxy: %s", error->message);
+    gboolean start = engine == NULL;
+    if (start == TRUE) {
+        engine = _new_shared_engine(self);
+        engine->priv->init_pending = TRUE;
+        engine->priv->init_context = g_main_context_ref_thread_default();
+        g_weak_ref_set(&_shared_engine, engine);
+    }
+    _subscribe(self, engine);
+    engine->priv->init_waiters = g_list_append(engine->priv->init_waiters, task);
+    g_mutex_unlock(&_shared_engine_lock);
+
+    if (start == TRUE)
+        g_async_initable_init_async(G_ASYNC_INITABLE(engine), g_task_get_priority(task),
+                                    NULL, _on_shared_engine_ready, NULL);
+}
+
+/* Called once an instance is being set up through GInitable or
+ * GAsyncInitable, so that gtlm_nfc_constructed() does not do it again
+ */
+static void
+_drop_default_init (GTlmNfc* self)
+{
+    if (self->priv->default_init == NULL)
+        return;
+    g_source_destroy(self->priv->default_init);
+    g_clear_pointer(&self->priv->default_init, g_source_unref);
+}
+
+static gboolean
+gtlm_nfc_initable_init (GInitable     *initable,
+                        GCancellable  *cancellable,
+                        GError       **error)
+{
+    GTlmNfc* self = GTLM_NFC(initable);
+
+    _drop_default_init(self);
+
+    if (self->priv->shared == TRUE)
+        return _init_shared(self, cancellable, error);
+
+    if (self->priv->worker_thread == FALSE)
+        return _init_engine(self, cancellable, error);
+
+    _InitEngine init = { self, cancellable, error, FALSE };
+    gtlm_nfc_worker_invoke_sync(self->priv->worker, _init_engine_on_worker, &init);
+    return init.result;
+}
+
+static void
+gtlm_nfc_initable_iface_init (GInitableIface *iface)
+{
+    iface->init = gtlm_nfc_initable_init;
+}
+
+typedef struct {
+    guint pending;
+    GError* error;
+} _InitData;
+
+static void
+_init_data_free (_InitData* data)
+{
+    if (data->error)
+        g_error_free(data->error);
+    g_slice_free(_InitData, data);
+}
+
+static void
+_init_step_done (GTask* task, GError* error)
+{
+    _InitData* data = g_task_get_task_data(task);
+
+    if (error != NULL) {
+        if (data->error == NULL)
+            data->error = error;
+        else
             g_error_free(error);
-            g_variant_unref(adapter_v);
+    }
+
+    if (--data->pending > 0) {
+        g_object_unref(task);
+        return;
+    }
+
+    GTlmNfc* self = g_task_get_source_object(task);
+    if (data->error == NULL && self->priv->activation == ACTIVATION_SHUT_DOWN)
+        data->error = g_error_new(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                  "gtlm_nfc_shutdown_async() was called");
+
+    if (data->error != NULL) {
+        g_task_return_error(task, data->error);
+        data->error = NULL;
+    } else {
+        _setup_neard_manager(self);
+        g_task_return_boolean(task, TRUE);
+    }
+    g_object_unref(task);
+}
+
+static void
+_on_agent_registered (GObject      *source_object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+    GError* error = NULL;
+
+    GVariant* response = g_dbus_connection_call_finish (G_DBUS_CONNECTION(source_object),
+                                                        res,
+                                                        &error);
+    if (response == NULL)
+        g_prefix_error (&error, "Error registering an agent with neard: ");
+    else
+        g_variant_unref(response);
+
+    _init_step_done(G_TASK(user_data), error);
+}
+
+static void
+_on_neard_manager_ready (GObject      *source_object,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+    GTask* task = G_TASK(user_data);
+    GTlmNfc* self = g_task_get_source_object(task);
+    GError* error = NULL;
+
+    self->priv->neard_manager = g_dbus_object_manager_client_new_finish (res, &error);
+    if (self->priv->neard_manager == NULL)
+        g_prefix_error (&error, "Error creating neard object manager: ");
+
+    _init_step_done(task, error);
+}
+
+static void
+_on_system_bus_ready (GObject      *source_object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+    GTask* task = G_TASK(user_data);
+    GTlmNfc* self = g_task_get_source_object(task);
+    _InitData* data = g_task_get_task_data(task);
+    GError* error = NULL;
+
+    self->priv->system_bus = g_bus_get_finish(res, &error);
+    if (self->priv->system_bus == NULL) {
+        g_prefix_error (&error, "Error getting a system bus: ");
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+
+    if (_register_agent_object(self, &error) == FALSE) {
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+    _watch_neard(self);
+
+    // agent registration and object manager setup do not depend on each
+    // other, so both are in flight at the same time
+    data->pending = 2;
+    g_dbus_connection_call (self->priv->system_bus,
+                            "org.neard",
+                            "/org/neard",
+                            "org.neard.AgentManager",
+                            "RegisterNDEFAgent",
+                            g_variant_new("(os)",
+                                          "/org/tlmnfc/agent",
+                                          "application/gtlm-nfc"),
+                            NULL,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            g_task_get_cancellable(task),
+                            _on_agent_registered,
+                            task);
+    g_dbus_object_manager_client_new (self->priv->system_bus,
+                                      G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_NONE,
+                                      "org.neard",
+                                      "/",
+                                      NULL, NULL, NULL,
+                                      g_task_get_cancellable(task),
+                                      _on_neard_manager_ready,
+                                      g_object_ref(task));
+}
+
+/* The worker thread may block, so it simply runs the synchronous setup */
+static gboolean
+_init_engine_in_task (gpointer user_data)
+{
+    GTask* task = G_TASK(user_data);
+    GError* error = NULL;
+
+    if (_init_engine(g_task_get_source_object(task), g_task_get_cancellable(task), &error))
+        g_task_return_boolean(task, TRUE);
+    else
+        g_task_return_error(task, error);
+    g_object_unref(task);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+gtlm_nfc_async_initable_init_async (GAsyncInitable      *initable,
+                                    int                  io_priority,
+                                    GCancellable        *cancellable,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+    GTlmNfc* self = GTLM_NFC(initable);
+    GTask* task = g_task_new(initable, cancellable, callback, user_data);
+    g_task_set_source_tag(task, gtlm_nfc_async_initable_init_async);
+    _drop_default_init(self);
+    g_task_set_priority(task, io_priority);
+
+    if (self->priv->shared == TRUE) {
+        _init_shared_async(self, task);
+        return;
+    }
+
+    if (self->priv->worker_thread == TRUE) {
+        g_main_context_invoke(gtlm_nfc_worker_get_context(self->priv->worker),
+                              _init_engine_in_task, task);
+        return;
+    }
+
+    if (self->priv->lazy == TRUE) {
+        g_task_return_boolean(task, TRUE);
+        g_object_unref(task);
+        return;
+    }
+
+    self->priv->activation = ACTIVATION_PENDING;
+    g_task_set_task_data(task, g_slice_new0(_InitData), (GDestroyNotify)_init_data_free);
+    g_bus_get(G_BUS_TYPE_SYSTEM, cancellable, _on_system_bus_ready, task);
+}
+
+static gboolean
+gtlm_nfc_async_initable_init_finish (GAsyncInitable  *initable,
+                                     GAsyncResult    *res,
+                                     GError         **error)
+{
+    g_return_val_if_fail (g_task_is_valid (res, initable), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(res), error);
+}
+
+static void
+gtlm_nfc_async_initable_iface_init (GAsyncInitableIface *iface)
+{
+    iface->init_async = gtlm_nfc_async_initable_init_async;
+    iface->init_finish = gtlm_nfc_async_initable_init_finish;
+}
+
+static gboolean _teardown_engine (gpointer user_data);
+static void _release_engine (GTlmNfc* self);
+
+static void
+_activation_failed (GTlmNfc* self, GError* error)
+{
+    g_debug("Error connecting to neard: %s", error->message);
+    g_error_free(error);
+
+    // undo what was done, so that the next activation starts afresh
+    _teardown_engine(self);
+}
+
+static void
+_on_activated (GObject      *source_object,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+    GError* error = NULL;
+
+    if (g_task_propagate_boolean(G_TASK(res), &error) == FALSE)
+        _activation_failed(GTLM_NFC(source_object), error);
+}
+
+/* Connects to neard if that has not been done yet, or restarts polling if
+ * it was stopped for inactivity. Runs on the thread that talks to neard.
+ */
+void gtlm_nfc_activate_engine(GTlmNfc* self)
+{
+    if (self->priv->activation == ACTIVATION_PENDING ||
+            self->priv->activation == ACTIVATION_SHUT_DOWN)
+        return;
+
+    if (self->priv->activation == ACTIVATION_NONE) {
+        g_debug("Connecting to neard on first use");
+        // the worker thread may block; otherwise the same steps as in
+        // gtlm_nfc_new_async() are taken
+        if (self->priv->worker_thread == TRUE) {
+            GError* error = NULL;
+            if (_connect_engine(self, NULL, &error) == FALSE)
+                _activation_failed(self, error);
             return;
-        }        
-        // start polling on an adapter
-        _setup_nfc_adapter(self, adapter);
-        g_object_unref(adapter);
-        g_variant_unref(adapter_v);
+        }
+        self->priv->activation = ACTIVATION_PENDING;
+        GTask* task = g_task_new(self, NULL, _on_activated, NULL);
+        g_task_set_task_data(task, g_slice_new0(_InitData), (GDestroyNotify)_init_data_free);
+        g_bus_get(G_BUS_TYPE_SYSTEM, NULL, _on_system_bus_ready, task);
         return;
     }
 
-    
+    gtlm_nfc_adapters_wake(self);
 }
 
+static gboolean
+_activate (gpointer user_data)
+{
+    GTlmNfc* self = GTLM_NFC(user_data);
 
-void _on_object_added(GDBusObjectManager *manager,
-                         GDBusObject        *object,
-                         gpointer            user_data)
+    gtlm_nfc_activate_engine(self);
+    g_object_unref(self);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * gtlm_nfc_activate:
+ * @tlm_nfc: an instance of GTlmNfc object
+ *
+ * Makes sure that the adapters are polling for tags. If @tlm_nfc was created
+ * with #GTlmNfc:lazy set, the first call connects to neard, registers the
+ * NDEF agent and sets up the adapters; adapters whose polling was stopped by
+ * the idle timeout of their poll policy (see gtlm_nfc_set_poll_policy()) are
+ * started again. Otherwise this only restarts the idle timeouts.
+ *
+ * This does not wait for neard; #GTlmNfc::adapters-ready is emitted once the
+ * adapters are set up. Connection errors are not reported, and the next call
+ * tries again.
+ */
+void gtlm_nfc_activate(GTlmNfc* tlm_nfc)
 {
-    //GTlmNfc* self = GTLM_NFC(user_data);
-    g_debug("Object %s added", 
-                    g_dbus_object_get_object_path (object));
-    
-    GList* interfaces = g_dbus_object_get_interfaces(object);
-    GList* interfaces_iter = interfaces;
-    while (interfaces_iter != NULL) {
-        _on_interface_added(manager, object, interfaces_iter->data, user_data);
-        g_object_unref(interfaces_iter->data);
-        interfaces_iter = interfaces_iter->next;
+    g_return_if_fail (G_IS_TLM_NFC (tlm_nfc));
+
+    GTlmNfc* engine = gtlm_nfc_get_engine(tlm_nfc);
+    gtlm_nfc_invoke_engine(engine, _activate, g_object_ref(engine), g_object_unref);
+}
+
+typedef struct {
+    GTlmNfc* self;
+    GTask* task;
+    gint timeout_msec;
+} _Shutdown;
+
+static void
+_on_shutdown_agent_unregistered (GObject      *source_object,
+                                 GAsyncResult *res,
+                                 gpointer      user_data)
+{
+    GTask* task = G_TASK(user_data);
+    GError* error = NULL;
+
+    GVariant* response = g_dbus_connection_call_finish (G_DBUS_CONNECTION(source_object),
+                                                        res,
+                                                        &error);
+    if (response == NULL) {
+        g_prefix_error (&error, "Error unregistering an agent with neard: ");
+        g_task_return_error(task, error);
+    } else {
+        g_variant_unref(response);
+        g_task_return_boolean(task, TRUE);
     }
-    g_list_free(interfaces);
-    g_debug("Finished checking interfaces");   
+    g_object_unref(task);
 }
 
-void _on_object_removed(GDBusObjectManager *manager,
-                         GDBusObject        *object,
-                         gpointer            user_data)
+static void
+_discard_shutdown (_Shutdown* shutdown)
+{
+    // disposing the engine has shut it down already
+    g_task_return_boolean(shutdown->task, TRUE);
+    g_object_unref(shutdown->task);
+    g_object_unref(shutdown->self);
+    g_slice_free(_Shutdown, shutdown);
+}
+
+static gboolean
+_shutdown (gpointer user_data)
+{
+    _Shutdown* shutdown = user_data;
+    GTlmNfc* self = shutdown->self;
+    GTask* task = shutdown->task;
+
+    self->priv->activation = ACTIVATION_SHUT_DOWN;
+    if (self->priv->agent_registered == TRUE) {
+        g_dbus_connection_call (self->priv->system_bus,
+                                "org.neard",
+                                "/org/neard",
+                                "org.neard.AgentManager",
+                                "UnregisterNDEFAgent",
+                                g_variant_new("(os)",
+                                              "/org/tlmnfc/agent",
+                                              "application/gtlm-nfc"),
+                                NULL,
+                                G_DBUS_CALL_FLAGS_NONE,
+                                shutdown->timeout_msec,
+                                g_task_get_cancellable(task),
+                                _on_shutdown_agent_unregistered,
+                                task);
+    } else {
+        // not connected, or neard has gone away and took the agent with it
+        g_task_return_boolean(task, TRUE);
+        g_object_unref(task);
+    }
+    _release_engine(self);
+
+    g_object_unref(self);
+    g_slice_free(_Shutdown, shutdown);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * gtlm_nfc_shutdown_async:
+ * @tlm_nfc: an instance of GTlmNfc object
+ * @timeout_msec: how long to wait for neard, in milliseconds, or -1 to use
+ * the default D-Bus timeout
+ * @cancellable: (allow-none): a #GCancellable or %NULL
+ * @callback: a #GAsyncReadyCallback to call when the shutdown is done
+ * @user_data: the data to pass to @callback
+ *
+ * Disconnects @tlm_nfc from neard: unregisters the NDEF agent and stops
+ * emitting signals. Afterwards @tlm_nfc no longer finds tags, and it does not
+ * connect to neard again; it only remains to be unreferenced.
+ *
+ * Disposing of a #GTlmNfc also unregisters the agent, but without waiting
+ * for neard's reply, so that a hung neard cannot hold up the caller. Use this
+ * function to know that neard has let go of the agent, for instance before
+ * another process registers its own. @callback is called once neard has
+ * replied, or at the latest when @timeout_msec has passed, in the
+ * thread-default main context of the thread this function was called from;
+ * gtlm_nfc_shutdown_finish() gives the result.
+ *
+ * If @tlm_nfc shares its connection to neard with other instances (see
+ * #GTlmNfc:shared), it stops emitting signals right away, but the connection
+ * is only shut down together with the last of them.
+ */
+void gtlm_nfc_shutdown_async(GTlmNfc* tlm_nfc,
+                             gint timeout_msec,
+                             GCancellable* cancellable,
+                             GAsyncReadyCallback callback,
+                             gpointer user_data)
+{
+    g_return_if_fail (G_IS_TLM_NFC (tlm_nfc));
+
+    GTask* task = g_task_new(tlm_nfc, cancellable, callback, user_data);
+    g_task_set_source_tag(task, gtlm_nfc_shutdown_async);
+
+    // a shared instance stops getting the engine's signals right away
+    GTlmNfc* engine = g_object_ref(gtlm_nfc_get_engine(tlm_nfc));
+    if (tlm_nfc->priv->engine != NULL) {
+        tlm_nfc->priv->activation = ACTIVATION_SHUT_DOWN;
+        if (_unsubscribe(tlm_nfc) == FALSE) {
+            g_object_unref(engine);
+            g_task_return_boolean(task, TRUE);
+            g_object_unref(task);
+            return;
+        }
+    }
+
+    _Shutdown* shutdown = g_slice_new(_Shutdown);
+    shutdown->self = engine;
+    shutdown->task = task;
+    shutdown->timeout_msec = timeout_msec;
+    gtlm_nfc_invoke_engine(shutdown->self, _shutdown, shutdown, (GDestroyNotify)_discard_shutdown);
+}
+
+/**
+ * gtlm_nfc_shutdown_finish:
+ * @tlm_nfc: an instance of GTlmNfc object
+ * @result: the #GAsyncResult passed to the callback
+ * @error: if non-NULL, set to an error, if one occurs
+ *
+ * Finishes an operation started with gtlm_nfc_shutdown_async(). @error is
+ * set to %G_IO_ERROR_TIMED_OUT if neard did not reply in time; @tlm_nfc is
+ * disconnected from neard all the same.
+ *
+ * Returns: %TRUE if neard confirmed that the agent was unregistered, or
+ * there was no agent to unregister.
+ */
+gboolean gtlm_nfc_shutdown_finish(GTlmNfc* tlm_nfc,
+                                  GAsyncResult* result,
+                                  GError** error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, tlm_nfc), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+/**
+ * gtlm_nfc_new:
+ * @cancellable: (allow-none): a #GCancellable or %NULL
+ * @error: if non-NULL, set to an error, if one occurs
+ *
+ * Creates a new #GTlmNfc object, connects it to the system bus, registers
+ * its NDEF agent with neard and starts polling on the NFC adapters. This
+ * function blocks until the agent has been registered; use
+ * gtlm_nfc_new_async() to avoid that.
+ *
+ * Returns: (transfer full): a new #GTlmNfc object, or %NULL if setting it up
+ * failed.
+ */
+GTlmNfc* gtlm_nfc_new(GCancellable* cancellable, GError** error)
+{
+    return g_initable_new(G_TYPE_TLM_NFC, cancellable, error, NULL);
+}
+
+/**
+ * gtlm_nfc_new_async:
+ * @cancellable: (allow-none): a #GCancellable or %NULL
+ * @callback: a #GAsyncReadyCallback to call when the object is ready
+ * @user_data: the data to pass to @callback
+ *
+ * Asynchronously creates a new #GTlmNfc object. The system bus connection,
+ * the NDEF agent registration and the neard object manager are all set up
+ * without blocking the caller's main context. Use gtlm_nfc_new_finish() in
+ * @callback to get the result.
+ */
+void gtlm_nfc_new_async(GCancellable* cancellable,
+                        GAsyncReadyCallback callback,
+                        gpointer user_data)
+{
+    g_async_initable_new_async(G_TYPE_TLM_NFC, G_PRIORITY_DEFAULT, cancellable,
+                               callback, user_data, NULL);
+}
+
+/**
+ * gtlm_nfc_new_finish:
+ * @res: the #GAsyncResult passed to the callback
+ * @error: if non-NULL, set to an error, if one occurs
+ *
+ * Finishes an operation started with gtlm_nfc_new_async().
+ *
+ * Returns: (transfer full): a new #GTlmNfc object, or %NULL if setting it up
+ * failed.
+ */
+GTlmNfc* gtlm_nfc_new_finish(GAsyncResult* res, GError** error)
+{
+    GObject* source_object = g_async_result_get_source_object(res);
+    GObject* object = g_async_initable_new_finish(G_ASYNC_INITABLE(source_object), res, error);
+    g_object_unref(source_object);
+
+    return object != NULL ? GTLM_NFC(object) : NULL;
+}
+
+/**
+ * GTlmNfcPollMode:
+ * @GTLM_NFC_POLL_MODE_INITIATOR: the adapter polls for tags and devices
+ * @GTLM_NFC_POLL_MODE_TARGET: the adapter waits to be polled by a device
+ * @GTLM_NFC_POLL_MODE_DUAL: the adapter alternates between both
+ *
+ * The modes an adapter can poll in, see gtlm_nfc_set_poll_policy().
+ */
+
+/**
+ * GTlmNfcEventType:
+ * @GTLM_NFC_EVENT_TAG_FOUND: see #GTlmNfc::tag-found
+ * @GTLM_NFC_EVENT_TAG_LOST: see #GTlmNfc::tag-lost
+ * @GTLM_NFC_EVENT_RECORD_FOUND: see #GTlmNfc::record-found
+ * @GTLM_NFC_EVENT_NO_RECORD_FOUND: see #GTlmNfc::no-record-found
+ * @GTLM_NFC_EVENT_ADAPTER_REARMED: see #GTlmNfc::adapter-rearmed
+ * @GTLM_NFC_EVENT_ADAPTERS_READY: see #GTlmNfc::adapters-ready
+ * @GTLM_NFC_EVENT_TAG_READY: see #GTlmNfc::tag-ready
+ *
+ * The kind of a #GTlmNfcEvent; there is one for each signal of #GTlmNfc.
+ */
+
+/**
+ * GTLM_NFC_EVENT_PATH_SIZE:
+ *
+ * The size of the @path buffer of #GTlmNfcEvent.
+ */
+
+/**
+ * GTLM_NFC_EVENT_FIELD_SIZE:
+ *
+ * The size of the @username and @password buffers of #GTlmNfcEvent.
+ */
+
+/**
+ * GTlmNfcEventFlags:
+ * @GTLM_NFC_EVENT_PATH_TRUNCATED: @path was cut short to fit its buffer
+ * @GTLM_NFC_EVENT_USERNAME_TRUNCATED: @username was cut short to fit its
+ * buffer
+ * @GTLM_NFC_EVENT_PASSWORD_TRUNCATED: @password was cut short to fit its
+ * buffer
+ *
+ * Flags of a #GTlmNfcEvent. A record with a truncated username or password
+ * cannot be used to log in; get it from #GTlmNfc::record-found instead.
+ */
+
+/**
+ * GTlmNfcEvent:
+ * @type: what happened
+ * @flags: which strings were truncated
+ * @dropped: how many events were dropped since the previous one was taken,
+ * because the consumer fell behind and the buffer was full
+ * @time: when the event happened, in g_get_monotonic_time() microseconds
+ * @dead_time: the dead time of an adapter re-arm, in microseconds
+ * @path: the tag or adapter path, or an empty string
+ * @username: the username from a record, or an empty string
+ * @password: the password from a record, or an empty string
+ *
+ * One event as returned by gtlm_nfc_next_event(). Only the fields that go
+ * with the signal for @type are set; strings that do not fit are truncated,
+ * and @flags says which. As @password is a copy of a secret in memory that
+ * the caller owns, every event must be wiped with gtlm_nfc_event_clear()
+ * once it has been handled.
+ */
+
+/**
+ * gtlm_nfc_get_event_fd:
+ * @tlm_nfc: an instance of GTlmNfc object
+ *
+ * Gives access to the events of @tlm_nfc without a GLib main loop. From the
+ * first call on, every signal is also stored in a fixed-size buffer, and the
+ * returned file descriptor becomes readable while that buffer holds events.
+ * Poll it (for instance with epoll) alongside your other descriptors and
+ * fetch the events with gtlm_nfc_next_event(); do not read from it directly.
+ *
+ * The events are produced by the thread that talks to neard, so unless
+ * #GTlmNfc:worker-thread is set, the main context that @tlm_nfc was created
+ * in still has to be iterated.
+ *
+ * The first call also calls gtlm_nfc_activate(). The descriptor stays owned
+ * by @tlm_nfc and is closed when it is finalized.
+ *
+ * Returns: a file descriptor, or -1 if one could not be created
+ */
+gint gtlm_nfc_get_event_fd(GTlmNfc* tlm_nfc)
 {
-    //GTlmNfc* self = GTLM_NFC(user_data);
-    g_debug("Object %s removed", 
-                    g_dbus_object_get_object_path (object));
-
-    GList* interfaces = g_dbus_object_get_interfaces(object);
-    GList* interfaces_iter = interfaces;
-    while (interfaces_iter != NULL) {
-        _on_interface_removed(manager, object, interfaces_iter->data, user_data);
-        g_object_unref(interfaces_iter->data);
-        interfaces_iter = interfaces_iter->next;
+    g_return_val_if_fail (G_IS_TLM_NFC (tlm_nfc), -1);
+
+    GTlmNfcEventRing* ring = g_atomic_pointer_get(&tlm_nfc->priv->event_ring);
+    if (ring == NULL) {
+        ring = gtlm_nfc_event_ring_new();
+        if (ring == NULL)
+            return -1;
+        if (!g_atomic_pointer_compare_and_exchange(&tlm_nfc->priv->event_ring, NULL, ring)) {
+            gtlm_nfc_event_ring_free(ring);
+            ring = g_atomic_pointer_get(&tlm_nfc->priv->event_ring);
+        }
+        gtlm_nfc_activate(tlm_nfc);
     }
-    g_list_free(interfaces);
-    g_debug("Finished checking interfaces");       
+    return gtlm_nfc_event_ring_get_fd(ring);
 }
 
-void _on_property_changed (GDBusObjectManagerClient *manager,
-                                                        GDBusObjectProxy         *object_proxy,
-                                                        GDBusProxy               *interface_proxy,
-                                                        GVariant                 *changed_properties,
-                                                        GStrv                     invalidated_properties,
-                                                        gpointer                  user_data)
+/**
+ * gtlm_nfc_next_event:
+ * @tlm_nfc: an instance of GTlmNfc object
+ * @event: (out caller-allocates): the event
+ *
+ * Takes the oldest event out of the buffer set up by
+ * gtlm_nfc_get_event_fd(). This never blocks or allocates memory. Events
+ * should be fetched until this returns %FALSE before polling again; only one
+ * thread may fetch events at a time.
+ *
+ * The buffer's copy of a password is wiped as the event is returned; the
+ * caller must wipe @event with gtlm_nfc_event_clear() once done with it.
+ *
+ * Returns: %TRUE if @event was filled in, %FALSE if there are no events
+ */
+gboolean gtlm_nfc_next_event(GTlmNfc* tlm_nfc, GTlmNfcEvent* event)
 {
-    gchar *parameters_str;
+    g_return_val_if_fail (G_IS_TLM_NFC (tlm_nfc), FALSE);
+    g_return_val_if_fail (event != NULL, FALSE);
 
-    parameters_str = g_variant_print (changed_properties, TRUE);
-    g_debug("Property of object %s changed:\n%s",
-            g_dbus_object_get_object_path(G_DBUS_OBJECT(object_proxy)), parameters_str);
-    g_debug("Invalidated properties:");
-    while (*invalidated_properties != NULL) {
-        g_print(*invalidated_properties);
-        invalidated_properties++;
-    }
-    g_free(parameters_str);
+    GTlmNfcEventRing* ring = g_atomic_pointer_get(&tlm_nfc->priv->event_ring);
+    if (ring == NULL)
+        return FALSE;
+    return gtlm_nfc_event_ring_pop(ring, event);
 }
 
-static void _setup_agent_and_adapters(GTlmNfc* self)
+/**
+ * gtlm_nfc_event_clear:
+ * @event: an event filled in by gtlm_nfc_next_event()
+ *
+ * Overwrites all of @event with zeroes, so that the password it may hold
+ * does not linger in memory. Call this for every event once it has been
+ * handled, also when @event is about to go out of scope.
+ */
+void gtlm_nfc_event_clear(GTlmNfcEvent* event)
 {
-    GError *error = NULL;
+    g_return_if_fail (event != NULL);
 
-    /* Introspection data for the agent object we are exporting */
-    const gchar introspection_xml[] =
-        "<node>"
-        "  <interface name='org.neard.NDEFAgent'>"
-        "    <method name='GetNDEF'>"
-        "      <arg type='a{sv}' name='values' direction='in'/>"
-        "    </method>"
-        "    <method name='Release'>"
-        "    </method>"
-        "  </interface>"
-        "</node>";
-    
-    const GDBusInterfaceVTable interface_vtable =
-    {
-        _handle_agent_method_call,
-        _handle_agent_get_property,
-        _handle_agent_set_property
-    };
+    /* going through a volatile pointer keeps the compiler from dropping the
+     * stores to memory that is not read again */
+    volatile guchar* p = (volatile guchar*)event;
+    for (gsize i = 0; i < sizeof(*event); i++)
+        p[i] = 0;
+}
 
-    self->system_bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
-    
-    if (self->system_bus == NULL) {
-        g_debug ("Error getting a system bus: %s", error->message);
-        g_error_free (error);
-        return;
-    }        
-    
-    GDBusNodeInfo *introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
-      
-    self->agent_registration_id = g_dbus_connection_register_object (self->system_bus,
-                                                       "/org/tlmnfc/agent",
-                                                       introspection_data->interfaces[0],
-                                                       &interface_vtable,
-                                                       self,
-                                                       NULL,
-                                                       &error);
+/**
+ * gtlm_nfc_stats_copy:
+ * @stats: a #GTlmNfcStats
+ *
+ * Returns: (transfer full): a newly allocated copy of @stats, to be freed with
+ * gtlm_nfc_stats_free().
+ */
+GTlmNfcStats* gtlm_nfc_stats_copy(const GTlmNfcStats* stats)
+{
+    return g_slice_dup(GTlmNfcStats, stats);
+}
 
-    if (self->agent_registration_id <= 0) {
-        g_debug ("Error registering an agent object: %s", error->message);
-        g_dbus_node_info_unref (introspection_data);
-        g_error_free (error);
-        return;
-    }
-    g_dbus_node_info_unref (introspection_data);
-    
-    GVariant* agent_register_response = g_dbus_connection_call_sync (self->system_bus,
-                                         "org.neard",
-                                         "/org/neard",
-                                         "org.neard.AgentManager",
-                                        "RegisterNDEFAgent",
-                                        g_variant_new("(os)", 
-                                                      "/org/tlmnfc/agent", 
-                                                      "application/gtlm-nfc"),
-                                        NULL,              
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        -1,
-                                        NULL,
-                                        &error);
-    if (agent_register_response == NULL) {
-        g_debug ("Error registering an agent with neard: %s", error->message);
-        g_error_free (error);
-        return;
-    }
-    g_variant_unref(agent_register_response);
+/**
+ * gtlm_nfc_stats_free:
+ * @stats: a #GTlmNfcStats returned by gtlm_nfc_stats_copy()
+ *
+ * Frees @stats.
+ */
+void gtlm_nfc_stats_free(GTlmNfcStats* stats)
+{
+    g_slice_free(GTlmNfcStats, stats);
+}
 
-    
-    self->neard_manager =  g_dbus_object_manager_client_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-                                         G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_NONE,
-                                         "org.neard",
-                                         "/",
-                                         NULL, NULL, NULL, NULL,
-                                         &error);
-    if (self->neard_manager == NULL)
-    {
-        g_debug ("Error creating neard object manager: %s", error->message);
-        g_error_free (error);
-        return ;
-    }
-    
-    // subscribe to interface added/removed signals
-    g_signal_connect (G_DBUS_OBJECT_MANAGER(self->neard_manager),
-                    "interface-added",
-                    G_CALLBACK (_on_interface_added),
-                    self);
-    g_signal_connect (G_DBUS_OBJECT_MANAGER(self->neard_manager),
-                    "interface-removed",
-                    G_CALLBACK (_on_interface_removed),
-                    self);
-    g_signal_connect (G_DBUS_OBJECT_MANAGER(self->neard_manager),
-                    "object-added",
-                    G_CALLBACK (_on_object_added),
-                    self);
-    g_signal_connect (G_DBUS_OBJECT_MANAGER(self->neard_manager),
-                    "object-removed",
-                    G_CALLBACK (_on_object_removed),
-                    self);
-    
-    
-    g_signal_connect (G_DBUS_OBJECT_MANAGER(self->neard_manager),
-                    "interface-proxy-properties-changed",
-                    G_CALLBACK (_on_property_changed),
-                    self);
-    
+/**
+ * gtlm_nfc_get_stats:
+ * @tlm_nfc: an instance of GTlmNfc object
+ * @stats: (out caller-allocates): filled in with the statistics
+ *
+ * Reports how long tags spend in each #GTlmNfcStage on their way from neard
+ * to the #GTlmNfc::record-found handlers. The statistics are recorded into
+ * fixed histograms as tags are read, without allocating memory, and this
+ * function only copies them.
+ */
+void gtlm_nfc_get_stats(GTlmNfc* tlm_nfc, GTlmNfcStats* stats)
+{
+    g_return_if_fail (G_IS_TLM_NFC (tlm_nfc));
+    g_return_if_fail (stats != NULL);
 
-    
-    _setup_nfc_adapters(self);    
-    return;
+    GTlmNfc* engine = gtlm_nfc_get_engine(tlm_nfc);
+    g_mutex_lock(&engine->priv->stats_lock);
+    *stats = engine->priv->stats;
+    g_mutex_unlock(&engine->priv->stats_lock);
 }
 
+static gint64
+_get_average_latency (const GTlmNfcStats* stats)
+{
+    const GTlmNfcHistogram* total = &stats->stages[GTLM_NFC_STAGE_TOTAL];
+    return total->count > 0 ? total->total_usec / (gint64)total->count : 0;
+}
 
 static void
 gtlm_nfc_init (GTlmNfc *self)
 {
-    
-    _setup_agent_and_adapters(self);
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, G_TYPE_TLM_NFC, GTlmNfcPrivate);
+    gtlm_nfc_adapters_init(self);
+    self->priv->tags = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                       g_free, (GDestroyNotify)_tag_state_free);
+    g_mutex_init(&self->priv->subscribers_lock);
+    g_mutex_init(&self->priv->stats_lock);
 }
 
 static void
@@ -706,8 +3046,34 @@ gtlm_nfc_set_property (GObject      *object,
                                        const GValue *value,
                                        GParamSpec   *pspec)
 {
+    GTlmNfc *tlm_nfc = GTLM_NFC (object);
+
     switch (property_id)
     {
+        case PROP_DEFERRED_DISPATCH:
+            g_atomic_int_set (&tlm_nfc->priv->deferred_dispatch, g_value_get_boolean (value));
+            break;
+        case PROP_WORKER_THREAD:
+            tlm_nfc->priv->worker_thread = g_value_get_boolean (value);
+            break;
+        case PROP_LAZY:
+            tlm_nfc->priv->lazy = g_value_get_boolean (value);
+            break;
+        case PROP_IDLE_TIMEOUT:
+            tlm_nfc->priv->idle_timeout = g_value_get_uint (value);
+            break;
+        case PROP_TAG_SETTLE_TIME:
+            tlm_nfc->priv->tag_settle_time = g_value_get_uint (value);
+            break;
+        case PROP_VERIFY_WRITES:
+            g_atomic_int_set (&tlm_nfc->priv->verify_writes, g_value_get_boolean (value));
+            break;
+        case PROP_DIRECT_RECORDS:
+            tlm_nfc->priv->direct_records = g_value_get_boolean (value);
+            break;
+        case PROP_SHARED:
+            tlm_nfc->priv->shared = g_value_get_boolean (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -721,62 +3087,214 @@ gtlm_nfc_get_property (GObject    *object,
                                        GParamSpec *pspec)
 {
     GTlmNfc *tlm_nfc = GTLM_NFC (object);
-    (void) tlm_nfc;
+    GTlmNfcStats stats;
+
     switch (prop_id)
     {
-            
+        case PROP_DEFERRED_DISPATCH:
+            g_value_set_boolean (value, g_atomic_int_get (&tlm_nfc->priv->deferred_dispatch));
+            break;
+        case PROP_WORKER_THREAD:
+            g_value_set_boolean (value, tlm_nfc->priv->worker_thread);
+            break;
+        case PROP_LAZY:
+            g_value_set_boolean (value, tlm_nfc->priv->lazy);
+            break;
+        case PROP_IDLE_TIMEOUT:
+            g_value_set_uint (value, tlm_nfc->priv->idle_timeout);
+            break;
+        case PROP_TAG_SETTLE_TIME:
+            g_value_set_uint (value, tlm_nfc->priv->tag_settle_time);
+            break;
+        case PROP_VERIFY_WRITES:
+            g_value_set_boolean (value, g_atomic_int_get (&tlm_nfc->priv->verify_writes));
+            break;
+        case PROP_DIRECT_RECORDS:
+            g_value_set_boolean (value, tlm_nfc->priv->direct_records);
+            break;
+        case PROP_SHARED:
+            g_value_set_boolean (value, tlm_nfc->priv->shared);
+            break;
+        case PROP_STATS:
+            gtlm_nfc_get_stats (tlm_nfc, &stats);
+            g_value_set_boxed (value, &stats);
+            break;
+        case PROP_AVERAGE_LATENCY:
+            gtlm_nfc_get_stats (tlm_nfc, &stats);
+            g_value_set_int64 (value, _get_average_latency (&stats));
+            break;
+        case PROP_MAX_LATENCY:
+            gtlm_nfc_get_stats (tlm_nfc, &stats);
+            g_value_set_int64 (value,
+                stats.stages[GTLM_NFC_STAGE_TOTAL].max_usec);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
             break;
     }
 }
 
-static void gtlm_nfc_dispose(GObject *object)
+/* Drops everything that ties @self to neard, without talking to neard */
+static void
+_release_engine (GTlmNfc* self)
+{
+    if (self->priv->neard_watch_id > 0) {
+        g_dbus_connection_signal_unsubscribe(self->priv->system_bus, self->priv->neard_watch_id);
+        self->priv->neard_watch_id = 0;
+    }
+    if (self->priv->agent_registration_id > 0) {
+        if (g_dbus_connection_unregister_object(self->priv->system_bus, self->priv->agent_registration_id) == FALSE)
+            g_debug("Error unregistering agent object");
+        self->priv->agent_registration_id = 0;
+    }
+
+    g_mutex_lock(&self->priv->stats_lock);
+    g_hash_table_remove_all(self->priv->adapters);
+    g_mutex_unlock(&self->priv->stats_lock);
+    g_hash_table_remove_all(self->priv->tags);
+    if (self->priv->neard_manager) {
+        g_signal_handlers_disconnect_by_data(self->priv->neard_manager, self);
+        g_object_unref(self->priv->neard_manager);
+        self->priv->neard_manager = NULL;
+    }
+    if (self->priv->system_bus) {
+        g_object_unref(self->priv->system_bus);
+        self->priv->system_bus = NULL;
+    }
+    self->priv->agent_registered = FALSE;
+    self->priv->recovery_start = 0;
+
+    if (self->priv->enrollment != NULL)
+        gtlm_nfc_enrollment_finish(self->priv->enrollment,
+                                   g_error_new(G_IO_ERROR, G_IO_ERROR_CLOSED,
+                                               "GTlmNfc was disconnected from neard"));
+}
+
+/* neard may be hung, so the agent is unregistered without waiting for the
+ * reply. The flush keeps the connection alive until the call has been sent,
+ * in case this drops the last reference to it.
+ */
+static gboolean
+_teardown_engine (gpointer user_data)
+{
+    GTlmNfc* self = GTLM_NFC (user_data);
+
+    if (self->priv->system_bus) {
+        g_dbus_connection_call (self->priv->system_bus,
+                                "org.neard",
+                                "/org/neard",
+                                "org.neard.AgentManager",
+                                "UnregisterNDEFAgent",
+                                g_variant_new("(os)",
+                                              "/org/tlmnfc/agent",
+                                              "application/gtlm-nfc"),
+                                NULL,
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                NULL,
+                                NULL,
+                                NULL);
+        g_dbus_connection_flush (self->priv->system_bus, NULL, NULL, NULL);
+    }
+    _release_engine(self);
+    if (self->priv->activation != ACTIVATION_SHUT_DOWN)
+        self->priv->activation = ACTIVATION_NONE;
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_on_default_init_done (GObject      *source_object,
+                       GAsyncResult *res,
+                       gpointer      user_data)
+{
+    GError* error = NULL;
+
+    if (g_async_initable_init_finish(G_ASYNC_INITABLE(source_object), res, &error) == FALSE) {
+        g_debug("Error setting up GTlmNfc: %s", error->message);
+        g_error_free(error);
+    }
+}
+
+static gboolean
+_init_by_default (gpointer user_data)
+{
+    g_async_initable_init_async(G_ASYNC_INITABLE(user_data), G_PRIORITY_DEFAULT, NULL,
+                                _on_default_init_done, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+/* An instance created with g_object_new() alone, without going through
+ * GInitable or GAsyncInitable, sets itself up asynchronously once the main
+ * context it was created in runs; errors are only logged then.
+ */
+static gboolean
+_start_commands_on_worker (gpointer user_data)
+{
+    _start_commands(GTLM_NFC(user_data));
+    return G_SOURCE_REMOVE;
+}
+
+static void gtlm_nfc_constructed(GObject *object)
 {
     GTlmNfc* self = GTLM_NFC (object);
 
-    if (self->system_bus) {
-        GError* error = NULL;
-        GVariant* agent_register_response = g_dbus_connection_call_sync (self->system_bus,
-                                         "org.neard",
-                                         "/org/neard",
-                                         "org.neard.AgentManager",
-                                        "UnregisterNDEFAgent",
-                                        g_variant_new("(os)",
-                                                      "/org/tlmnfc/agent",
-                                                      "application/gtlm-nfc"),
-                                        NULL,
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        -1,
-                                        NULL,
-                                        &error);
-        if (agent_register_response == NULL) {
-            g_debug ("Error unregistering an agent with neard: %s", error->message);
-            g_error_free (error);
-        }
-        g_variant_unref(agent_register_response);
+    // the engine's thread is settled before any call can be made on @self;
+    // a shared instance only uses its own until it has joined the engine
+    if (self->priv->worker_thread == TRUE && self->priv->shared == FALSE) {
+        _start_worker(self);
+        gtlm_nfc_worker_invoke_sync(self->priv->worker, _start_commands_on_worker, self);
+    } else {
+        _start_commands(self);
     }
-    if (self->agent_registration_id > 0)
-        if (g_dbus_connection_unregister_object(self->system_bus, self->agent_registration_id) == FALSE)
-            g_debug("Error unregistering agent object");
 
+    self->priv->default_init = g_idle_source_new();
+    g_source_set_callback(self->priv->default_init, _init_by_default, self, NULL);
+    g_source_attach(self->priv->default_init, g_main_context_get_thread_default());
+
+    G_OBJECT_CLASS (gtlm_nfc_parent_class)->constructed (object);
+}
+
+static void gtlm_nfc_dispose(GObject *object)
+{
+    GTlmNfc* self = GTLM_NFC (object);
+
+    if (self->priv->engine != NULL)
+        _unsubscribe(self);
 
-    if (self->neard_manager) {
-        g_object_unref(self->neard_manager);
-        self->neard_manager = NULL;
+    _drop_default_init(self);
+
+    if (self->priv->worker != NULL) {
+        gtlm_nfc_worker_invoke_sync(self->priv->worker, _teardown_engine, self);
+        gtlm_nfc_worker_free(self->priv->worker);
+        self->priv->worker = NULL;
+    } else {
+        _teardown_engine(self);
     }
-    if (self->system_bus) {
-        g_object_unref(self->system_bus);
-        self->system_bus = NULL;
+    if (self->priv->commands != NULL) {
+        gtlm_nfc_mailbox_free(self->priv->commands);
+        self->priv->commands = NULL;
     }
-    
+    if (self->priv->events != NULL) {
+        gtlm_nfc_mailbox_free(self->priv->events);
+        self->priv->events = NULL;
+    }
+
     G_OBJECT_CLASS (gtlm_nfc_parent_class)->dispose (object);
 }
 
 static void gtlm_nfc_finalize(GObject *object)
 {
-    //GTlmNfc* self = GTLM_NFC (object);
-    
+    GTlmNfc* self = GTLM_NFC (object);
+
+    g_hash_table_unref(self->priv->adapters);
+    g_hash_table_unref(self->priv->tags);
+    g_hash_table_unref(self->priv->poll_policies);
+    g_mutex_clear(&self->priv->subscribers_lock);
+    g_mutex_clear(&self->priv->stats_lock);
+    if (self->priv->event_ring != NULL)
+        gtlm_nfc_event_ring_free(self->priv->event_ring);
+    if (self->priv->init_error != NULL)
+        g_error_free(self->priv->init_error);
 
     G_OBJECT_CLASS (gtlm_nfc_parent_class)->finalize (object);
 }
@@ -785,11 +3303,208 @@ static void
 gtlm_nfc_class_init (GTlmNfcClass *klass)
 {
     GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
-    
+
+    g_type_class_add_private (klass, sizeof (GTlmNfcPrivate));
     gobject_class->set_property = gtlm_nfc_set_property;
     gobject_class->get_property = gtlm_nfc_get_property;
     gobject_class->dispose = gtlm_nfc_dispose;
+    gobject_class->constructed = gtlm_nfc_constructed;
     gobject_class->finalize = gtlm_nfc_finalize;
+
+    /**
+     * GTlmNfc:deferred-dispatch:
+     *
+     * If %TRUE, records read from a tag are decoded and reported through
+     * #GTlmNfc::record-found and #GTlmNfc::no-record-found from an idle
+     * source, after the reply to neard has been sent, instead of from within
+     * neard's agent call. This keeps slow signal handlers from delaying
+     * neard's processing of the next tag. A #GTlmNfc:shared instance
+     * queues these signals to its main context instead, without affecting
+     * the other instances.
+     */
+    properties[PROP_DEFERRED_DISPATCH] =
+        g_param_spec_boolean ("deferred-dispatch",
+                              "Deferred dispatch",
+                              "Report records from an idle source",
+                              FALSE,
+                              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+    /**
+     * GTlmNfc:worker-thread:
+     *
+     * If %TRUE, #GTlmNfc talks to neard from a thread of its own, with its
+     * own main context, instead of from the thread-default main context it
+     * was created in. Its signals are still emitted in the main context it was
+     * created in; they are passed there through a lock-free queue, so slow
+     * signal handlers and neard traffic do not hold each other up. Set this
+     * when creating the object, e.g. with g_initable_new().
+     */
+    properties[PROP_WORKER_THREAD] =
+        g_param_spec_boolean ("worker-thread",
+                              "Worker thread",
+                              "Talk to neard from a thread of its own",
+                              FALSE,
+                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                              G_PARAM_STATIC_STRINGS);
+
+    /**
+     * GTlmNfc:lazy:
+     *
+     * If %TRUE, creating #GTlmNfc does not touch the system bus. Connecting
+     * to neard, registering the NDEF agent and powering up the adapters are
+     * postponed until the first call to gtlm_nfc_activate(),
+     * gtlm_nfc_get_event_fd() or gtlm_nfc_write_username_password_async(),
+     * so that processes which may never need NFC do not pay for it at
+     * startup. Connect the signal handlers, then call gtlm_nfc_activate().
+     */
+    properties[PROP_LAZY] =
+        g_param_spec_boolean ("lazy",
+                              "Lazy",
+                              "Connect to neard on first use",
+                              FALSE,
+                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                              G_PARAM_STATIC_STRINGS);
+
+    /**
+     * GTlmNfc:idle-timeout:
+     *
+     * The number of seconds without NFC activity after which polling is
+     * stopped on an adapter, or 0 to keep polling. This is the idle timeout
+     * of adapters that have no poll policy of their own; see
+     * gtlm_nfc_set_poll_policy().
+     */
+    properties[PROP_IDLE_TIMEOUT] =
+        g_param_spec_uint ("idle-timeout",
+                           "Idle timeout",
+                           "Seconds without activity before polling stops",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                           G_PARAM_STATIC_STRINGS);
+
+    /**
+     * GTlmNfc:tag-settle-time:
+     *
+     * neard publishes the records of a tag once it has read them, and a
+     * tag is reported by #GTlmNfc::tag-ready as soon as that happens. A
+     * blank tag has no records to publish, so it is taken to be ready when
+     * this many milliseconds have passed since it was found without any
+     * records showing up. 0 makes tags ready as soon as they are found.
+     */
+    properties[PROP_TAG_SETTLE_TIME] =
+        g_param_spec_uint ("tag-settle-time",
+                           "Tag settle time",
+                           "Milliseconds until a tag without records is ready",
+                           0, G_MAXUINT, 500,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                           G_PARAM_STATIC_STRINGS);
+
+    /**
+     * GTlmNfc:verify-writes:
+     *
+     * If %TRUE, a write is only reported as done once neard has read the
+     * tag again, which it does right after writing to it, and the record
+     * it found holds what was written. The tag has to stay in place for
+     * that, but it does not have to be tapped again. Applies to the writes
+     * and enrollments started while it is set, except for blocking writes
+     * from the thread that talks to neard (see
+     * gtlm_nfc_write_username_password()).
+     */
+    properties[PROP_VERIFY_WRITES] =
+        g_param_spec_boolean ("verify-writes",
+                              "Verify writes",
+                              "Read tags back after writing to them",
+                              FALSE,
+                              G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+    /**
+     * GTlmNfc:direct-records:
+     *
+     * If %TRUE, a record is reported as soon as neard publishes it as an
+     * org.neard.Record object, if the object carries the record's payload,
+     * instead of when neard calls the NDEF agent with it, which takes
+     * another round trip. The agent call for a record that has been
+     * reported this way is not reported again, and neither is a record
+     * object whose agent call came first. Records without a payload are
+     * reported through the agent as before.
+     */
+    properties[PROP_DIRECT_RECORDS] =
+        g_param_spec_boolean ("direct-records",
+                              "Direct records",
+                              "Report records from neard's record objects",
+                              FALSE,
+                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                              G_PARAM_STATIC_STRINGS);
+
+    /**
+     * GTlmNfc:shared:
+     *
+     * If %TRUE, this instance shares one bus connection, NDEF agent and neard
+     * object manager with all other instances in the process that have this
+     * set, and gets its signals from them. The first such instance decides
+     * #GTlmNfc:worker-thread, #GTlmNfc:lazy, #GTlmNfc:idle-timeout and
+     * #GTlmNfc:direct-records for all of them; gtlm_nfc_set_poll_policy()
+     * and the statistics apply to all of them too. #GTlmNfc:deferred-dispatch
+     * is kept per instance.
+     *
+     * Signals are emitted in the main context each instance was created in.
+     * An instance created after the adapters have been set up gets its own
+     * #GTlmNfc::adapters-ready. A shared instance created while another one
+     * is still being set up waits for it, also if that is done
+     * asynchronously.
+     *
+     * If %FALSE, the instance talks to neard by itself. As neard takes one
+     * NDEF agent per record type, only one such instance (or group of shared
+     * ones) can exist at a time.
+     */
+    properties[PROP_SHARED] =
+        g_param_spec_boolean ("shared",
+                              "Shared",
+                              "Share the connection to neard within the process",
+                              FALSE,
+                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                              G_PARAM_STATIC_STRINGS);
+
+    /**
+     * GTlmNfc:stats:
+     *
+     * A copy of the latency statistics, as returned by gtlm_nfc_get_stats().
+     * Like the other statistics properties, this is not notified when it
+     * changes.
+     */
+    properties[PROP_STATS] =
+        g_param_spec_boxed ("stats",
+                            "Statistics",
+                            "Latency statistics of the tag to credential pipeline",
+                            G_TYPE_TLM_NFC_STATS,
+                            G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+    /**
+     * GTlmNfc:average-latency:
+     *
+     * The average time in microseconds from neard announcing a tag to the
+     * #GTlmNfc::record-found handlers returning.
+     */
+    properties[PROP_AVERAGE_LATENCY] =
+        g_param_spec_int64 ("average-latency",
+                            "Average latency",
+                            "Average time from tag to credentials",
+                            0, G_MAXINT64, 0,
+                            G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+    /**
+     * GTlmNfc:max-latency:
+     *
+     * The longest time in microseconds from neard announcing a tag to the
+     * #GTlmNfc::record-found handlers returning.
+     */
+    properties[PROP_MAX_LATENCY] =
+        g_param_spec_int64 ("max-latency",
+                            "Maximum latency",
+                            "Longest time from tag to credentials",
+                            0, G_MAXINT64, 0,
+                            G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+    g_object_class_install_properties (gobject_class, N_PROPERTIES, properties);
     
     
     /**
@@ -801,9 +3516,11 @@ gtlm_nfc_class_init (GTlmNfcClass *klass)
      */
     signals[SIG_TAG_FOUND] = g_signal_new ("tag-found", 
         G_TYPE_TLM_NFC,
-        G_SIGNAL_RUN_FIRST, 0, NULL, NULL, NULL, G_TYPE_NONE,
+        G_SIGNAL_RUN_FIRST, 0, NULL, NULL, g_cclosure_marshal_VOID__STRING, G_TYPE_NONE,
         1, G_TYPE_STRING);
         //2, G_TYPE_STRING, G_TYPE_STRING);    
+    g_signal_set_va_marshaller (signals[SIG_TAG_FOUND], G_TYPE_TLM_NFC,
+                                g_cclosure_marshal_VOID__STRINGv);
 
     /**
      * GTlmNfc::tag-lost:
@@ -814,8 +3531,10 @@ gtlm_nfc_class_init (GTlmNfcClass *klass)
      */
     signals[SIG_TAG_LOST] = g_signal_new ("tag-lost", 
         G_TYPE_TLM_NFC,
-        G_SIGNAL_RUN_FIRST, 0, NULL, NULL, NULL, G_TYPE_NONE,
+        G_SIGNAL_RUN_FIRST, 0, NULL, NULL, g_cclosure_marshal_VOID__STRING, G_TYPE_NONE,
         1, G_TYPE_STRING);
+    g_signal_set_va_marshaller (signals[SIG_TAG_LOST], G_TYPE_TLM_NFC,
+                                g_cclosure_marshal_VOID__STRINGv);
 
     /**
      * GTlmNfc::record-found:
@@ -824,12 +3543,18 @@ gtlm_nfc_class_init (GTlmNfcClass *klass)
      * @password: the password on the tag
      * 
      * This signal is issued by #GTlmNfc object when a username and password pair
-     * has been found on a tag.
+     * has been found on a tag. @username and @password are only valid for the
+     * duration of the signal emission; handlers that need them later must
+     * copy them.
      */
     signals[SIG_RECORD_FOUND] = g_signal_new ("record-found", 
         G_TYPE_TLM_NFC,
-        G_SIGNAL_RUN_FIRST, 0, NULL, NULL, NULL, G_TYPE_NONE,
-        2, G_TYPE_STRING, G_TYPE_STRING);    
+        G_SIGNAL_RUN_FIRST, 0, NULL, NULL, gtlm_nfc_marshal_VOID__STRING_STRING, G_TYPE_NONE,
+        2,
+        G_TYPE_STRING | G_SIGNAL_TYPE_STATIC_SCOPE,
+        G_TYPE_STRING | G_SIGNAL_TYPE_STATIC_SCOPE);
+    g_signal_set_va_marshaller (signals[SIG_RECORD_FOUND], G_TYPE_TLM_NFC,
+                                gtlm_nfc_marshal_VOID__STRING_STRINGv);    
 
     /**
      * GTlmNfc::no-record-found:
@@ -840,7 +3565,61 @@ gtlm_nfc_class_init (GTlmNfcClass *klass)
      */
     signals[SIG_NO_RECORD_FOUND] = g_signal_new ("no-record-found", 
         G_TYPE_TLM_NFC,
-        G_SIGNAL_RUN_FIRST, 0, NULL, NULL, NULL, G_TYPE_NONE,
-        0);     
-    
+        G_SIGNAL_RUN_FIRST, 0, NULL, NULL, g_cclosure_marshal_VOID__VOID, G_TYPE_NONE,
+        0);
+    g_signal_set_va_marshaller (signals[SIG_NO_RECORD_FOUND], G_TYPE_TLM_NFC,
+                                g_cclosure_marshal_VOID__VOIDv);     
+
+    /**
+     * GTlmNfc::adapter-rearmed:
+     * @tlm_nfc: the object which emitted the signal
+     * @adapter_path: an identifier of the adapter
+     * @dead_time: time in microseconds between the tag going away and the
+     * adapter polling again
+     *
+     * This signal is issued by #GTlmNfc object when an adapter is ready to
+     * detect the next tag after the previous one has been removed.
+     */
+    signals[SIG_ADAPTER_REARMED] = g_signal_new ("adapter-rearmed",
+        G_TYPE_TLM_NFC,
+        G_SIGNAL_RUN_FIRST, 0, NULL, NULL, gtlm_nfc_marshal_VOID__STRING_INT64, G_TYPE_NONE,
+        2, G_TYPE_STRING, G_TYPE_INT64);
+    g_signal_set_va_marshaller (signals[SIG_ADAPTER_REARMED], G_TYPE_TLM_NFC,
+                                gtlm_nfc_marshal_VOID__STRING_INT64v);
+
+    /**
+     * GTlmNfc::adapters-ready:
+     * @tlm_nfc: the object which emitted the signal
+     *
+     * This signal is issued by #GTlmNfc object once all adapters present at
+     * startup have been switched on and are polling for tags. The adapters
+     * are set up concurrently. The signal is issued again after adapters
+     * that are plugged in later have been set up, and after polling has
+     * been restarted by gtlm_nfc_activate(). An adapter that neard fails to
+     * set up does not hold the signal back.
+     */
+    signals[SIG_ADAPTERS_READY] = g_signal_new ("adapters-ready",
+        G_TYPE_TLM_NFC,
+        G_SIGNAL_RUN_FIRST, 0, NULL, NULL, g_cclosure_marshal_VOID__VOID, G_TYPE_NONE,
+        0);
+    g_signal_set_va_marshaller (signals[SIG_ADAPTERS_READY], G_TYPE_TLM_NFC,
+                                g_cclosure_marshal_VOID__VOIDv);
+
+    /**
+     * GTlmNfc::tag-ready:
+     * @tlm_nfc: the object which emitted the signal
+     * @nfc_tag_path: an identifier of the tag (use in gtlm_nfc_write_username_password())
+     *
+     * This signal is issued by #GTlmNfc object after #GTlmNfc::tag-found,
+     * once neard has finished reading the tag and it can be written to; see
+     * #GTlmNfc:tag-settle-time. Writes to the tag that are issued before
+     * then are held back until this signal, so there is no need to wait for
+     * it before writing.
+     */
+    signals[SIG_TAG_READY] = g_signal_new ("tag-ready",
+        G_TYPE_TLM_NFC,
+        G_SIGNAL_RUN_FIRST, 0, NULL, NULL, g_cclosure_marshal_VOID__STRING, G_TYPE_NONE,
+        1, G_TYPE_STRING);
+    g_signal_set_va_marshaller (signals[SIG_TAG_READY], G_TYPE_TLM_NFC,
+                                g_cclosure_marshal_VOID__STRINGv);
 }
@@ -32,10 +32,16 @@
 typedef enum {
     GTLM_NFC_ERROR_NONE,
 
-    GTLM_NFC_ERROR_NO_TAG = 1
+    GTLM_NFC_ERROR_NO_TAG = 1,
+    GTLM_NFC_ERROR_CREDENTIALS_TOO_LONG = 2,
+    GTLM_NFC_ERROR_TAG_READ_ONLY = 3,
+    GTLM_NFC_ERROR_TAG_TOO_SMALL = 4,
+    GTLM_NFC_ERROR_VERIFY_FAILED = 5
    
 } GTlmNfcError;
 
+#define GTLM_NFC_ERROR   (gtlm_nfc_error_quark())
+
 #define G_TYPE_TLM_NFC             (gtlm_nfc_get_type ())
 #define GTLM_NFC(obj)             (G_TYPE_CHECK_INSTANCE_CAST ((obj), G_TYPE_TLM_NFC, GTlmNfc))
 #define G_IS_TLM_NFC(obj)          (G_TYPE_CHECK_INSTANCE_TYPE ((obj), G_TYPE_TLM_NFC))
@@ -46,14 +52,87 @@ typedef enum {
 
 typedef struct _GTlmNfc        GTlmNfc;
 typedef struct _GTlmNfcClass   GTlmNfcClass;
+typedef struct _GTlmNfcPrivate GTlmNfcPrivate;
+
+#define GTLM_NFC_HISTOGRAM_BUCKETS 24
+
+typedef struct {
+    guint64 count;
+    gint64 min_usec;
+    gint64 max_usec;
+    gint64 total_usec;
+    guint64 buckets[GTLM_NFC_HISTOGRAM_BUCKETS];
+} GTlmNfcHistogram;
+
+typedef enum {
+    GTLM_NFC_STAGE_TAG_TO_AGENT,
+    GTLM_NFC_STAGE_DECODE,
+    GTLM_NFC_STAGE_DISPATCH,
+    GTLM_NFC_STAGE_HANDLERS,
+    GTLM_NFC_STAGE_TOTAL,
+
+    GTLM_NFC_N_STAGES
+} GTlmNfcStage;
+
+typedef struct {
+    GTlmNfcHistogram stages[GTLM_NFC_N_STAGES];
+    GTlmNfcHistogram recovery;
+} GTlmNfcStats;
+
+#define G_TYPE_TLM_NFC_STATS       (gtlm_nfc_stats_get_type ())
+
+typedef enum {
+    GTLM_NFC_POLL_MODE_INITIATOR,
+    GTLM_NFC_POLL_MODE_TARGET,
+    GTLM_NFC_POLL_MODE_DUAL
+} GTlmNfcPollMode;
+
+typedef enum {
+    GTLM_NFC_EVENT_TAG_FOUND,
+    GTLM_NFC_EVENT_TAG_LOST,
+    GTLM_NFC_EVENT_RECORD_FOUND,
+    GTLM_NFC_EVENT_NO_RECORD_FOUND,
+    GTLM_NFC_EVENT_ADAPTER_REARMED,
+    GTLM_NFC_EVENT_ADAPTERS_READY,
+    GTLM_NFC_EVENT_TAG_READY
+} GTlmNfcEventType;
+
+#define GTLM_NFC_EVENT_PATH_SIZE 128
+#define GTLM_NFC_EVENT_FIELD_SIZE 256
+
+typedef enum {
+    GTLM_NFC_EVENT_PATH_TRUNCATED = 1 << 0,
+    GTLM_NFC_EVENT_USERNAME_TRUNCATED = 1 << 1,
+    GTLM_NFC_EVENT_PASSWORD_TRUNCATED = 1 << 2
+} GTlmNfcEventFlags;
+
+typedef struct {
+    GTlmNfcEventType type;
+    GTlmNfcEventFlags flags;
+    guint dropped;
+    gint64 time;
+    gint64 dead_time;
+    gchar path[GTLM_NFC_EVENT_PATH_SIZE];
+    gchar username[GTLM_NFC_EVENT_FIELD_SIZE];
+    gchar password[GTLM_NFC_EVENT_FIELD_SIZE];
+} GTlmNfcEvent;
+
+typedef struct {
+    const gchar* tag_path;
+    const gchar* username;
+    const GError* error;
+    guint written;
+    guint failed;
+    guint remaining;
+    gint64 elapsed_usec;
+    gdouble tags_per_minute;
+} GTlmNfcEnrollProgress;
 
 struct _GTlmNfc
 {
     GObject parent_instance;
-    
-    GDBusObjectManager* neard_manager; 
-    GDBusConnection* system_bus;
-    guint agent_registration_id;
+
+    GTlmNfcPrivate* priv;
 };
 
 struct _GTlmNfcClass
@@ -61,12 +140,98 @@ struct _GTlmNfcClass
     GObjectClass parent_class;
 };
 
+typedef void (*GTlmNfcEnrollProgressCallback) (GTlmNfc* tlm_nfc,
+                                               const GTlmNfcEnrollProgress* progress,
+                                               gpointer user_data);
+
 GType gtlm_nfc_get_type (void);
 
+GQuark gtlm_nfc_error_quark (void);
+
+GTlmNfc* gtlm_nfc_new(GCancellable* cancellable, GError** error);
+
+void gtlm_nfc_new_async(GCancellable* cancellable,
+                        GAsyncReadyCallback callback,
+                        gpointer user_data);
+
+GTlmNfc* gtlm_nfc_new_finish(GAsyncResult* res, GError** error);
+
+GType gtlm_nfc_stats_get_type (void);
+
+GTlmNfcStats* gtlm_nfc_stats_copy(const GTlmNfcStats* stats);
+
+void gtlm_nfc_stats_free(GTlmNfcStats* stats);
+
+void gtlm_nfc_get_stats(GTlmNfc* tlm_nfc, GTlmNfcStats* stats);
+
+void gtlm_nfc_activate(GTlmNfc* tlm_nfc);
+
+void gtlm_nfc_shutdown_async(GTlmNfc* tlm_nfc,
+                             gint timeout_msec,
+                             GCancellable* cancellable,
+                             GAsyncReadyCallback callback,
+                             gpointer user_data);
+
+gboolean gtlm_nfc_shutdown_finish(GTlmNfc* tlm_nfc,
+                                  GAsyncResult* result,
+                                  GError** error);
+
+void gtlm_nfc_set_poll_policy(GTlmNfc* tlm_nfc,
+                              const gchar* adapter_path,
+                              GTlmNfcPollMode mode,
+                              guint idle_timeout);
+
+gboolean gtlm_nfc_get_polling_time(GTlmNfc* tlm_nfc,
+                                   const gchar* adapter_path,
+                                   gint64* polling_usec,
+                                   gint64* total_usec);
+
+gint gtlm_nfc_get_event_fd(GTlmNfc* tlm_nfc);
+
+gboolean gtlm_nfc_next_event(GTlmNfc* tlm_nfc, GTlmNfcEvent* event);
+void gtlm_nfc_event_clear(GTlmNfcEvent* event);
+
+gboolean gtlm_nfc_get_rearm_time(GTlmNfc* tlm_nfc,
+                                 const gchar* adapter_path,
+                                 gint64* last_usec,
+                                 gint64* max_usec,
+                                 gint64* average_usec,
+                                 guint* count);
+
+gsize gtlm_nfc_get_encoded_size(const gchar* username,
+                                const gchar* password);
+
 void gtlm_nfc_write_username_password(GTlmNfc* tlm_nfc, 
                                       const gchar* nfc_tag_path,
                                       const gchar* username, 
                                       const gchar* password,
                                       GError** error);
 
+void gtlm_nfc_write_username_password_async(GTlmNfc* tlm_nfc,
+                                            const gchar* nfc_tag_path,
+                                            const gchar* username,
+                                            const gchar* password,
+                                            gint timeout_msec,
+                                            GCancellable* cancellable,
+                                            GAsyncReadyCallback callback,
+                                            gpointer user_data);
+
+gboolean gtlm_nfc_write_username_password_finish(GTlmNfc* tlm_nfc,
+                                                 GAsyncResult* result,
+                                                 GError** error);
+
+void gtlm_nfc_enroll_async(GTlmNfc* tlm_nfc,
+                           const gchar* const* usernames,
+                           const gchar* const* passwords,
+                           gint timeout_msec,
+                           GCancellable* cancellable,
+                           GTlmNfcEnrollProgressCallback progress_callback,
+                           gpointer progress_user_data,
+                           GAsyncReadyCallback callback,
+                           gpointer user_data);
+
+gboolean gtlm_nfc_enroll_finish(GTlmNfc* tlm_nfc,
+                                GAsyncResult* result,
+                                GError** error);
+
 #endif /* __GTLM_NFC_H__ */
\ No newline at end of file
@@ -0,0 +1,1240 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <string.h>
+#include "mock-neard.h"
+
+#define MOCK_NEARD_MIME_TYPE "application/gtlm-nfc"
+
+static const gchar mock_neard_introspection_xml[] =
+    "<node>"
+    "  <interface name='org.freedesktop.DBus.ObjectManager'>"
+    "    <method name='GetManagedObjects'>"
+    "      <arg type='a{oa{sa{sv}}}' name='objects' direction='out'/>"
+    "    </method>"
+    "    <signal name='InterfacesAdded'>"
+    "      <arg type='o' name='object'/>"
+    "      <arg type='a{sa{sv}}' name='interfaces'/>"
+    "    </signal>"
+    "    <signal name='InterfacesRemoved'>"
+    "      <arg type='o' name='object'/>"
+    "      <arg type='as' name='interfaces'/>"
+    "    </signal>"
+    "  </interface>"
+    "  <interface name='org.neard.AgentManager'>"
+    "    <method name='RegisterNDEFAgent'>"
+    "      <arg type='o' name='path' direction='in'/>"
+    "      <arg type='s' name='type' direction='in'/>"
+    "    </method>"
+    "    <method name='UnregisterNDEFAgent'>"
+    "      <arg type='o' name='path' direction='in'/>"
+    "      <arg type='s' name='type' direction='in'/>"
+    "    </method>"
+    "  </interface>"
+    "  <interface name='org.neard.Adapter'>"
+    "    <method name='StartPollLoop'>"
+    "      <arg type='s' name='mode' direction='in'/>"
+    "    </method>"
+    "    <method name='StopPollLoop'/>"
+    "    <property name='Mode' type='s' access='read'/>"
+    "    <property name='Powered' type='b' access='readwrite'/>"
+    "    <property name='Polling' type='b' access='read'/>"
+    "    <property name='Protocols' type='as' access='read'/>"
+    "  </interface>"
+    "  <interface name='org.neard.Tag'>"
+    "    <method name='Write'>"
+    "      <arg type='a{sv}' name='attributes' direction='in'/>"
+    "    </method>"
+    "    <property name='Type' type='s' access='read'/>"
+    "    <property name='Protocol' type='s' access='read'/>"
+    "    <property name='ReadOnly' type='b' access='read'/>"
+    "    <property name='Adapter' type='o' access='read'/>"
+    "  </interface>"
+    "  <interface name='org.neard.Record'>"
+    "    <property name='Type' type='s' access='read'/>"
+    "    <property name='MIME' type='s' access='read'/>"
+    "    <property name='Payload' type='ay' access='read'/>"
+    "  </interface>"
+    "  <interface name='org.neard.Device'>"
+    "    <method name='Push'>"
+    "      <arg type='a{sv}' name='attributes' direction='in'/>"
+    "    </method>"
+    "    <property name='Adapter' type='o' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+/* An object exported by the mock: its interfaces with their properties,
+ * and the payload of its record if it is a tag.
+ */
+typedef struct {
+    gchar* path;
+    GHashTable* interfaces;     /* name -> GHashTable of name -> GVariant */
+    GArray* registration_ids;
+    GBytes* payload;
+    gboolean reading;
+} _MockObject;
+
+struct _MockNeard {
+    gchar* bus_address;
+    GThread* thread;
+    GMainContext* context;
+    GMainLoop* loop;
+    GDBusConnection* connection;
+    GDBusNodeInfo* introspection_data;
+    GHashTable* objects;        /* path -> _MockObject */
+    guint manager_registration_id;
+    guint agent_manager_registration_id;
+    gchar* agent_owner;
+    gchar* agent_path;
+    guint tag_count;
+    guint device_count;
+    guint adapter_count;
+    guint start_poll_loop_count;
+    guint agent_registration_count;
+    gboolean unresponsive;
+    GQueue stalled_calls;       /* of GDBusMethodInvocation */
+    guint read_delay;
+    gchar* tag_type;
+    gboolean tag_read_only;
+    guint write_count;
+    gboolean read_after_write;
+    gboolean torn_writes;
+    gboolean record_payloads;
+    gboolean call_agent;
+    gboolean agent_record_path;
+
+    GMutex lock;
+    GCond cond;
+    gboolean ready;
+    /* poll loops of the main adapter, kept under the lock so that they can
+     * be waited for from other threads */
+    gboolean polling;
+    guint poll_loops_started;
+    gchar* poll_mode;
+};
+
+static void _mock_object_free(_MockObject* object)
+{
+    g_free(object->path);
+    g_hash_table_unref(object->interfaces);
+    g_array_unref(object->registration_ids);
+    if (object->payload != NULL)
+        g_bytes_unref(object->payload);
+    g_slice_free(_MockObject, object);
+}
+
+static GVariant* _mock_object_get_interfaces(_MockObject* object)
+{
+    GVariantBuilder builder;
+    GHashTableIter iter;
+    gpointer interface_name, properties;
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sa{sv}}"));
+    g_hash_table_iter_init(&iter, object->interfaces);
+    while (g_hash_table_iter_next(&iter, &interface_name, &properties)) {
+        GHashTableIter prop_iter;
+        gpointer name, value;
+
+        g_variant_builder_open(&builder, G_VARIANT_TYPE("{sa{sv}}"));
+        g_variant_builder_add(&builder, "s", interface_name);
+        g_variant_builder_open(&builder, G_VARIANT_TYPE_VARDICT);
+        g_hash_table_iter_init(&prop_iter, properties);
+        while (g_hash_table_iter_next(&prop_iter, &name, &value))
+            g_variant_builder_add(&builder, "{sv}", name, value);
+        g_variant_builder_close(&builder);
+        g_variant_builder_close(&builder);
+    }
+    return g_variant_builder_end(&builder);
+}
+
+static void _emit_properties_changed(MockNeard* mock,
+                                     _MockObject* object,
+                                     const gchar* interface_name,
+                                     const gchar* name,
+                                     GVariant* value)
+{
+    GVariantBuilder builder;
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&builder, "{sv}", name, value);
+    g_dbus_connection_emit_signal(mock->connection, NULL, object->path,
+                                  "org.freedesktop.DBus.Properties",
+                                  "PropertiesChanged",
+                                  g_variant_new("(sa{sv}as)", interface_name, &builder, NULL),
+                                  NULL);
+}
+
+static GVariant* _mock_object_get_property(_MockObject* object,
+                                           const gchar* interface_name,
+                                           const gchar* name)
+{
+    GHashTable* properties = g_hash_table_lookup(object->interfaces, interface_name);
+    if (properties == NULL)
+        return NULL;
+    return g_hash_table_lookup(properties, name);
+}
+
+/* Keeps track of the poll loops of the main adapter */
+static void _record_polling(MockNeard* mock, _MockObject* adapter, gboolean polling)
+{
+    GVariant* mode = _mock_object_get_property(adapter, "org.neard.Adapter", "Mode");
+
+    g_mutex_lock(&mock->lock);
+    if (polling == TRUE && mock->polling == FALSE) {
+        mock->poll_loops_started++;
+        g_free(mock->poll_mode);
+        mock->poll_mode = g_variant_dup_string(mode, NULL);
+    }
+    mock->polling = polling;
+    g_cond_broadcast(&mock->cond);
+    g_mutex_unlock(&mock->lock);
+}
+
+static void _mock_object_set_property(MockNeard* mock,
+                                      _MockObject* object,
+                                      const gchar* interface_name,
+                                      const gchar* name,
+                                      GVariant* value)
+{
+    GHashTable* properties = g_hash_table_lookup(object->interfaces, interface_name);
+    GVariant* old_value = g_hash_table_lookup(properties, name);
+
+    g_variant_ref_sink(value);
+    if (old_value != NULL && g_variant_equal(old_value, value)) {
+        g_variant_unref(value);
+        return;
+    }
+    g_hash_table_insert(properties, g_strdup(name), value);
+    if (g_strcmp0(object->path, MOCK_NEARD_ADAPTER_PATH) == 0 &&
+        g_strcmp0(name, "Polling") == 0)
+        _record_polling(mock, object, g_variant_get_boolean(value));
+    _emit_properties_changed(mock, object, interface_name, name, value);
+}
+
+static GHashTable* _mock_object_add_interface(_MockObject* object,
+                                              const gchar* interface_name)
+{
+    GHashTable* properties = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                   g_free, (GDestroyNotify)g_variant_unref);
+    g_hash_table_insert(object->interfaces, g_strdup(interface_name), properties);
+    return properties;
+}
+
+static void _add_property(GHashTable* properties, const gchar* name, GVariant* value)
+{
+    g_hash_table_insert(properties, g_strdup(name), g_variant_ref_sink(value));
+}
+
+static _MockObject* _mock_object_new(const gchar* path)
+{
+    _MockObject* object = g_slice_new0(_MockObject);
+    object->path = g_strdup(path);
+    object->interfaces = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                               g_free, (GDestroyNotify)g_hash_table_unref);
+    object->registration_ids = g_array_new(FALSE, FALSE, sizeof(guint));
+    return object;
+}
+
+static void _on_get_ndef_reply(GObject* source_object,
+                               GAsyncResult* res,
+                               gpointer user_data)
+{
+    GError* error = NULL;
+    GVariant* result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object),
+                                                     res, &error);
+    if (result == NULL) {
+        g_debug("mock-neard: GetNDEF failed: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+    g_variant_unref(result);
+}
+
+static void _call_agent(MockNeard* mock, const gchar* record_path, GBytes* payload)
+{
+    GVariantBuilder builder;
+    GVariant* payload_v;
+
+    if (mock->agent_owner == NULL || mock->call_agent == FALSE)
+        return;
+
+    payload_v = g_variant_new_from_bytes(G_VARIANT_TYPE_BYTESTRING, payload, TRUE);
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+    if (mock->agent_record_path == TRUE)
+        g_variant_builder_add(&builder, "{sv}", "Record", g_variant_new_object_path(record_path));
+    g_variant_builder_add(&builder, "{sv}", "Payload", payload_v);
+    g_variant_builder_add(&builder, "{sv}", "NDEF", payload_v);
+
+    g_dbus_connection_call(mock->connection, mock->agent_owner, mock->agent_path,
+                           "org.neard.NDEFAgent", "GetNDEF",
+                           g_variant_new("(a{sv})", &builder),
+                           NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                           _on_get_ndef_reply, NULL);
+}
+
+static void _handle_method_call(GDBusConnection* connection,
+                                const gchar* sender,
+                                const gchar* object_path,
+                                const gchar* interface_name,
+                                const gchar* method_name,
+                                GVariant* parameters,
+                                GDBusMethodInvocation* invocation,
+                                gpointer user_data);
+
+static GVariant* _handle_get_property(GDBusConnection* connection,
+                                      const gchar* sender,
+                                      const gchar* object_path,
+                                      const gchar* interface_name,
+                                      const gchar* property_name,
+                                      GError** error,
+                                      gpointer user_data)
+{
+    MockNeard* mock = user_data;
+    _MockObject* object = g_hash_table_lookup(mock->objects, object_path);
+    GVariant* value = NULL;
+
+    if (object != NULL)
+        value = _mock_object_get_property(object, interface_name, property_name);
+    if (value == NULL) {
+        g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                    "No property %s", property_name);
+        return NULL;
+    }
+    return g_variant_ref(value);
+}
+
+static gboolean _handle_set_property(GDBusConnection* connection,
+                                     const gchar* sender,
+                                     const gchar* object_path,
+                                     const gchar* interface_name,
+                                     const gchar* property_name,
+                                     GVariant* value,
+                                     GError** error,
+                                     gpointer user_data)
+{
+    MockNeard* mock = user_data;
+    _MockObject* object = g_hash_table_lookup(mock->objects, object_path);
+
+    if (object == NULL || g_strcmp0(property_name, "Powered") != 0) {
+        g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_PROPERTY_READ_ONLY,
+                    "Property %s is read-only", property_name);
+        return FALSE;
+    }
+    _mock_object_set_property(mock, object, interface_name, property_name, value);
+    if (g_variant_get_boolean(value) == FALSE)
+        _mock_object_set_property(mock, object, interface_name, "Polling",
+                                  g_variant_new_boolean(FALSE));
+    return TRUE;
+}
+
+static const GDBusInterfaceVTable mock_neard_vtable =
+{
+    _handle_method_call,
+    _handle_get_property,
+    _handle_set_property
+};
+
+static void _export_object(MockNeard* mock, _MockObject* object)
+{
+    GHashTableIter iter;
+    gpointer interface_name;
+
+    g_hash_table_insert(mock->objects, object->path, object);
+    g_hash_table_iter_init(&iter, object->interfaces);
+    while (g_hash_table_iter_next(&iter, &interface_name, NULL)) {
+        GDBusInterfaceInfo* info = g_dbus_node_info_lookup_interface(
+            mock->introspection_data, interface_name);
+        guint id = g_dbus_connection_register_object(mock->connection,
+                                                     object->path,
+                                                     info,
+                                                     &mock_neard_vtable,
+                                                     mock, NULL, NULL);
+        g_array_append_val(object->registration_ids, id);
+    }
+
+    g_dbus_connection_emit_signal(mock->connection, NULL, "/",
+                                  "org.freedesktop.DBus.ObjectManager",
+                                  "InterfacesAdded",
+                                  g_variant_new("(o@a{sa{sv}})", object->path,
+                                                _mock_object_get_interfaces(object)),
+                                  NULL);
+}
+
+static void _unexport_object(MockNeard* mock, _MockObject* object)
+{
+    GVariantBuilder builder;
+    GHashTableIter iter;
+    gpointer interface_name;
+    guint i;
+
+    for (i = 0; i < object->registration_ids->len; i++)
+        g_dbus_connection_unregister_object(mock->connection,
+            g_array_index(object->registration_ids, guint, i));
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_STRING_ARRAY);
+    g_hash_table_iter_init(&iter, object->interfaces);
+    while (g_hash_table_iter_next(&iter, &interface_name, NULL))
+        g_variant_builder_add(&builder, "s", interface_name);
+    g_dbus_connection_emit_signal(mock->connection, NULL, "/",
+                                  "org.freedesktop.DBus.ObjectManager",
+                                  "InterfacesRemoved",
+                                  g_variant_new("(oas)", object->path, &builder),
+                                  NULL);
+
+    g_hash_table_remove(mock->objects, object->path);
+}
+
+static void _export_record(MockNeard* mock, _MockObject* tag, GBytes* payload)
+{
+    gchar* record_path = g_strdup_printf("%s/record0", tag->path);
+    _MockObject* record = g_hash_table_lookup(mock->objects, record_path);
+
+    if (record != NULL)
+        _unexport_object(mock, record);
+
+    record = _mock_object_new(record_path);
+    GHashTable* properties = _mock_object_add_interface(record, "org.neard.Record");
+    _add_property(properties, "Type", g_variant_new_string("MIME"));
+    _add_property(properties, "MIME", g_variant_new_string(MOCK_NEARD_MIME_TYPE));
+    if (mock->record_payloads == TRUE)
+        _add_property(properties, "Payload",
+                      g_variant_new_from_bytes(G_VARIANT_TYPE_BYTESTRING, payload, TRUE));
+    _export_object(mock, record);
+
+    if (tag->payload != NULL)
+        g_bytes_unref(tag->payload);
+    tag->payload = g_bytes_ref(payload);
+    g_free(record_path);
+}
+
+static void _handle_write(MockNeard* mock,
+                          _MockObject* tag,
+                          GVariant* parameters,
+                          GDBusMethodInvocation* invocation)
+{
+    GVariant* read_only = _mock_object_get_property(tag, "org.neard.Tag", "ReadOnly");
+
+    mock->write_count++;
+    if (g_variant_get_boolean(read_only) == TRUE) {
+        g_dbus_method_invocation_return_dbus_error(invocation,
+                                                   "org.neard.Error.PermissionDenied",
+                                                   "Permission denied");
+        return;
+    }
+
+    // like neard, refuse to write while the tag is being read (NFC-57)
+    if (tag->reading == TRUE) {
+        g_dbus_method_invocation_return_dbus_error(invocation,
+                                                   "org.neard.Error.InProgress",
+                                                   "Operation already in progress");
+        return;
+    }
+
+    GVariant* attributes = g_variant_get_child_value(parameters, 0);
+    GVariant* payload_v = g_variant_lookup_value(attributes, "Payload",
+                                                 G_VARIANT_TYPE_BYTESTRING);
+
+    if (payload_v == NULL) {
+        g_dbus_method_invocation_return_dbus_error(invocation,
+                                                   "org.neard.Error.InvalidArguments",
+                                                   "Invalid arguments");
+    } else {
+        GBytes* payload = g_variant_get_data_as_bytes(payload_v);
+        if (mock->torn_writes == TRUE) {
+            GBytes* torn = g_bytes_new_from_bytes(payload, 0, g_bytes_get_size(payload) / 2);
+            g_bytes_unref(payload);
+            payload = torn;
+        }
+        _export_record(mock, tag, payload);
+        g_variant_unref(payload_v);
+        g_dbus_method_invocation_return_value(invocation, NULL);
+
+        // like neard, read the tag again once the write is done
+        if (mock->read_after_write == TRUE) {
+            gchar* record_path = g_strdup_printf("%s/record0", tag->path);
+            _call_agent(mock, record_path, payload);
+            g_free(record_path);
+        }
+        g_bytes_unref(payload);
+    }
+    g_variant_unref(attributes);
+}
+
+static void _handle_method_call(GDBusConnection* connection,
+                                const gchar* sender,
+                                const gchar* object_path,
+                                const gchar* interface_name,
+                                const gchar* method_name,
+                                GVariant* parameters,
+                                GDBusMethodInvocation* invocation,
+                                gpointer user_data)
+{
+    MockNeard* mock = user_data;
+    _MockObject* object = g_hash_table_lookup(mock->objects, object_path);
+
+    if (mock->unresponsive == TRUE) {
+        g_queue_push_tail(&mock->stalled_calls, invocation);
+        return;
+    }
+    // a stalled call can be for an object that has gone away since
+    if (object == NULL && (g_strcmp0(interface_name, "org.neard.Adapter") == 0 ||
+                           g_strcmp0(interface_name, "org.neard.Tag") == 0)) {
+        g_dbus_method_invocation_return_dbus_error(invocation,
+                                                   "org.neard.Error.DoesNotExist",
+                                                   "Does Not Exist");
+        return;
+    }
+
+    if (g_strcmp0(method_name, "GetManagedObjects") == 0) {
+        GVariantBuilder builder;
+        GHashTableIter iter;
+        gpointer value;
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{oa{sa{sv}}}"));
+        g_hash_table_iter_init(&iter, mock->objects);
+        while (g_hash_table_iter_next(&iter, NULL, &value))
+            g_variant_builder_add(&builder, "{o@a{sa{sv}}}",
+                                  ((_MockObject*)value)->path,
+                                  _mock_object_get_interfaces(value));
+        g_dbus_method_invocation_return_value(invocation,
+                                              g_variant_new("(a{oa{sa{sv}}})", &builder));
+    } else if (g_strcmp0(method_name, "RegisterNDEFAgent") == 0) {
+        const gchar* path;
+        const gchar* type;
+
+        g_variant_get(parameters, "(&o&s)", &path, &type);
+        mock->agent_registration_count++;
+        if (mock->agent_owner != NULL || g_strcmp0(type, MOCK_NEARD_MIME_TYPE) != 0) {
+            g_dbus_method_invocation_return_dbus_error(invocation,
+                                                       "org.neard.Error.AlreadyExists",
+                                                       "Already Exists");
+            return;
+        }
+        mock->agent_owner = g_strdup(sender);
+        mock->agent_path = g_strdup(path);
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    } else if (g_strcmp0(method_name, "UnregisterNDEFAgent") == 0) {
+        if (g_strcmp0(mock->agent_owner, sender) != 0) {
+            g_dbus_method_invocation_return_dbus_error(invocation,
+                                                       "org.neard.Error.DoesNotExist",
+                                                       "Does Not Exist");
+            return;
+        }
+        g_clear_pointer(&mock->agent_owner, g_free);
+        g_clear_pointer(&mock->agent_path, g_free);
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    } else if (g_strcmp0(method_name, "StartPollLoop") == 0) {
+        const gchar* mode;
+        GVariant* powered = _mock_object_get_property(object, interface_name, "Powered");
+        GVariant* polling = _mock_object_get_property(object, interface_name, "Polling");
+
+        mock->start_poll_loop_count++;
+        if (g_variant_get_boolean(powered) == FALSE) {
+            g_dbus_method_invocation_return_dbus_error(invocation,
+                                                       "org.neard.Error.Failed",
+                                                       "Adapter is not powered");
+            return;
+        }
+        if (g_variant_get_boolean(polling) == TRUE) {
+            g_dbus_method_invocation_return_dbus_error(invocation,
+                                                       "org.neard.Error.AlreadyEnabled",
+                                                       "Already enabled");
+            return;
+        }
+        g_variant_get(parameters, "(&s)", &mode);
+        _mock_object_set_property(mock, object, interface_name, "Mode",
+                                  g_variant_new_string(mode));
+        _mock_object_set_property(mock, object, interface_name, "Polling",
+                                  g_variant_new_boolean(TRUE));
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    } else if (g_strcmp0(method_name, "StopPollLoop") == 0) {
+        GVariant* polling = _mock_object_get_property(object, interface_name, "Polling");
+
+        if (g_variant_get_boolean(polling) == FALSE) {
+            g_dbus_method_invocation_return_dbus_error(invocation,
+                                                       "org.neard.Error.NotPolling",
+                                                       "Not polling");
+            return;
+        }
+        _mock_object_set_property(mock, object, interface_name, "Polling",
+                                  g_variant_new_boolean(FALSE));
+        _mock_object_set_property(mock, object, interface_name, "Mode",
+                                  g_variant_new_string("Idle"));
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    } else if (g_strcmp0(method_name, "Write") == 0) {
+        _handle_write(mock, object, parameters, invocation);
+    } else {
+        g_dbus_method_invocation_return_dbus_error(invocation,
+                                                   "org.neard.Error.NotSupported",
+                                                   "Not supported");
+    }
+}
+
+static void _export_adapter(MockNeard* mock, const gchar* path)
+{
+    _MockObject* adapter = _mock_object_new(path);
+    GHashTable* properties = _mock_object_add_interface(adapter, "org.neard.Adapter");
+    const gchar* protocols[] = { "MIFARE", "ISO-DEP", NULL };
+
+    _add_property(properties, "Mode", g_variant_new_string("Idle"));
+    _add_property(properties, "Powered", g_variant_new_boolean(FALSE));
+    _add_property(properties, "Polling", g_variant_new_boolean(FALSE));
+    _add_property(properties, "Protocols", g_variant_new_strv(protocols, -1));
+    if (g_strcmp0(path, MOCK_NEARD_ADAPTER_PATH) == 0)
+        _record_polling(mock, adapter, FALSE);
+    _export_object(mock, adapter);
+}
+
+static gboolean _mock_ready(gpointer user_data)
+{
+    MockNeard* mock = user_data;
+
+    g_mutex_lock(&mock->lock);
+    mock->ready = TRUE;
+    g_cond_broadcast(&mock->cond);
+    g_mutex_unlock(&mock->lock);
+    return G_SOURCE_REMOVE;
+}
+
+/* Connects to the bus, exports the objects of a freshly started neard and
+ * takes the org.neard name.
+ */
+static void _mock_connect(MockNeard* mock)
+{
+    GError* error = NULL;
+    GVariant* result;
+
+    mock->connection = g_dbus_connection_new_for_address_sync(mock->bus_address,
+        G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+        G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+        NULL, NULL, &error);
+    g_assert_no_error(error);
+
+    mock->manager_registration_id = g_dbus_connection_register_object(mock->connection,
+        "/",
+        g_dbus_node_info_lookup_interface(mock->introspection_data,
+                                          "org.freedesktop.DBus.ObjectManager"),
+        &mock_neard_vtable, mock, NULL, &error);
+    g_assert_no_error(error);
+    mock->agent_manager_registration_id = g_dbus_connection_register_object(mock->connection,
+        "/org/neard",
+        g_dbus_node_info_lookup_interface(mock->introspection_data,
+                                          "org.neard.AgentManager"),
+        &mock_neard_vtable, mock, NULL, &error);
+    g_assert_no_error(error);
+    _export_adapter(mock, MOCK_NEARD_ADAPTER_PATH);
+    mock->adapter_count = 1;
+
+    result = g_dbus_connection_call_sync(mock->connection,
+                                         "org.freedesktop.DBus",
+                                         "/org/freedesktop/DBus",
+                                         "org.freedesktop.DBus",
+                                         "RequestName",
+                                         g_variant_new("(su)", "org.neard", 0),
+                                         G_VARIANT_TYPE("(u)"),
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         -1, NULL, &error);
+    g_assert_no_error(error);
+    g_variant_unref(result);
+}
+
+/* Drops everything without announcing it, the way a crashing neard does */
+static void _mock_disconnect(MockNeard* mock)
+{
+    GHashTableIter iter;
+    gpointer value;
+    GDBusMethodInvocation* invocation;
+
+    while ((invocation = g_queue_pop_head(&mock->stalled_calls)) != NULL)
+        g_dbus_method_invocation_return_dbus_error(invocation,
+                                                   "org.neard.Error.Failed",
+                                                   "neard has gone away");
+
+    g_hash_table_iter_init(&iter, mock->objects);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        _MockObject* object = value;
+        guint i;
+        for (i = 0; i < object->registration_ids->len; i++)
+            g_dbus_connection_unregister_object(mock->connection,
+                g_array_index(object->registration_ids, guint, i));
+    }
+    g_hash_table_remove_all(mock->objects);
+    g_dbus_connection_unregister_object(mock->connection, mock->manager_registration_id);
+    g_dbus_connection_unregister_object(mock->connection, mock->agent_manager_registration_id);
+    g_dbus_connection_close_sync(mock->connection, NULL, NULL);
+    g_clear_object(&mock->connection);
+
+    g_clear_pointer(&mock->agent_owner, g_free);
+    g_clear_pointer(&mock->agent_path, g_free);
+}
+
+static gpointer _mock_thread(gpointer user_data)
+{
+    MockNeard* mock = user_data;
+
+    g_main_context_push_thread_default(mock->context);
+    _mock_connect(mock);
+
+    // report readiness from within the loop, so that a quit cannot be lost
+    GSource* source = g_idle_source_new();
+    g_source_set_callback(source, _mock_ready, mock, NULL);
+    g_source_attach(source, mock->context);
+    g_source_unref(source);
+
+    g_main_loop_run(mock->loop);
+
+    _mock_disconnect(mock);
+    g_main_context_pop_thread_default(mock->context);
+    return NULL;
+}
+
+MockNeard* mock_neard_new(const gchar* bus_address)
+{
+    MockNeard* mock = g_new0(MockNeard, 1);
+    GError* error = NULL;
+
+    mock->bus_address = g_strdup(bus_address);
+    mock->context = g_main_context_new();
+    mock->loop = g_main_loop_new(mock->context, FALSE);
+    mock->introspection_data = g_dbus_node_info_new_for_xml(mock_neard_introspection_xml,
+                                                            &error);
+    g_assert_no_error(error);
+    mock->objects = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                          NULL, (GDestroyNotify)_mock_object_free);
+    g_queue_init(&mock->stalled_calls);
+    mock->call_agent = TRUE;
+    mock->agent_record_path = TRUE;
+    mock->tag_type = g_strdup("Type 2");
+    g_mutex_init(&mock->lock);
+    g_cond_init(&mock->cond);
+
+    mock->thread = g_thread_new("mock-neard", _mock_thread, mock);
+    g_mutex_lock(&mock->lock);
+    while (mock->ready == FALSE)
+        g_cond_wait(&mock->cond, &mock->lock);
+    g_mutex_unlock(&mock->lock);
+    return mock;
+}
+
+void mock_neard_free(MockNeard* mock)
+{
+    g_main_loop_quit(mock->loop);
+    g_thread_join(mock->thread);
+
+    g_hash_table_unref(mock->objects);
+    g_dbus_node_info_unref(mock->introspection_data);
+    g_main_loop_unref(mock->loop);
+    g_main_context_unref(mock->context);
+    g_mutex_clear(&mock->lock);
+    g_cond_clear(&mock->cond);
+    g_free(mock->bus_address);
+    g_free(mock->tag_type);
+    g_free(mock->poll_mode);
+    g_free(mock);
+}
+
+/* Runs a request on the mock's thread and waits for it to complete */
+typedef void (*_MockFunc)(MockNeard* mock, gpointer data);
+
+typedef struct {
+    MockNeard* mock;
+    _MockFunc func;
+    gpointer data;
+    gboolean done;
+} _MockCall;
+
+static gboolean _mock_call_dispatch(gpointer user_data)
+{
+    _MockCall* call = user_data;
+
+    call->func(call->mock, call->data);
+    g_mutex_lock(&call->mock->lock);
+    call->done = TRUE;
+    g_cond_broadcast(&call->mock->cond);
+    g_mutex_unlock(&call->mock->lock);
+    return FALSE;
+}
+
+static void _mock_call(MockNeard* mock, _MockFunc func, gpointer data)
+{
+    _MockCall call = { mock, func, data, FALSE };
+
+    g_main_context_invoke(mock->context, _mock_call_dispatch, &call);
+    g_mutex_lock(&mock->lock);
+    while (call.done == FALSE)
+        g_cond_wait(&mock->cond, &mock->lock);
+    g_mutex_unlock(&mock->lock);
+}
+
+typedef struct {
+    GBytes* payload;
+    gchar* tag_path;
+} _PlaceTag;
+
+typedef struct {
+    MockNeard* mock;
+    gchar* tag_path;
+    GBytes* payload;
+} _ReadTag;
+
+/* Publishes what was read from a tag, as neard does when it is done */
+static void _finish_read(MockNeard* mock, const gchar* tag_path, GBytes* payload)
+{
+    _MockObject* tag = g_hash_table_lookup(mock->objects, tag_path);
+    if (tag == NULL)
+        return;
+
+    tag->reading = FALSE;
+    if (payload != NULL) {
+        gchar* record_path = g_strdup_printf("%s/record0", tag_path);
+        _export_record(mock, tag, payload);
+        _call_agent(mock, record_path, payload);
+        g_free(record_path);
+    }
+}
+
+static gboolean _on_read_done(gpointer user_data)
+{
+    _ReadTag* read = user_data;
+
+    _finish_read(read->mock, read->tag_path, read->payload);
+    return G_SOURCE_REMOVE;
+}
+
+static void _read_tag_free(_ReadTag* read)
+{
+    g_free(read->tag_path);
+    if (read->payload != NULL)
+        g_bytes_unref(read->payload);
+    g_slice_free(_ReadTag, read);
+}
+
+static void _place_tag(MockNeard* mock, gpointer data)
+{
+    _PlaceTag* place = data;
+    _MockObject* adapter = g_hash_table_lookup(mock->objects, MOCK_NEARD_ADAPTER_PATH);
+    _MockObject* tag;
+    GHashTable* properties;
+
+    // neard stops polling as soon as it has found a target
+    _mock_object_set_property(mock, adapter, "org.neard.Adapter", "Polling",
+                              g_variant_new_boolean(FALSE));
+
+    place->tag_path = g_strdup_printf("%s/tag%u", MOCK_NEARD_ADAPTER_PATH, mock->tag_count++);
+    tag = _mock_object_new(place->tag_path);
+    properties = _mock_object_add_interface(tag, "org.neard.Tag");
+    _add_property(properties, "Type", g_variant_new_string(mock->tag_type));
+    _add_property(properties, "Protocol", g_variant_new_string("MIFARE"));
+    _add_property(properties, "ReadOnly", g_variant_new_boolean(mock->tag_read_only));
+    _add_property(properties, "Adapter", g_variant_new_object_path(MOCK_NEARD_ADAPTER_PATH));
+    _export_object(mock, tag);
+
+    if (mock->read_delay == 0) {
+        _finish_read(mock, place->tag_path, place->payload);
+        return;
+    }
+
+    _ReadTag* read = g_slice_new(_ReadTag);
+    read->mock = mock;
+    read->tag_path = g_strdup(place->tag_path);
+    read->payload = place->payload != NULL ? g_bytes_ref(place->payload) : NULL;
+    tag->reading = TRUE;
+
+    GSource* source = g_timeout_source_new(mock->read_delay);
+    g_source_set_callback(source, _on_read_done, read, (GDestroyNotify)_read_tag_free);
+    g_source_attach(source, mock->context);
+    g_source_unref(source);
+}
+
+gchar* mock_neard_place_tag(MockNeard* mock, GBytes* payload)
+{
+    _PlaceTag place = { payload, NULL };
+
+    _mock_call(mock, _place_tag, &place);
+    return place.tag_path;
+}
+
+static void _remove_tag(MockNeard* mock, gpointer data)
+{
+    const gchar* tag_path = data;
+    gchar* record_path = g_strdup_printf("%s/record0", tag_path);
+    _MockObject* object;
+
+    object = g_hash_table_lookup(mock->objects, record_path);
+    if (object != NULL)
+        _unexport_object(mock, object);
+    object = g_hash_table_lookup(mock->objects, tag_path);
+    if (object != NULL)
+        _unexport_object(mock, object);
+    g_free(record_path);
+}
+
+void mock_neard_remove_tag(MockNeard* mock, const gchar* tag_path)
+{
+    _mock_call(mock, _remove_tag, (gpointer)tag_path);
+}
+
+typedef struct {
+    const gchar* tag_path;
+    GBytes* payload;
+} _GetPayload;
+
+static void _get_tag_payload(MockNeard* mock, gpointer data)
+{
+    _GetPayload* get = data;
+    _MockObject* tag = g_hash_table_lookup(mock->objects, get->tag_path);
+
+    if (tag != NULL && tag->payload != NULL)
+        get->payload = g_bytes_ref(tag->payload);
+}
+
+GBytes* mock_neard_get_tag_payload(MockNeard* mock, const gchar* tag_path)
+{
+    _GetPayload get = { tag_path, NULL };
+
+    _mock_call(mock, _get_tag_payload, &get);
+    return get.payload;
+}
+
+static void _get_polling(MockNeard* mock, gpointer data)
+{
+    _MockObject* adapter = g_hash_table_lookup(mock->objects, MOCK_NEARD_ADAPTER_PATH);
+    GVariant* polling = _mock_object_get_property(adapter, "org.neard.Adapter", "Polling");
+
+    *(gboolean*)data = g_variant_get_boolean(polling);
+}
+
+gboolean mock_neard_adapter_is_polling(MockNeard* mock)
+{
+    gboolean polling = FALSE;
+
+    _mock_call(mock, _get_polling, &polling);
+    return polling;
+}
+
+gboolean mock_neard_wait_for_polling(MockNeard* mock, guint timeout_msec)
+{
+    gint64 end_time = g_get_monotonic_time() + timeout_msec * G_TIME_SPAN_MILLISECOND;
+    gboolean polling;
+
+    g_mutex_lock(&mock->lock);
+    while (mock->polling == FALSE && g_cond_wait_until(&mock->cond, &mock->lock, end_time))
+        ;
+    polling = mock->polling;
+    g_mutex_unlock(&mock->lock);
+    return polling;
+}
+
+guint mock_neard_get_poll_loop_count(MockNeard* mock, gchar** mode)
+{
+    guint count;
+
+    g_mutex_lock(&mock->lock);
+    count = mock->poll_loops_started;
+    if (mode != NULL)
+        *mode = g_strdup(mock->poll_mode);
+    g_mutex_unlock(&mock->lock);
+    return count;
+}
+
+typedef struct {
+    const gchar* adapter_path;
+    gchar* mode;
+} _GetMode;
+
+static void _get_adapter_mode(MockNeard* mock, gpointer data)
+{
+    _GetMode* get = data;
+    _MockObject* adapter = g_hash_table_lookup(mock->objects, get->adapter_path);
+    if (adapter == NULL)
+        return;
+
+    GVariant* mode = _mock_object_get_property(adapter, "org.neard.Adapter", "Mode");
+    get->mode = g_variant_dup_string(mode, NULL);
+}
+
+gchar* mock_neard_get_adapter_mode(MockNeard* mock, const gchar* adapter_path)
+{
+    _GetMode get = { adapter_path, NULL };
+
+    _mock_call(mock, _get_adapter_mode, &get);
+    return get.mode;
+}
+
+static void _add_adapter(MockNeard* mock, gpointer data)
+{
+    gchar* path = g_strdup_printf("/org/neard/nfc%u", mock->adapter_count++);
+
+    _export_adapter(mock, path);
+    *(gchar**)data = path;
+}
+
+gchar* mock_neard_add_adapter(MockNeard* mock)
+{
+    gchar* path = NULL;
+
+    _mock_call(mock, _add_adapter, &path);
+    return path;
+}
+
+static void _switch_adapter_off(MockNeard* mock, gpointer data)
+{
+    _MockObject* adapter = g_hash_table_lookup(mock->objects, MOCK_NEARD_ADAPTER_PATH);
+
+    _mock_object_set_property(mock, adapter, "org.neard.Adapter", "Powered",
+                              g_variant_new_boolean(FALSE));
+    _mock_object_set_property(mock, adapter, "org.neard.Adapter", "Polling",
+                              g_variant_new_boolean(FALSE));
+}
+
+void mock_neard_switch_adapter_off(MockNeard* mock)
+{
+    _mock_call(mock, _switch_adapter_off, NULL);
+}
+
+static void _add_device(MockNeard* mock, gpointer data)
+{
+    gchar* path = g_strdup_printf("%s/device%u", MOCK_NEARD_ADAPTER_PATH, mock->device_count++);
+    _MockObject* device = _mock_object_new(path);
+    GHashTable* properties = _mock_object_add_interface(device, "org.neard.Device");
+
+    _add_property(properties, "Adapter", g_variant_new_object_path(MOCK_NEARD_ADAPTER_PATH));
+    _export_object(mock, device);
+    *(gchar**)data = path;
+}
+
+gchar* mock_neard_add_device(MockNeard* mock)
+{
+    gchar* path = NULL;
+
+    _mock_call(mock, _add_device, &path);
+    return path;
+}
+
+static void _remove_device(MockNeard* mock, gpointer data)
+{
+    _MockObject* device = g_hash_table_lookup(mock->objects, data);
+
+    if (device != NULL)
+        _unexport_object(mock, device);
+}
+
+void mock_neard_remove_device(MockNeard* mock, const gchar* device_path)
+{
+    _mock_call(mock, _remove_device, (gpointer)device_path);
+}
+
+static void _set_unresponsive(MockNeard* mock, gpointer data)
+{
+    GDBusMethodInvocation* invocation;
+
+    mock->unresponsive = *(gboolean*)data;
+    if (mock->unresponsive == TRUE)
+        return;
+
+    while ((invocation = g_queue_pop_head(&mock->stalled_calls)) != NULL)
+        _handle_method_call(g_dbus_method_invocation_get_connection(invocation),
+                            g_dbus_method_invocation_get_sender(invocation),
+                            g_dbus_method_invocation_get_object_path(invocation),
+                            g_dbus_method_invocation_get_interface_name(invocation),
+                            g_dbus_method_invocation_get_method_name(invocation),
+                            g_dbus_method_invocation_get_parameters(invocation),
+                            invocation,
+                            mock);
+}
+
+typedef struct {
+    const gchar* type;
+    gboolean read_only;
+} _TagKind;
+
+static void _set_tag_kind(MockNeard* mock, gpointer data)
+{
+    _TagKind* kind = data;
+
+    g_free(mock->tag_type);
+    mock->tag_type = g_strdup(kind->type);
+    mock->tag_read_only = kind->read_only;
+}
+
+void mock_neard_set_tag_kind(MockNeard* mock, const gchar* type, gboolean read_only)
+{
+    _TagKind kind = { type, read_only };
+
+    _mock_call(mock, _set_tag_kind, &kind);
+}
+
+typedef struct {
+    gboolean read_after_write;
+    gboolean torn_writes;
+} _SetWriteBehaviour;
+
+static void _set_write_behaviour(MockNeard* mock, gpointer data)
+{
+    _SetWriteBehaviour* set = data;
+
+    mock->read_after_write = set->read_after_write;
+    mock->torn_writes = set->torn_writes;
+}
+
+void mock_neard_set_write_behaviour(MockNeard* mock,
+                                    gboolean read_after_write,
+                                    gboolean torn_writes)
+{
+    _SetWriteBehaviour set = { read_after_write, torn_writes };
+
+    _mock_call(mock, _set_write_behaviour, &set);
+}
+
+typedef struct {
+    gboolean record_payloads;
+    gboolean call_agent;
+} _SetRecordDelivery;
+
+static void _set_record_delivery(MockNeard* mock, gpointer data)
+{
+    _SetRecordDelivery* set = data;
+
+    mock->record_payloads = set->record_payloads;
+    mock->call_agent = set->call_agent;
+}
+
+void mock_neard_set_record_delivery(MockNeard* mock,
+                                    gboolean record_payloads,
+                                    gboolean call_agent)
+{
+    _SetRecordDelivery set = { record_payloads, call_agent };
+
+    _mock_call(mock, _set_record_delivery, &set);
+}
+
+static void _set_agent_record_path(MockNeard* mock, gpointer data)
+{
+    mock->agent_record_path = *(gboolean*)data;
+}
+
+void mock_neard_set_agent_record_path(MockNeard* mock, gboolean agent_record_path)
+{
+    _mock_call(mock, _set_agent_record_path, &agent_record_path);
+}
+
+static void _get_write_count(MockNeard* mock, gpointer data)
+{
+    *(guint*)data = mock->write_count;
+}
+
+guint mock_neard_get_write_count(MockNeard* mock)
+{
+    guint count = 0;
+
+    _mock_call(mock, _get_write_count, &count);
+    return count;
+}
+
+static void _set_read_delay(MockNeard* mock, gpointer data)
+{
+    mock->read_delay = *(guint*)data;
+}
+
+void mock_neard_set_read_delay(MockNeard* mock, guint read_delay)
+{
+    _mock_call(mock, _set_read_delay, &read_delay);
+}
+
+void mock_neard_set_unresponsive(MockNeard* mock, gboolean unresponsive)
+{
+    _mock_call(mock, _set_unresponsive, &unresponsive);
+}
+
+static void _restart(MockNeard* mock, gpointer data)
+{
+    _mock_disconnect(mock);
+    _mock_connect(mock);
+}
+
+void mock_neard_restart(MockNeard* mock)
+{
+    _mock_call(mock, _restart, NULL);
+}
+
+static void _get_polling_adapter_count(MockNeard* mock, gpointer data)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init(&iter, mock->objects);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        GVariant* polling = _mock_object_get_property(value, "org.neard.Adapter", "Polling");
+        if (polling != NULL && g_variant_get_boolean(polling) == TRUE)
+            (*(guint*)data)++;
+    }
+}
+
+guint mock_neard_get_polling_adapter_count(MockNeard* mock)
+{
+    guint count = 0;
+
+    _mock_call(mock, _get_polling_adapter_count, &count);
+    return count;
+}
+
+static void _get_agent_registered(MockNeard* mock, gpointer data)
+{
+    *(gboolean*)data = mock->agent_owner != NULL;
+}
+
+gboolean mock_neard_agent_is_registered(MockNeard* mock)
+{
+    gboolean registered = FALSE;
+
+    _mock_call(mock, _get_agent_registered, &registered);
+    return registered;
+}
+
+static void _get_agent_registration_count(MockNeard* mock, gpointer data)
+{
+    *(guint*)data = mock->agent_registration_count;
+}
+
+guint mock_neard_get_agent_registration_count(MockNeard* mock)
+{
+    guint count = 0;
+
+    _mock_call(mock, _get_agent_registration_count, &count);
+    return count;
+}
+
+static void _get_start_poll_loop_count(MockNeard* mock, gpointer data)
+{
+    *(guint*)data = mock->start_poll_loop_count;
+}
+
+guint mock_neard_get_start_poll_loop_count(MockNeard* mock)
+{
+    guint count = 0;
+
+    _mock_call(mock, _get_start_poll_loop_count, &count);
+    return count;
+}
@@ -0,0 +1,145 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef __MOCK_NEARD_H__
+#define __MOCK_NEARD_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+
+/* A stand-in for neard, for running the library against a private bus
+ * (see GTestDBus). It runs on its own thread and main context, owns the
+ * org.neard name and exports an ObjectManager, an AgentManager and one
+ * adapter at MOCK_NEARD_ADAPTER_PATH. Tags are placed on and removed from
+ * the adapter by the test.
+ *
+ * All functions are called from the test's thread; they return once the
+ * mock has processed the request.
+ */
+typedef struct _MockNeard MockNeard;
+
+#define MOCK_NEARD_ADAPTER_PATH "/org/neard/nfc0"
+
+MockNeard* mock_neard_new(const gchar* bus_address);
+void mock_neard_free(MockNeard* mock);
+
+/* Places a tag on the adapter. If @payload is not %NULL, the tag carries an
+ * application/gtlm-nfc record with that payload, and it is passed to the
+ * registered NDEF agent. Returns the object path of the tag.
+ */
+gchar* mock_neard_place_tag(MockNeard* mock, GBytes* payload);
+void mock_neard_remove_tag(MockNeard* mock, const gchar* tag_path);
+
+/* Returns the payload last written to a tag, or %NULL */
+GBytes* mock_neard_get_tag_payload(MockNeard* mock, const gchar* tag_path);
+
+/* Plugs in another adapter and returns its object path. Tags are always
+ * placed on the adapter at MOCK_NEARD_ADAPTER_PATH.
+ */
+gchar* mock_neard_add_adapter(MockNeard* mock);
+
+/* Switches the adapter at MOCK_NEARD_ADAPTER_PATH off, as a kill switch
+ * would; it stops polling and stays off until it is powered on again.
+ */
+void mock_neard_switch_adapter_off(MockNeard* mock);
+
+/* Brings a peer device into range of the adapter at MOCK_NEARD_ADAPTER_PATH
+ * and returns its object path. The library does not use devices; they stand
+ * for the other objects a busy neard announces.
+ */
+gchar* mock_neard_add_device(MockNeard* mock);
+void mock_neard_remove_device(MockNeard* mock, const gchar* device_path);
+
+/* Simulates neard crashing and being started again: the org.neard name goes
+ * away together with all objects and the registered agent, then comes back
+ * on a new connection with one adapter that is neither powered nor polling.
+ */
+void mock_neard_restart(MockNeard* mock);
+
+/* Simulates a hung neard: while unresponsive, method calls are queued
+ * without a reply. They are handled once the mock is responsive again.
+ */
+void mock_neard_set_unresponsive(MockNeard* mock, gboolean unresponsive);
+
+/* Makes tags that are placed from now on take @read_delay milliseconds to
+ * be read. Until then their records are not published, the agent is not
+ * called and writing to them fails, as it does with neard (NFC-57).
+ */
+void mock_neard_set_read_delay(MockNeard* mock, guint read_delay);
+
+/* Makes tags that are placed from now on of NFC Forum @type ("Type 2"
+ * unless set otherwise) and read-only if @read_only is set. Writing to
+ * read-only tags fails.
+ */
+void mock_neard_set_tag_kind(MockNeard* mock, const gchar* type, gboolean read_only);
+
+/* If @read_after_write is set, the agent is called with what is on a tag
+ * after each write to it, as neard reads tags again once it has written
+ * them. If @torn_writes is set, writes succeed but only the first half of
+ * the payload ends up on the tag, as when a tag is pulled away too early.
+ */
+void mock_neard_set_write_behaviour(MockNeard* mock,
+                                    gboolean read_after_write,
+                                    gboolean torn_writes);
+
+/* Decides how the records read from tags reach the library: if
+ * @record_payloads is set, record objects carry their payload in a Payload
+ * property, and if @call_agent is set (the default), the registered agent
+ * is called with it.
+ */
+void mock_neard_set_record_delivery(MockNeard* mock,
+                                    gboolean record_payloads,
+                                    gboolean call_agent);
+/* Decides whether the agent is told the path of the record it is called
+ * for, as older versions of neard do not (the default is %TRUE)
+ */
+void mock_neard_set_agent_record_path(MockNeard* mock, gboolean agent_record_path);
+
+gboolean mock_neard_adapter_is_polling(MockNeard* mock);
+/* Blocks until the main adapter is polling, or at most @timeout_msec;
+ * returns whether it is. Unlike the other calls this does not need the
+ * mock's thread, so it can wait on any thread.
+ */
+gboolean mock_neard_wait_for_polling(MockNeard* mock, guint timeout_msec);
+/* Returns how many poll loops the main adapter has started, and in @mode
+ * the mode of the last one; unlike the Mode property, this outlives the
+ * poll loop itself
+ */
+guint mock_neard_get_poll_loop_count(MockNeard* mock, gchar** mode);
+/* Returns the Mode property of an adapter, or %NULL if there is no such
+ * adapter; "Idle" while the adapter is not polling
+ */
+gchar* mock_neard_get_adapter_mode(MockNeard* mock, const gchar* adapter_path);
+guint mock_neard_get_polling_adapter_count(MockNeard* mock);
+gboolean mock_neard_agent_is_registered(MockNeard* mock);
+/* Returns how many RegisterNDEFAgent calls have reached the mock, including
+ * refused ones
+ */
+guint mock_neard_get_agent_registration_count(MockNeard* mock);
+guint mock_neard_get_start_poll_loop_count(MockNeard* mock);
+/* Returns how many Write calls have reached the mock */
+guint mock_neard_get_write_count(MockNeard* mock);
+
+#endif /* __MOCK_NEARD_H__ */
@@ -0,0 +1,545 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+#include "gtlm-nfc.h"
+#include "gtlm-nfc-payload.h"
+#include "mock-neard.h"
+
+/* All heap allocations in the process go through these wrappers, so the
+ * benchmarks below can count the allocations made by a code path. The
+ * per-thread count leaves out GDBus' worker thread and mock-neard.
+ */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static gsize allocations = 0;
+static __thread gsize thread_allocations = 0;
+
+void* malloc(size_t size)
+{
+    __sync_fetch_and_add(&allocations, 1);
+    thread_allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+    __sync_fetch_and_add(&allocations, 1);
+    thread_allocations++;
+    return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    __sync_fetch_and_add(&allocations, 1);
+    thread_allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+static gint64 _get_thread_cpu_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+/* A stand-in for GTlmNfc's record-found signal, declared once with copied
+ * and once with borrowed string arguments.
+ */
+typedef struct { GObject parent_instance; } BenchEmitter;
+typedef struct { GObjectClass parent_class; } BenchEmitterClass;
+
+G_DEFINE_TYPE (BenchEmitter, bench_emitter, G_TYPE_OBJECT)
+
+static guint copying_signal;
+static guint borrowing_signal;
+
+static void bench_emitter_init (BenchEmitter *self)
+{
+}
+
+static void bench_emitter_class_init (BenchEmitterClass *klass)
+{
+    copying_signal = g_signal_new ("copying",
+        G_TYPE_FROM_CLASS (klass),
+        G_SIGNAL_RUN_FIRST, 0, NULL, NULL, NULL, G_TYPE_NONE,
+        2, G_TYPE_STRING, G_TYPE_STRING);
+    borrowing_signal = g_signal_new ("borrowing",
+        G_TYPE_FROM_CLASS (klass),
+        G_SIGNAL_RUN_FIRST, 0, NULL, NULL, NULL, G_TYPE_NONE,
+        2,
+        G_TYPE_STRING | G_SIGNAL_TYPE_STATIC_SCOPE,
+        G_TYPE_STRING | G_SIGNAL_TYPE_STATIC_SCOPE);
+}
+
+static void _record_found_callback(GObject* emitter,
+                                   const gchar* username,
+                                   const gchar* password,
+                                   gpointer user_data)
+{
+    guint* counter = user_data;
+    if (username != NULL && password != NULL)
+        (*counter)++;
+}
+
+/* The payload format written before the compact format was introduced */
+static gchar* _encode_legacy(const gchar* username, const gchar* password)
+{
+    GVariant* v = g_variant_new("(msms)", username, password);
+    
+    gchar* out = g_base64_encode(g_variant_get_data(v), g_variant_get_size(v));
+    g_variant_unref(v);
+    return out;
+}
+
+/* Builds the argument of a GetNDEF call the way it arrives from the bus,
+ * i.e. in serialized form.
+ */
+static GVariant* _make_get_ndef_parameters(const guint8* payload, gsize size)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&builder, "{sv}", "Record",
+                          g_variant_new_object_path("/org/neard/nfc0/tag0/record0"));
+    g_variant_builder_add(&builder, "{sv}", "Payload",
+                          g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+                                                    payload, size, sizeof(guint8)));
+
+    GVariant* parameters = g_variant_ref_sink(g_variant_new("(a{sv})", &builder));
+    GBytes* bytes = g_variant_get_data_as_bytes(parameters);
+    GVariant* serialized = g_variant_ref_sink(
+        g_variant_new_from_bytes(G_VARIANT_TYPE("(a{sv})"), bytes, TRUE));
+    g_bytes_unref(bytes);
+    g_variant_unref(parameters);
+    return serialized;
+}
+
+/* The read path before payloads were borrowed */
+static void _read_copying(GObject* emitter, GVariant* parameters)
+{
+    GVariant* parameters_dict = g_variant_get_child_value(parameters, 0);
+    gchar* payload_data;
+    g_variant_lookup(parameters_dict, "Payload", "^ay", &payload_data);
+    g_variant_unref(parameters_dict);
+
+    gsize variant_s_size = 0;
+    guchar* variant_s = g_base64_decode(payload_data, &variant_s_size);
+    GVariantType* v_t = g_variant_type_new("(msms)");
+    GVariant* v = g_variant_new_from_data(v_t, variant_s, variant_s_size, FALSE, NULL, NULL);
+
+    gchar* username = NULL;
+    gchar* password = NULL;
+    g_variant_get(v, "(msms)", &username, &password);
+
+    g_signal_emit(emitter, copying_signal, 0, username, password);
+
+    g_free(username);
+    g_free(password);
+    g_variant_unref(v);
+    g_variant_type_free(v_t);
+    g_free(variant_s);
+    g_free(payload_data);
+}
+
+/* The read path of the library's NDEF agent */
+static void _read_borrowing(GObject* emitter, GVariant* parameters)
+{
+    GTlmNfcPayload payload;
+    gsize size = 0;
+
+    GVariant* payload_v = gtlm_nfc_payload_lookup(parameters);
+    const guint8* data = g_variant_get_fixed_array(payload_v, &size, sizeof(guint8));
+    if (gtlm_nfc_payload_decode(&payload, data, size) == TRUE)
+        g_signal_emit(emitter, borrowing_signal, 0, payload.username, payload.password);
+    gtlm_nfc_payload_clear(&payload);
+    g_variant_unref(payload_v);
+}
+
+typedef void (*ReadFunc)(GObject* emitter, GVariant* parameters);
+
+static void _run_read_benchmark(const gchar* name,
+                                ReadFunc read_func,
+                                GObject* emitter,
+                                GVariant* parameters,
+                                guint iterations)
+{
+    // warm up type and quark caches
+    read_func(emitter, parameters);
+
+    gsize allocations_start = allocations;
+    gint64 time_start = g_get_monotonic_time();
+    for (guint i = 0; i < iterations; i++)
+        read_func(emitter, parameters);
+    gint64 time_spent = g_get_monotonic_time() - time_start;
+    gsize allocations_spent = allocations - allocations_start;
+
+    printf("%-24s %10.2f allocs/read %10.3f us/read\n",
+           name,
+           (gdouble)allocations_spent / iterations,
+           (gdouble)time_spent / iterations);
+}
+
+/* Latencies of one kind of operation, in microseconds */
+typedef struct {
+    gint64 min;
+    gint64 max;
+    gint64 total;
+    guint count;
+} Latency;
+
+static void _latency_add(Latency* latency, gint64 usec)
+{
+    if (latency->count == 0 || usec < latency->min)
+        latency->min = usec;
+    latency->max = MAX(latency->max, usec);
+    latency->total += usec;
+    latency->count++;
+}
+
+static void _latency_print(const gchar* name, Latency* latency)
+{
+    printf("%-24s %10.1f us min %10.1f us avg %10.1f us max\n",
+           name,
+           (gdouble)latency->min,
+           latency->count > 0 ? (gdouble)latency->total / latency->count : 0.0,
+           (gdouble)latency->max);
+}
+
+static void _stats_print(GTlmNfc* tlm_nfc)
+{
+    static const gchar* stage_names[GTLM_NFC_N_STAGES] = {
+        "  tag->agent", "  decode", "  dispatch", "  handlers", "  total"
+    };
+    GTlmNfcStats stats;
+
+    gtlm_nfc_get_stats(tlm_nfc, &stats);
+    for (gint stage = 0; stage < GTLM_NFC_N_STAGES; stage++) {
+        GTlmNfcHistogram* histogram = &stats.stages[stage];
+        Latency latency = { histogram->min_usec, histogram->max_usec,
+                            histogram->total_usec, histogram->count };
+        _latency_print(stage_names[stage], &latency);
+    }
+}
+
+typedef struct {
+    gint tag_found;
+    gint record_found;
+    gint rearmed;
+    gint written;
+} BusEvents;
+
+static void _on_bus_tag_found(GTlmNfc* tlm_nfc, const gchar* tag_path, gpointer user_data)
+{
+    ((BusEvents*)user_data)->tag_found++;
+}
+
+static void _on_bus_record_found(GTlmNfc* tlm_nfc,
+                                 const gchar* username,
+                                 const gchar* password,
+                                 gpointer user_data)
+{
+    ((BusEvents*)user_data)->record_found++;
+}
+
+static void _on_bus_adapter_rearmed(GTlmNfc* tlm_nfc,
+                                    const gchar* adapter_path,
+                                    gint64 dead_time,
+                                    gpointer user_data)
+{
+    ((BusEvents*)user_data)->rearmed++;
+}
+
+static void _on_bus_write_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    GError* error = NULL;
+
+    if (gtlm_nfc_write_username_password_finish(GTLM_NFC(source_object), res, &error) == FALSE) {
+        fprintf(stderr, "Write failed: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+    ((BusEvents*)user_data)->written++;
+}
+
+static gboolean _on_bus_timeout(gpointer user_data)
+{
+    *(gboolean*)user_data = TRUE;
+    return G_SOURCE_REMOVE;
+}
+
+/* Iterates the main context until *counter reaches target, or gives up
+ * after a few seconds.
+ */
+static gboolean _wait_for_count(gint* counter, gint target)
+{
+    gboolean timed_out = FALSE;
+    guint timeout_id = g_timeout_add_seconds(5, _on_bus_timeout, &timed_out);
+
+    while (*counter < target && timed_out == FALSE)
+        g_main_context_iteration(NULL, TRUE);
+
+    if (timed_out == FALSE)
+        g_source_remove(timeout_id);
+    return timed_out == FALSE;
+}
+
+static void _on_interfaces_changed(GDBusConnection* connection,
+                                   const gchar* sender_name,
+                                   const gchar* object_path,
+                                   const gchar* interface_name,
+                                   const gchar* signal_name,
+                                   GVariant* parameters,
+                                   gpointer user_data)
+{
+    (*(gint*)user_data)++;
+}
+
+static guint _subscribe_interfaces_changed(GDBusConnection* connection,
+                                           const gchar* signal_name,
+                                           gint* counter)
+{
+    return g_dbus_connection_signal_subscribe(connection, NULL,
+                                              "org.freedesktop.DBus.ObjectManager",
+                                              signal_name, "/", NULL,
+                                              G_DBUS_SIGNAL_FLAGS_NONE,
+                                              _on_interfaces_changed, counter, NULL);
+}
+
+typedef gchar* (*AddObjectFunc)(MockNeard* mock);
+typedef void (*RemoveObjectFunc)(MockNeard* mock, const gchar* path);
+
+static gchar* _add_empty_tag(MockNeard* mock)
+{
+    return mock_neard_place_tag(mock, NULL);
+}
+
+/* The cost of one InterfacesAdded on the thread that runs the library:
+ * allocations and CPU time from the signal arriving to the library's
+ * handlers having run. The benchmark subscribes to the signal on the same
+ * connection as the library, without a sender, and GDBus dispatches such
+ * subscriptions after those for neard's name, so its handler runs last.
+ */
+static gboolean _run_interfaces_added_benchmark(const gchar* name,
+                                                GTlmNfc* tlm_nfc,
+                                                MockNeard* mock,
+                                                AddObjectFunc add_object,
+                                                RemoveObjectFunc remove_object,
+                                                guint iterations)
+{
+    GDBusConnection* connection = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, NULL);
+    gint added = 0;
+    gint removed = 0;
+    gsize allocations_spent = 0;
+    gint64 cpu_time_spent = 0;
+    gboolean ok = TRUE;
+
+    guint added_id = _subscribe_interfaces_changed(connection, "InterfacesAdded", &added);
+    guint removed_id = _subscribe_interfaces_changed(connection, "InterfacesRemoved", &removed);
+
+    for (guint i = 1; i <= iterations && ok == TRUE; i++) {
+        gsize allocations_start = thread_allocations;
+        gint64 cpu_time_start = _get_thread_cpu_time();
+        gchar* path = add_object(mock);
+        ok = _wait_for_count(&added, i);
+        cpu_time_spent += _get_thread_cpu_time() - cpu_time_start;
+        allocations_spent += thread_allocations - allocations_start;
+
+        remove_object(mock, path);
+        g_free(path);
+        if (ok == TRUE)
+            ok = _wait_for_count(&removed, i);
+    }
+
+    g_dbus_connection_signal_unsubscribe(connection, added_id);
+    g_dbus_connection_signal_unsubscribe(connection, removed_id);
+    g_object_unref(connection);
+    if (ok == TRUE)
+        printf("%-24s %10.1f allocs/add %10.1f us cpu/add\n",
+               name,
+               (gdouble)allocations_spent / iterations,
+               (gdouble)cpu_time_spent / iterations);
+    return ok;
+}
+
+static gboolean _run_bus_benchmark(guint iterations)
+{
+    GError* error = NULL;
+    BusEvents events = { 0, 0, 0, 0 };
+    Latency read_latency = { 0, 0, 0, 0 };
+    Latency write_latency = { 0, 0, 0, 0 };
+    gboolean ok = FALSE;
+
+    GTestDBus* bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+    g_test_dbus_up(bus);
+    g_setenv("DBUS_SYSTEM_BUS_ADDRESS", g_test_dbus_get_bus_address(bus), TRUE);
+    MockNeard* mock = mock_neard_new(g_test_dbus_get_bus_address(bus));
+
+    GTlmNfc* tlm_nfc = gtlm_nfc_new(NULL, &error);
+    if (tlm_nfc == NULL) {
+        fprintf(stderr, "Failed to set up GTlmNfc: %s\n", error->message);
+        g_error_free(error);
+        goto out;
+    }
+    g_signal_connect(tlm_nfc, "tag-found", G_CALLBACK(_on_bus_tag_found), &events);
+    g_signal_connect(tlm_nfc, "record-found", G_CALLBACK(_on_bus_record_found), &events);
+    g_signal_connect(tlm_nfc, "adapter-rearmed", G_CALLBACK(_on_bus_adapter_rearmed), &events);
+    while (mock_neard_adapter_is_polling(mock) == FALSE)
+        g_main_context_iteration(NULL, FALSE);
+
+    gsize payload_size = 0;
+    guint8* payload_data = gtlm_nfc_payload_encode("someuser", "somesecret", &payload_size);
+    GBytes* payload = g_bytes_new_take(payload_data, payload_size);
+
+    // a full tap: the tag arrives, its record is reported, it goes away and
+    // the adapter is polling again
+    gint64 taps_start = g_get_monotonic_time();
+    for (guint i = 1; i <= iterations; i++) {
+        gint64 start = g_get_monotonic_time();
+        gchar* tag_path = mock_neard_place_tag(mock, payload);
+        if (_wait_for_count(&events.record_found, i) == FALSE) {
+            g_free(tag_path);
+            goto out_payload;
+        }
+        _latency_add(&read_latency, g_get_monotonic_time() - start);
+        mock_neard_remove_tag(mock, tag_path);
+        g_free(tag_path);
+        if (_wait_for_count(&events.rearmed, i) == FALSE)
+            goto out_payload;
+    }
+    gint64 taps_time = g_get_monotonic_time() - taps_start;
+
+    for (guint i = 1; i <= iterations; i++) {
+        gchar* tag_path = mock_neard_place_tag(mock, NULL);
+        if (_wait_for_count(&events.tag_found, iterations + i) == FALSE) {
+            g_free(tag_path);
+            goto out_payload;
+        }
+        gint64 start = g_get_monotonic_time();
+        gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, "someuser", "somesecret",
+                                               -1, NULL, _on_bus_write_done, &events);
+        if (_wait_for_count(&events.written, i) == FALSE) {
+            g_free(tag_path);
+            goto out_payload;
+        }
+        _latency_add(&write_latency, g_get_monotonic_time() - start);
+        mock_neard_remove_tag(mock, tag_path);
+        g_free(tag_path);
+        if (_wait_for_count(&events.rearmed, iterations + i) == FALSE)
+            goto out_payload;
+    }
+
+    gint64 rearm_max = 0;
+    gint64 rearm_average = 0;
+    gtlm_nfc_get_rearm_time(tlm_nfc, MOCK_NEARD_ADAPTER_PATH,
+                            NULL, &rearm_max, &rearm_average, NULL);
+
+    printf("Against mock-neard on a private bus, %u taps\n", iterations);
+    _latency_print("tag placed->record", &read_latency);
+    _stats_print(tlm_nfc);
+    _latency_print("write", &write_latency);
+    printf("%-24s %10.1f us avg %10.1f us max\n", "re-arm dead time",
+           (gdouble)rearm_average, (gdouble)rearm_max);
+    printf("%-24s %10.1f taps/s\n", "throughput",
+           taps_time > 0 ? (gdouble)iterations * G_USEC_PER_SEC / taps_time : 0.0);
+
+    printf("\nInterfacesAdded from mock-neard, %u objects\n", iterations);
+    if (_run_interfaces_added_benchmark("foreign (device)", tlm_nfc, mock,
+                                        mock_neard_add_device, mock_neard_remove_device,
+                                        iterations) == FALSE ||
+        _run_interfaces_added_benchmark("tag", tlm_nfc, mock,
+                                        _add_empty_tag, mock_neard_remove_tag,
+                                        iterations) == FALSE)
+        goto out_payload;
+    ok = TRUE;
+
+out_payload:
+    g_bytes_unref(payload);
+out:
+    if (ok == FALSE)
+        fprintf(stderr, "Bus benchmark timed out\n");
+    if (tlm_nfc != NULL)
+        g_object_unref(tlm_nfc);
+    mock_neard_free(mock);
+    g_test_dbus_down(bus);
+    g_object_unref(bus);
+    return ok;
+}
+
+int main (int argc, char *argv[])
+{
+    guint iterations = 100000;
+    guint bus_iterations = 200;
+    guint records_found = 0;
+
+    if (argc > 1)
+        iterations = atoi(argv[1]);
+    if (argc > 2)
+        bus_iterations = atoi(argv[2]);
+
+#if !GLIB_CHECK_VERSION (2, 36, 0)
+    g_type_init ();
+#endif
+
+    GObject* emitter = g_object_new(bench_emitter_get_type(), NULL);
+    g_signal_connect(emitter, "copying", G_CALLBACK(_record_found_callback), &records_found);
+    g_signal_connect(emitter, "borrowing", G_CALLBACK(_record_found_callback), &records_found);
+
+    gchar* legacy = _encode_legacy("someuser", "somesecret");
+    // legacy payloads were written as bytestrings, including the nul
+    gsize legacy_size = strlen(legacy) + 1;
+    GVariant* legacy_parameters = _make_get_ndef_parameters((const guint8*)legacy, legacy_size);
+
+    gsize compact_size = 0;
+    guint8* compact = gtlm_nfc_payload_encode("someuser", "somesecret", &compact_size);
+    GVariant* compact_parameters = _make_get_ndef_parameters(compact, compact_size);
+
+    printf("Payload size: legacy %" G_GSIZE_FORMAT " bytes, compact %" G_GSIZE_FORMAT " bytes\n",
+           legacy_size, compact_size);
+    printf("Credential read path, %u iterations\n", iterations);
+    _run_read_benchmark("copying, legacy", _read_copying, emitter, legacy_parameters, iterations);
+    _run_read_benchmark("borrowing, legacy", _read_borrowing, emitter, legacy_parameters, iterations);
+    _run_read_benchmark("borrowing, compact", _read_borrowing, emitter, compact_parameters, iterations);
+
+    g_free(legacy);
+    g_free(compact);
+    g_variant_unref(legacy_parameters);
+    g_variant_unref(compact_parameters);
+    g_object_unref(emitter);
+
+    if (records_found != 3 * (iterations + 1))
+        return EXIT_FAILURE;
+
+    printf("\n");
+    return _run_bus_benchmark(bus_iterations) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,1830 @@
+/* vi: set et sw=4 ts=4 cino=t0,(0: */
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of libtlm-nfc
+ *
+ * Copyright (C) 2013 Intel Corporation.
+ *
+ * Contact: Alexander Kanavin <alex.kanavin@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "gtlm-nfc.h"
+#include "gtlm-nfc-payload.h"
+#include "mock-neard.h"
+
+/* These tests run the library against mock-neard on a private bus, so they
+ * need neither NFC hardware nor a running neard.
+ */
+
+static GTestDBus* test_bus = NULL;
+static MockNeard* mock = NULL;
+
+#define WAIT_TIMEOUT_MSEC 5000
+
+typedef gboolean (*ConditionFunc)(gpointer data);
+
+static gboolean _on_wait_timeout(gpointer user_data)
+{
+    *(gboolean*)user_data = TRUE;
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean _on_wait_tick(gpointer user_data)
+{
+    return G_SOURCE_CONTINUE;
+}
+
+/* Iterates the default main context until @condition holds. The tick
+ * makes sure conditions on the mock's state are re-checked even when
+ * nothing arrives on the bus.
+ */
+static gboolean _wait_for(ConditionFunc condition, gpointer data)
+{
+    gboolean timed_out = FALSE;
+    guint timeout_id = g_timeout_add(WAIT_TIMEOUT_MSEC, _on_wait_timeout, &timed_out);
+    guint tick_id = g_timeout_add(10, _on_wait_tick, NULL);
+
+    while (condition(data) == FALSE && timed_out == FALSE)
+        g_main_context_iteration(NULL, TRUE);
+
+    if (timed_out == FALSE)
+        g_source_remove(timeout_id);
+    g_source_remove(tick_id);
+    return timed_out == FALSE;
+}
+
+static gboolean _is_nonzero(gpointer data)
+{
+    return *(gint*)data != 0;
+}
+
+static gboolean _is_polling(gpointer data)
+{
+    return mock_neard_adapter_is_polling(data);
+}
+
+static gboolean _is_not_polling(gpointer data)
+{
+    return mock_neard_adapter_is_polling(data) == FALSE;
+}
+
+static gboolean _is_agent_registered(gpointer data)
+{
+    return mock_neard_agent_is_registered(data);
+}
+
+static gboolean _is_agent_unregistered(gpointer data)
+{
+    return mock_neard_agent_is_registered(data) == FALSE;
+}
+
+static gboolean _is_not_null(gpointer data)
+{
+    return *(gpointer*)data != NULL;
+}
+
+static gboolean _is_null(gpointer data)
+{
+    return *(gpointer*)data == NULL;
+}
+
+/* Drops the test's reference and waits for calls still in flight to let go
+ * of theirs
+ */
+static void _drop_tlm_nfc(GTlmNfc* tlm_nfc)
+{
+    g_object_add_weak_pointer(G_OBJECT(tlm_nfc), (gpointer*)&tlm_nfc);
+    g_object_unref(tlm_nfc);
+    fail_if(_wait_for(_is_null, &tlm_nfc) == FALSE, "GTlmNfc was not finalized");
+}
+
+/* Like _drop_tlm_nfc(), and also waits for the agent to be gone, so that the
+ * next test can register its agent at the same path. If @tlm_nfc is shared,
+ * it must be the last user of the engine.
+ */
+static void _unref_tlm_nfc(GTlmNfc* tlm_nfc)
+{
+    _drop_tlm_nfc(tlm_nfc);
+    fail_if(_wait_for(_is_agent_unregistered, mock) == FALSE, "Agent was not unregistered");
+}
+
+static GBytes* _encode_payload(const gchar* username, const gchar* password)
+{
+    gsize size = 0;
+    guint8* data = gtlm_nfc_payload_encode(username, password, &size);
+    return g_bytes_new_take(data, size);
+}
+
+typedef struct {
+    gint tag_found;
+    gint tag_lost;
+    gint record_found;
+    gint no_record_found;
+    gint rearmed;
+    gint adapters_ready;
+    gint tag_ready;
+    gchar* tag_path;
+    gchar* username;
+    gchar* password;
+} Events;
+
+static void _on_tag_found(GTlmNfc* tlm_nfc, const gchar* tag_path, gpointer user_data)
+{
+    Events* events = user_data;
+    events->tag_found++;
+    g_free(events->tag_path);
+    events->tag_path = g_strdup(tag_path);
+}
+
+static void _on_tag_lost(GTlmNfc* tlm_nfc, const gchar* tag_path, gpointer user_data)
+{
+    Events* events = user_data;
+    events->tag_lost++;
+}
+
+static void _on_tag_ready(GTlmNfc* tlm_nfc, const gchar* tag_path, gpointer user_data)
+{
+    Events* events = user_data;
+    events->tag_ready++;
+}
+
+static void _on_record_found(GTlmNfc* tlm_nfc,
+                             const gchar* username,
+                             const gchar* password,
+                             gpointer user_data)
+{
+    Events* events = user_data;
+    events->record_found++;
+    g_free(events->username);
+    g_free(events->password);
+    events->username = g_strdup(username);
+    events->password = g_strdup(password);
+}
+
+static void _on_no_record_found(GTlmNfc* tlm_nfc, gpointer user_data)
+{
+    Events* events = user_data;
+    events->no_record_found++;
+}
+
+static void _on_adapter_rearmed(GTlmNfc* tlm_nfc,
+                                const gchar* adapter_path,
+                                gint64 dead_time,
+                                gpointer user_data)
+{
+    Events* events = user_data;
+    events->rearmed++;
+}
+
+static void _on_adapters_ready(GTlmNfc* tlm_nfc, gpointer user_data)
+{
+    Events* events = user_data;
+    events->adapters_ready++;
+}
+
+static void _connect_events(GTlmNfc* tlm_nfc, Events* events)
+{
+    memset(events, 0, sizeof(Events));
+    g_signal_connect(tlm_nfc, "tag-found", G_CALLBACK(_on_tag_found), events);
+    g_signal_connect(tlm_nfc, "tag-lost", G_CALLBACK(_on_tag_lost), events);
+    g_signal_connect(tlm_nfc, "tag-ready", G_CALLBACK(_on_tag_ready), events);
+    g_signal_connect(tlm_nfc, "record-found", G_CALLBACK(_on_record_found), events);
+    g_signal_connect(tlm_nfc, "no-record-found", G_CALLBACK(_on_no_record_found), events);
+    g_signal_connect(tlm_nfc, "adapter-rearmed", G_CALLBACK(_on_adapter_rearmed), events);
+    g_signal_connect(tlm_nfc, "adapters-ready", G_CALLBACK(_on_adapters_ready), events);
+}
+
+static void _clear_events(Events* events)
+{
+    g_free(events->tag_path);
+    g_free(events->username);
+    g_free(events->password);
+}
+
+static GTlmNfc* _new_tlm_nfc(void)
+{
+    GError* error = NULL;
+    GTlmNfc* tlm_nfc = gtlm_nfc_new(NULL, &error);
+    fail_if(tlm_nfc == NULL, "Failed to set up GTlmNfc: %s", error ? error->message : "");
+    fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter did not start polling");
+    return tlm_nfc;
+}
+
+static GTlmNfc* _new_shared_tlm_nfc(void)
+{
+    GError* error = NULL;
+    GTlmNfc* tlm_nfc = g_initable_new(G_TYPE_TLM_NFC, NULL, &error, "shared", TRUE, NULL);
+    fail_if(tlm_nfc == NULL, "Failed to set up GTlmNfc: %s", error ? error->message : "");
+    fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter did not start polling");
+    return tlm_nfc;
+}
+
+static void _setup(void)
+{
+    mock = mock_neard_new(g_test_dbus_get_bus_address(test_bus));
+}
+
+static void _teardown(void)
+{
+    mock_neard_free(mock);
+    mock = NULL;
+}
+
+START_TEST (test_tlm_nfc_new)
+{
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+
+    fail_if(mock_neard_agent_is_registered(mock) == FALSE);
+    fail_if(mock_neard_get_start_poll_loop_count(mock) != 1);
+
+    _unref_tlm_nfc(tlm_nfc);
+    fail_if(_wait_for(_is_agent_unregistered, mock) == FALSE, "Agent was not unregistered");
+}
+END_TEST
+
+static void _on_new_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    GError* error = NULL;
+    GTlmNfc** tlm_nfc = user_data;
+
+    *tlm_nfc = gtlm_nfc_new_finish(res, &error);
+    fail_if(*tlm_nfc == NULL, "Failed to set up GTlmNfc: %s", error ? error->message : "");
+}
+
+START_TEST (test_tlm_nfc_new_async)
+{
+    GTlmNfc* tlm_nfc = NULL;
+
+    gtlm_nfc_new_async(NULL, _on_new_done, &tlm_nfc);
+    fail_if(_wait_for(_is_not_null, &tlm_nfc) == FALSE, "Asynchronous setup timed out");
+    fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter did not start polling");
+    fail_if(mock_neard_agent_is_registered(mock) == FALSE);
+
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_object_new)
+{
+    Events events;
+
+    // without GInitable, the object sets itself up once the main loop runs
+    GTlmNfc* tlm_nfc = g_object_new(G_TYPE_TLM_NFC, NULL);
+    _connect_events(tlm_nfc, &events);
+    fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter did not start polling");
+    fail_if(mock_neard_agent_is_registered(mock) == FALSE);
+
+    GBytes* payload = _encode_payload("someuser", "somesecret");
+    gchar* tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events.tag_found) == FALSE, "No tag found");
+    fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+    fail_if(g_strcmp0(events.username, "someuser") != 0);
+    mock_neard_remove_tag(mock, tag_path);
+
+    g_free(tag_path);
+    g_bytes_unref(payload);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_new_no_neard)
+{
+    GError* error = NULL;
+
+    mock_neard_free(mock);
+    mock = NULL;
+
+    GTlmNfc* tlm_nfc = gtlm_nfc_new(NULL, &error);
+    fail_if(tlm_nfc != NULL);
+    fail_if(error == NULL);
+    g_error_free(error);
+
+    mock = mock_neard_new(g_test_dbus_get_bus_address(test_bus));
+}
+END_TEST
+
+static void _on_shutdown_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    *(GAsyncResult**)user_data = g_object_ref(res);
+}
+
+START_TEST (test_tlm_nfc_shutdown)
+{
+    GError* error = NULL;
+    GAsyncResult* result = NULL;
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+
+    gtlm_nfc_shutdown_async(tlm_nfc, -1, NULL, _on_shutdown_done, &result);
+    fail_if(_wait_for(_is_not_null, &result) == FALSE, "Shutdown did not complete");
+    fail_if(gtlm_nfc_shutdown_finish(tlm_nfc, result, &error) == FALSE,
+            "Shutdown failed: %s", error ? error->message : "");
+    fail_if(mock_neard_agent_is_registered(mock) == TRUE);
+    g_clear_object(&result);
+    _unref_tlm_nfc(tlm_nfc);
+
+    // against a hung neard, shutdown gives up at its deadline...
+    tlm_nfc = _new_tlm_nfc();
+    mock_neard_set_unresponsive(mock, TRUE);
+    gint64 start = g_get_monotonic_time();
+    gtlm_nfc_shutdown_async(tlm_nfc, 200, NULL, _on_shutdown_done, &result);
+    fail_if(_wait_for(_is_not_null, &result) == FALSE, "Shutdown did not complete");
+    gint64 shutdown_time = g_get_monotonic_time() - start;
+    fail_if(gtlm_nfc_shutdown_finish(tlm_nfc, result, &error) == TRUE);
+    fail_if(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT) == FALSE,
+            "Unexpected error: %s", error ? error->message : "");
+    fail_if(shutdown_time < 200000 || shutdown_time > 1000000,
+            "Shutdown took %" G_GINT64_FORMAT " us", shutdown_time);
+    g_clear_error(&error);
+    g_clear_object(&result);
+    _drop_tlm_nfc(tlm_nfc);
+    mock_neard_set_unresponsive(mock, FALSE);
+    fail_if(_wait_for(_is_agent_unregistered, mock) == FALSE, "Agent was not unregistered");
+
+    // ...and disposing does not wait for it at all
+    tlm_nfc = _new_tlm_nfc();
+    mock_neard_set_unresponsive(mock, TRUE);
+    start = g_get_monotonic_time();
+    _drop_tlm_nfc(tlm_nfc);
+    gint64 dispose_time = g_get_monotonic_time() - start;
+    fail_if(dispose_time > 100000, "Disposing took %" G_GINT64_FORMAT " us", dispose_time);
+    mock_neard_set_unresponsive(mock, FALSE);
+    fail_if(_wait_for(_is_agent_unregistered, mock) == FALSE, "Agent was not unregistered");
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_read)
+{
+    Events events;
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _connect_events(tlm_nfc, &events);
+
+    GBytes* payload = _encode_payload("someuser", "somesecret");
+    gchar* tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+    fail_if(events.tag_found != 1);
+    fail_if(g_strcmp0(events.tag_path, tag_path) != 0);
+    fail_if(g_strcmp0(events.username, "someuser") != 0);
+    fail_if(g_strcmp0(events.password, "somesecret") != 0);
+    fail_if(events.no_record_found != 0);
+
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+    fail_if(_wait_for(_is_nonzero, &events.rearmed) == FALSE, "Adapter was not re-armed");
+    fail_if(mock_neard_adapter_is_polling(mock) == FALSE);
+
+    gint64 last_usec = 0;
+    guint count = 0;
+    fail_if(gtlm_nfc_get_rearm_time(tlm_nfc, MOCK_NEARD_ADAPTER_PATH,
+                                    &last_usec, NULL, NULL, &count) == FALSE);
+    fail_if(count != 1);
+    fail_if(last_usec <= 0);
+
+    g_free(tag_path);
+    g_bytes_unref(payload);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_read_legacy)
+{
+    Events events;
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _connect_events(tlm_nfc, &events);
+
+    // tags written by earlier versions carry a base64 encoded (msms)
+    // variant, with a trailing nul
+    GVariant* v = g_variant_ref_sink(g_variant_new("(msms)", "someuser", "somesecret"));
+    gchar* encoded = g_base64_encode(g_variant_get_data(v), g_variant_get_size(v));
+    GBytes* payload = g_bytes_new(encoded, strlen(encoded) + 1);
+
+    gchar* tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+    fail_if(g_strcmp0(events.username, "someuser") != 0);
+    fail_if(g_strcmp0(events.password, "somesecret") != 0);
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+
+    g_free(tag_path);
+    g_bytes_unref(payload);
+    g_free(encoded);
+    g_variant_unref(v);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_read_garbage)
+{
+    Events events;
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _connect_events(tlm_nfc, &events);
+
+    GBytes* payload = g_bytes_new_static("\xa7\x01\x03\x10garbage", 11);
+    gchar* tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events.no_record_found) == FALSE, "Record was not rejected");
+    fail_if(events.record_found != 0);
+    mock_neard_remove_tag(mock, tag_path);
+
+    g_free(tag_path);
+    g_bytes_unref(payload);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_read_deferred)
+{
+    Events events;
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    g_object_set(tlm_nfc, "deferred-dispatch", TRUE, NULL);
+    _connect_events(tlm_nfc, &events);
+
+    GBytes* payload = _encode_payload("someuser", NULL);
+    gchar* tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+    fail_if(g_strcmp0(events.username, "someuser") != 0);
+    fail_if(events.password != NULL);
+    mock_neard_remove_tag(mock, tag_path);
+
+    g_free(tag_path);
+    g_bytes_unref(payload);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_read_direct)
+{
+    Events events;
+    GError* error = NULL;
+    GTlmNfc* tlm_nfc = g_initable_new(G_TYPE_TLM_NFC, NULL, &error,
+                                      "direct-records", TRUE, NULL);
+    fail_if(tlm_nfc == NULL, "Failed to set up GTlmNfc: %s", error ? error->message : "");
+    fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter did not start polling");
+    _connect_events(tlm_nfc, &events);
+
+    // records are reported from neard's record objects...
+    GBytes* payload = _encode_payload("someuser", "somesecret");
+    mock_neard_set_record_delivery(mock, TRUE, FALSE);
+    gchar* tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+    fail_if(g_strcmp0(events.username, "someuser") != 0);
+    fail_if(g_strcmp0(events.password, "somesecret") != 0);
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+    g_free(tag_path);
+
+    // ...only once if the agent is called as well...
+    events.record_found = 0;
+    events.tag_lost = 0;
+    mock_neard_set_record_delivery(mock, TRUE, TRUE);
+    tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+    fail_if(events.record_found != 1, "Record was reported %d times", events.record_found);
+    g_free(tag_path);
+
+    // ...also if the agent is not told which record it is called for...
+    events.record_found = 0;
+    events.tag_lost = 0;
+    mock_neard_set_agent_record_path(mock, FALSE);
+    tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+    fail_if(events.record_found != 1, "Record was reported %d times", events.record_found);
+    mock_neard_set_agent_record_path(mock, TRUE);
+    g_free(tag_path);
+
+    // ...and through the agent if the record objects have no payload
+    events.record_found = 0;
+    events.tag_lost = 0;
+    mock_neard_set_record_delivery(mock, FALSE, TRUE);
+    tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+    fail_if(g_strcmp0(events.username, "someuser") != 0);
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+    fail_if(events.record_found != 1, "Record was reported %d times", events.record_found);
+    fail_if(events.no_record_found != 0);
+    g_free(tag_path);
+
+    g_bytes_unref(payload);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+typedef struct {
+    gint done;
+    gboolean written;
+    GError* error;
+} WriteResult;
+
+static void _on_write_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    WriteResult* result = user_data;
+
+    result->written = gtlm_nfc_write_username_password_finish(GTLM_NFC(source_object),
+                                                              res, &result->error);
+    result->done = 1;
+}
+
+START_TEST (test_tlm_nfc_write)
+{
+    Events events;
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _connect_events(tlm_nfc, &events);
+
+    gchar* tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &events.tag_found) == FALSE, "No tag found");
+
+    // written with the non-blocking call ...
+    WriteResult result = { 0, FALSE, NULL };
+    gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, "someuser", "somesecret",
+                                           -1, NULL, _on_write_done, &result);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Write timed out");
+    fail_if(result.written == FALSE, "Write failed: %s", result.error->message);
+
+    GTlmNfcPayload decoded;
+    GBytes* payload = mock_neard_get_tag_payload(mock, tag_path);
+    fail_if(payload == NULL);
+    fail_if(gtlm_nfc_payload_decode(&decoded,
+                                    g_bytes_get_data(payload, NULL),
+                                    g_bytes_get_size(payload)) == FALSE);
+    fail_if(g_strcmp0(decoded.username, "someuser") != 0);
+    fail_if(g_strcmp0(decoded.password, "somesecret") != 0);
+    gtlm_nfc_payload_clear(&decoded);
+    g_bytes_unref(payload);
+
+    // ... and with the blocking one
+    GError* error = NULL;
+    gtlm_nfc_write_username_password(tlm_nfc, tag_path, "otheruser", "othersecret", &error);
+    fail_if(error != NULL, "Write failed: %s", error ? error->message : "");
+
+    payload = mock_neard_get_tag_payload(mock, tag_path);
+    fail_if(gtlm_nfc_payload_decode(&decoded,
+                                    g_bytes_get_data(payload, NULL),
+                                    g_bytes_get_size(payload)) == FALSE);
+    fail_if(g_strcmp0(decoded.username, "otheruser") != 0);
+    gtlm_nfc_payload_clear(&decoded);
+    g_bytes_unref(payload);
+
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+
+    g_free(tag_path);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+typedef struct {
+    gint reports;
+    guint written;
+    guint failed;
+    guint remaining;
+    gboolean last_failed;
+    gchar* username;
+    gint done;
+    gboolean enrolled;
+    GError* error;
+} EnrollResult;
+
+static void _on_enroll_progress(GTlmNfc* tlm_nfc,
+                                const GTlmNfcEnrollProgress* progress,
+                                gpointer user_data)
+{
+    EnrollResult* result = user_data;
+
+    result->reports++;
+    result->written = progress->written;
+    result->failed = progress->failed;
+    result->remaining = progress->remaining;
+    result->last_failed = progress->error != NULL;
+    g_free(result->username);
+    result->username = g_strdup(progress->username);
+}
+
+static void _on_enroll_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    EnrollResult* result = user_data;
+
+    result->enrolled = gtlm_nfc_enroll_finish(GTLM_NFC(source_object), res, &result->error);
+    result->done = 1;
+}
+
+static gboolean _is_failed(gpointer data)
+{
+    EnrollResult* result = data;
+    return result->last_failed == TRUE;
+}
+
+static gboolean _is_written(gpointer data)
+{
+    EnrollResult* result = data;
+    return result->last_failed == FALSE;
+}
+
+static void _check_tag_username(const gchar* tag_path, const gchar* username)
+{
+    GTlmNfcPayload decoded;
+    GBytes* payload = mock_neard_get_tag_payload(mock, tag_path);
+    fail_if(payload == NULL);
+    fail_if(gtlm_nfc_payload_decode(&decoded,
+                                    g_bytes_get_data(payload, NULL),
+                                    g_bytes_get_size(payload)) == FALSE);
+    fail_if(g_strcmp0(decoded.username, username) != 0,
+            "Tag has %s instead of %s", decoded.username, username);
+    gtlm_nfc_payload_clear(&decoded);
+    g_bytes_unref(payload);
+}
+
+START_TEST (test_tlm_nfc_enroll)
+{
+    const gchar* usernames[] = { "user0", "user1", "user2", NULL };
+    const gchar* passwords[] = { "secret0", "secret1", "secret2", NULL };
+    EnrollResult result = { 0 };
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+
+    gtlm_nfc_enroll_async(tlm_nfc, usernames, passwords, 200, NULL,
+                          _on_enroll_progress, &result, _on_enroll_done, &result);
+
+    // each tag gets the next credentials...
+    gchar* tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &result.reports) == FALSE, "No progress reported");
+    fail_if(result.last_failed == TRUE);
+    fail_if(result.written != 1 || result.remaining != 2);
+    fail_if(g_strcmp0(result.username, "user0") != 0);
+    _check_tag_username(tag_path, "user0");
+    mock_neard_remove_tag(mock, tag_path);
+    g_free(tag_path);
+
+    // ...and credentials that could not be written go to the next tag
+    mock_neard_set_unresponsive(mock, TRUE);
+    tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_failed, &result) == FALSE, "Write did not fail");
+    fail_if(result.written != 1 || result.remaining != 2);
+    fail_if(g_strcmp0(result.username, "user1") != 0);
+    mock_neard_remove_tag(mock, tag_path);
+    mock_neard_set_unresponsive(mock, FALSE);
+    g_free(tag_path);
+
+    for (guint i = 1; i < 3; i++) {
+        tag_path = mock_neard_place_tag(mock, NULL);
+        result.last_failed = TRUE;
+        fail_if(_wait_for(_is_written, &result) == FALSE, "Write did not succeed");
+        _check_tag_username(tag_path, usernames[i]);
+        mock_neard_remove_tag(mock, tag_path);
+        g_free(tag_path);
+    }
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Enrollment did not complete");
+    fail_if(result.enrolled == FALSE, "Enrollment failed: %s",
+            result.error ? result.error->message : "");
+    fail_if(result.written != 3 || result.failed != 1 || result.remaining != 0);
+    g_free(result.username);
+
+    // an enrollment can be cancelled while it waits for a tag
+    GCancellable* cancellable = g_cancellable_new();
+    memset(&result, 0, sizeof(result));
+    gtlm_nfc_enroll_async(tlm_nfc, usernames, passwords, -1, cancellable,
+                          NULL, NULL, _on_enroll_done, &result);
+    g_cancellable_cancel(cancellable);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Enrollment was not cancelled");
+    fail_if(g_error_matches(result.error, G_IO_ERROR, G_IO_ERROR_CANCELLED) == FALSE);
+    g_clear_error(&result.error);
+    g_object_unref(cancellable);
+
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_tag_ready)
+{
+    Events events;
+    WriteResult result = { 0, FALSE, NULL };
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _connect_events(tlm_nfc, &events);
+    mock_neard_set_read_delay(mock, 200);
+
+    // a write issued as soon as the tag is found waits until neard has
+    // read the tag...
+    GBytes* payload = _encode_payload("someuser", "somesecret");
+    gchar* tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events.tag_found) == FALSE, "No tag found");
+    fail_if(events.tag_ready != 0);
+    gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, "otheruser", "othersecret",
+                                           -1, NULL, _on_write_done, &result);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Write timed out");
+    fail_if(result.written == FALSE, "Write failed: %s", result.error->message);
+    fail_if(events.tag_ready != 1);
+    _check_tag_username(tag_path, "otheruser");
+    fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+    g_free(tag_path);
+    g_bytes_unref(payload);
+
+    // ...also on a blank tag, which has no records to wait for...
+    memset(&result, 0, sizeof(result));
+    events.tag_found = events.tag_ready = events.tag_lost = 0;
+    tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &events.tag_found) == FALSE, "No tag found");
+    gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, "someuser", "somesecret",
+                                           -1, NULL, _on_write_done, &result);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Write timed out");
+    fail_if(result.written == FALSE, "Write failed: %s", result.error->message);
+    fail_if(events.tag_ready != 1);
+    _check_tag_username(tag_path, "someuser");
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+    g_free(tag_path);
+
+    // ...and fails if the tag goes away in the meantime
+    memset(&result, 0, sizeof(result));
+    events.tag_found = events.tag_ready = 0;
+    tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &events.tag_found) == FALSE, "No tag found");
+    gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, "someuser", "somesecret",
+                                           -1, NULL, _on_write_done, &result);
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Write timed out");
+    fail_if(g_error_matches(result.error, GTLM_NFC_ERROR, GTLM_NFC_ERROR_NO_TAG) == FALSE);
+    fail_if(events.tag_ready != 0);
+    g_clear_error(&result.error);
+    g_free(tag_path);
+
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_write_preflight)
+{
+    Events events;
+    WriteResult result = { 0, FALSE, NULL };
+    gchar long_field[GTLM_NFC_PAYLOAD_MAX_FIELD_SIZE + 2];
+
+    // a MIME record with an 8 byte header, the 20 byte type and the payload
+    fail_if(gtlm_nfc_get_encoded_size("someuser", "somesecret") != 3 + 20 + 23);
+    memset(long_field, 'x', sizeof(long_field) - 1);
+    long_field[sizeof(long_field) - 1] = '\0';
+    fail_if(gtlm_nfc_get_encoded_size(long_field, NULL) != 0);
+    long_field[GTLM_NFC_PAYLOAD_MAX_FIELD_SIZE] = '\0';
+    fail_if(gtlm_nfc_get_encoded_size(long_field, long_field) != 6 + 20 + 515);
+
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _connect_events(tlm_nfc, &events);
+
+    // read-only tags are not written to...
+    mock_neard_set_tag_kind(mock, "Type 2", TRUE);
+    gchar* tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &events.tag_found) == FALSE, "No tag found");
+    gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, "someuser", "somesecret",
+                                           -1, NULL, _on_write_done, &result);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Write timed out");
+    fail_if(g_error_matches(result.error, GTLM_NFC_ERROR, GTLM_NFC_ERROR_TAG_READ_ONLY) == FALSE,
+            "Unexpected result: %s", result.error ? result.error->message : "written");
+    fail_if(mock_neard_get_write_count(mock) != 0);
+    g_clear_error(&result.error);
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+    g_free(tag_path);
+
+    // ...and neither are credentials that do not fit
+    memset(&result, 0, sizeof(result));
+    events.tag_found = 0;
+    mock_neard_set_tag_kind(mock, "Type 1", FALSE);
+    tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &events.tag_found) == FALSE, "No tag found");
+    gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, long_field, long_field,
+                                           -1, NULL, _on_write_done, &result);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Write timed out");
+    fail_if(g_error_matches(result.error, GTLM_NFC_ERROR, GTLM_NFC_ERROR_TAG_TOO_SMALL) == FALSE,
+            "Unexpected result: %s", result.error ? result.error->message : "written");
+    fail_if(mock_neard_get_write_count(mock) != 0);
+    g_clear_error(&result.error);
+
+    memset(&result, 0, sizeof(result));
+    gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, "someuser", "somesecret",
+                                           -1, NULL, _on_write_done, &result);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Write timed out");
+    fail_if(result.written == FALSE, "Write failed: %s", result.error->message);
+    fail_if(mock_neard_get_write_count(mock) != 1);
+    mock_neard_remove_tag(mock, tag_path);
+    g_free(tag_path);
+
+    // a Type 2 tag may be an NTAG216, so anything we write is tried
+    memset(&result, 0, sizeof(result));
+    events.tag_found = 0;
+    mock_neard_set_tag_kind(mock, "Type 2", FALSE);
+    tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &events.tag_found) == FALSE, "No tag found");
+    gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, long_field, long_field,
+                                           -1, NULL, _on_write_done, &result);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Write timed out");
+    fail_if(result.written == FALSE, "Write failed: %s", result.error->message);
+    fail_if(mock_neard_get_write_count(mock) != 2);
+    GBytes* written = mock_neard_get_tag_payload(mock, tag_path);
+    fail_if(g_bytes_get_size(written) <= 144);
+    g_bytes_unref(written);
+    g_free(tag_path);
+
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+static gboolean _has_more_writes(gpointer data)
+{
+    return mock_neard_get_write_count(mock) > *(guint*)data;
+}
+
+typedef struct {
+    gint done;
+    GError* error;
+    gint64 usec;
+} BlockingWrite;
+
+static void _write_when_ready(GTlmNfc* tlm_nfc, const gchar* tag_path, gpointer user_data)
+{
+    BlockingWrite* write = user_data;
+    gint64 start = g_get_monotonic_time();
+
+    gtlm_nfc_write_username_password(tlm_nfc, tag_path, "someuser", "somesecret",
+                                     &write->error);
+    write->usec = g_get_monotonic_time() - start;
+    write->done = 1;
+}
+
+START_TEST (test_tlm_nfc_verify_write)
+{
+    Events events;
+    WriteResult result = { 0, FALSE, NULL };
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _connect_events(tlm_nfc, &events);
+    g_object_set(tlm_nfc, "verify-writes", TRUE, NULL);
+
+    gchar* tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &events.tag_ready) == FALSE, "Tag did not become ready");
+
+    // a write is done once the tag has been read back...
+    mock_neard_set_write_behaviour(mock, TRUE, FALSE);
+    gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, "someuser", "somesecret",
+                                           -1, NULL, _on_write_done, &result);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Write timed out");
+    fail_if(result.written == FALSE, "Write failed: %s", result.error->message);
+    fail_if(events.record_found == 0, "Tag was not read back");
+
+    // ...and fails if it does not hold what was written...
+    memset(&result, 0, sizeof(result));
+    mock_neard_set_write_behaviour(mock, TRUE, TRUE);
+    gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, "otheruser", "othersecret",
+                                           -1, NULL, _on_write_done, &result);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Write timed out");
+    fail_if(g_error_matches(result.error, GTLM_NFC_ERROR, GTLM_NFC_ERROR_VERIFY_FAILED) == FALSE,
+            "Unexpected result: %s", result.error ? result.error->message : "written");
+    g_clear_error(&result.error);
+
+    // ...or if it is not read back at all
+    memset(&result, 0, sizeof(result));
+    mock_neard_set_write_behaviour(mock, FALSE, FALSE);
+    gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, "someuser", "somesecret",
+                                           200, NULL, _on_write_done, &result);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Write timed out");
+    fail_if(g_error_matches(result.error, GTLM_NFC_ERROR, GTLM_NFC_ERROR_VERIFY_FAILED) == FALSE,
+            "Unexpected result: %s", result.error ? result.error->message : "written");
+    g_clear_error(&result.error);
+
+    // a tag that goes away before it is read back was not written
+    memset(&result, 0, sizeof(result));
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+    g_free(tag_path);
+    events.tag_ready = 0;
+    tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &events.tag_ready) == FALSE, "Tag did not become ready");
+    guint write_count = mock_neard_get_write_count(mock);
+    gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, "someuser", "somesecret",
+                                           -1, NULL, _on_write_done, &result);
+    fail_if(_wait_for(_has_more_writes, &write_count) == FALSE, "Tag was not written");
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Write timed out");
+    fail_if(g_error_matches(result.error, GTLM_NFC_ERROR, GTLM_NFC_ERROR_NO_TAG) == FALSE,
+            "Unexpected result: %s", result.error ? result.error->message : "written");
+    g_clear_error(&result.error);
+    g_free(tag_path);
+
+    // blocking writes from a tag-ready handler cannot wait for the
+    // read-back, which would be dispatched in the handler's main context
+    BlockingWrite write = { 0, NULL, 0 };
+    gulong handler_id = g_signal_connect(tlm_nfc, "tag-ready",
+                                         G_CALLBACK(_write_when_ready), &write);
+    mock_neard_set_write_behaviour(mock, TRUE, FALSE);
+    tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &write.done) == FALSE, "Write did not complete");
+    fail_if(write.error != NULL, "Write failed: %s", write.error ? write.error->message : "");
+    fail_if(write.usec > G_USEC_PER_SEC, "Write took %" G_GINT64_FORMAT " us", write.usec);
+    _check_tag_username(tag_path, "someuser");
+    g_signal_handler_disconnect(tlm_nfc, handler_id);
+    mock_neard_remove_tag(mock, tag_path);
+    g_free(tag_path);
+
+    // enrollments are verified too
+    const gchar* usernames[] = { "user0", NULL };
+    const gchar* passwords[] = { "secret0", NULL };
+    EnrollResult enroll_result = { 0 };
+    mock_neard_set_write_behaviour(mock, TRUE, FALSE);
+    gtlm_nfc_enroll_async(tlm_nfc, usernames, passwords, -1, NULL,
+                          NULL, NULL, _on_enroll_done, &enroll_result);
+    tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &enroll_result.done) == FALSE, "Enrollment did not complete");
+    fail_if(enroll_result.enrolled == FALSE, "Enrollment failed: %s",
+            enroll_result.error ? enroll_result.error->message : "");
+    _check_tag_username(tag_path, "user0");
+    mock_neard_remove_tag(mock, tag_path);
+    g_free(tag_path);
+
+    // cancelling an enrollment does not wait for the read-back
+    GCancellable* cancellable = g_cancellable_new();
+    memset(&enroll_result, 0, sizeof(enroll_result));
+    mock_neard_set_write_behaviour(mock, FALSE, FALSE);
+    gtlm_nfc_enroll_async(tlm_nfc, usernames, passwords, -1, cancellable,
+                          NULL, NULL, _on_enroll_done, &enroll_result);
+    write_count = mock_neard_get_write_count(mock);
+    tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_has_more_writes, &write_count) == FALSE, "Tag was not written");
+    g_cancellable_cancel(cancellable);
+    fail_if(_wait_for(_is_nonzero, &enroll_result.done) == FALSE, "Enrollment was not cancelled");
+    fail_if(g_error_matches(enroll_result.error, G_IO_ERROR, G_IO_ERROR_CANCELLED) == FALSE);
+    g_clear_error(&enroll_result.error);
+    g_object_unref(cancellable);
+    mock_neard_remove_tag(mock, tag_path);
+    g_free(tag_path);
+
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_write_no_tag)
+{
+    Events events;
+    GError* error = NULL;
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _connect_events(tlm_nfc, &events);
+
+    gtlm_nfc_write_username_password(tlm_nfc, MOCK_NEARD_ADAPTER_PATH "/tag99",
+                                     "someuser", "somesecret", &error);
+    fail_if(g_error_matches(error, GTLM_NFC_ERROR, GTLM_NFC_ERROR_NO_TAG) == FALSE);
+    g_clear_error(&error);
+
+    gchar* long_username = g_strnfill(GTLM_NFC_PAYLOAD_MAX_FIELD_SIZE + 1, 'a');
+    gchar* tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &events.tag_found) == FALSE, "No tag found");
+    gtlm_nfc_write_username_password(tlm_nfc, tag_path, long_username, "somesecret", &error);
+    fail_if(g_error_matches(error, GTLM_NFC_ERROR, GTLM_NFC_ERROR_CREDENTIALS_TOO_LONG) == FALSE);
+    g_clear_error(&error);
+    mock_neard_remove_tag(mock, tag_path);
+
+    g_free(tag_path);
+    g_free(long_username);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_taps)
+{
+    Events events;
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _connect_events(tlm_nfc, &events);
+    GBytes* payload = _encode_payload("someuser", "somesecret");
+
+    for (gint i = 1; i <= 20; i++) {
+        gchar* tag_path = mock_neard_place_tag(mock, payload);
+        fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+        mock_neard_remove_tag(mock, tag_path);
+        fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter was not re-armed");
+        fail_if(events.tag_found != i || events.tag_lost != i);
+        events.record_found = 0;
+        g_free(tag_path);
+    }
+    fail_if(mock_neard_get_start_poll_loop_count(mock) != 21);
+
+    g_bytes_unref(payload);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_stats)
+{
+    Events events;
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _connect_events(tlm_nfc, &events);
+    GBytes* payload = _encode_payload("someuser", "somesecret");
+
+    GTlmNfcStats stats;
+    gtlm_nfc_get_stats(tlm_nfc, &stats);
+    for (gint stage = 0; stage < GTLM_NFC_N_STAGES; stage++)
+        fail_if(stats.stages[stage].count != 0);
+
+    for (gint i = 0; i < 5; i++) {
+        gchar* tag_path = mock_neard_place_tag(mock, payload);
+        fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+        mock_neard_remove_tag(mock, tag_path);
+        fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter was not re-armed");
+        events.record_found = 0;
+        g_free(tag_path);
+    }
+
+    gtlm_nfc_get_stats(tlm_nfc, &stats);
+    for (gint stage = 0; stage < GTLM_NFC_N_STAGES; stage++) {
+        GTlmNfcHistogram* histogram = &stats.stages[stage];
+        guint64 bucket_total = 0;
+        for (gint bucket = 0; bucket < GTLM_NFC_HISTOGRAM_BUCKETS; bucket++)
+            bucket_total += histogram->buckets[bucket];
+        fail_if(histogram->count != 5, "Stage %d has %" G_GUINT64_FORMAT " samples",
+                stage, histogram->count);
+        fail_if(bucket_total != histogram->count);
+        fail_if(histogram->min_usec > histogram->max_usec);
+        fail_if(histogram->total_usec < histogram->max_usec);
+    }
+    fail_if(stats.stages[GTLM_NFC_STAGE_TOTAL].max_usec <= 0);
+
+    GTlmNfcStats* stats_copy = NULL;
+    gint64 average_latency = 0;
+    gint64 max_latency = 0;
+    g_object_get(tlm_nfc, "stats", &stats_copy,
+                 "average-latency", &average_latency,
+                 "max-latency", &max_latency, NULL);
+    fail_if(stats_copy == NULL);
+    fail_if(memcmp(stats_copy, &stats, sizeof(stats)) != 0);
+    fail_if(max_latency != stats.stages[GTLM_NFC_STAGE_TOTAL].max_usec);
+    fail_if(average_latency <= 0 || average_latency > max_latency);
+    gtlm_nfc_stats_free(stats_copy);
+
+    g_bytes_unref(payload);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_neard_restart)
+{
+    Events events;
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _connect_events(tlm_nfc, &events);
+
+    // a tag in range goes away together with neard
+    gchar* tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &events.tag_found) == FALSE, "No tag found");
+    g_free(tag_path);
+
+    mock_neard_restart(mock);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+    fail_if(_wait_for(_is_agent_registered, mock) == FALSE, "Agent was not registered again");
+    fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter did not start polling again");
+
+    GBytes* payload = _encode_payload("someuser", "somesecret");
+    tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+    fail_if(g_strcmp0(events.username, "someuser") != 0);
+    fail_if(g_strcmp0(events.password, "somesecret") != 0);
+
+    GTlmNfcStats stats;
+    gtlm_nfc_get_stats(tlm_nfc, &stats);
+    fail_if(stats.recovery.count != 1);
+    fail_if(stats.recovery.max_usec <= 0);
+
+    mock_neard_remove_tag(mock, tag_path);
+    g_free(tag_path);
+    g_bytes_unref(payload);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_adapters_ready)
+{
+    Events events;
+    GError* error = NULL;
+    gchar* adapter_paths[3];
+
+    adapter_paths[0] = mock_neard_add_adapter(mock);
+    adapter_paths[1] = mock_neard_add_adapter(mock);
+    GTlmNfc* tlm_nfc = gtlm_nfc_new(NULL, &error);
+    fail_if(tlm_nfc == NULL, "Failed to set up GTlmNfc: %s", error ? error->message : "");
+    _connect_events(tlm_nfc, &events);
+
+    fail_if(_wait_for(_is_nonzero, &events.adapters_ready) == FALSE, "Adapters not ready");
+    fail_if(mock_neard_get_polling_adapter_count(mock) != 3);
+    fail_if(events.adapters_ready != 1);
+
+    // a hotplugged adapter is set up too
+    events.adapters_ready = 0;
+    adapter_paths[2] = mock_neard_add_adapter(mock);
+    fail_if(_wait_for(_is_nonzero, &events.adapters_ready) == FALSE, "Adapter not ready");
+    fail_if(mock_neard_get_polling_adapter_count(mock) != 4);
+    fail_if(events.adapters_ready != 1);
+
+    for (gint i = 0; i < 3; i++)
+        g_free(adapter_paths[i]);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_rearm_powered_off)
+{
+    Events events;
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _connect_events(tlm_nfc, &events);
+    fail_if(_wait_for(_is_nonzero, &events.adapters_ready) == FALSE, "Adapters not ready");
+
+    // the adapter is switched off while a tag is on it; re-arming it powers
+    // it on again, which is not another setup
+    gchar* tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &events.tag_found) == FALSE, "No tag found");
+    mock_neard_switch_adapter_off(mock);
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events.rearmed) == FALSE, "Adapter was not re-armed");
+    fail_if(mock_neard_adapter_is_polling(mock) == FALSE);
+    g_free(tag_path);
+
+    // by the time the next tag is read, adapters-ready would have come again
+    GBytes* payload = _encode_payload("someuser", "somesecret");
+    tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+    fail_if(events.adapters_ready != 1);
+    fail_if(events.rearmed != 1);
+
+    mock_neard_remove_tag(mock, tag_path);
+    g_free(tag_path);
+    g_bytes_unref(payload);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_shared)
+{
+    Events events[2];
+    GTlmNfc* first = _new_shared_tlm_nfc();
+    _connect_events(first, &events[0]);
+    fail_if(_wait_for(_is_nonzero, &events[0].adapters_ready) == FALSE, "Adapters not ready");
+
+    // the second instance joins the first one's engine, and is told that
+    // the adapters are ready
+    GTlmNfc* second = _new_shared_tlm_nfc();
+    _connect_events(second, &events[1]);
+    fail_if(mock_neard_get_agent_registration_count(mock) != 1);
+
+    // deferred dispatch is up to each instance
+    gboolean deferred = TRUE;
+    g_object_set(second, "deferred-dispatch", TRUE, NULL);
+    g_object_get(first, "deferred-dispatch", &deferred, NULL);
+    fail_if(deferred == TRUE);
+    fail_if(_wait_for(_is_nonzero, &events[1].adapters_ready) == FALSE, "Adapters not ready");
+    fail_if(events[0].adapters_ready != 1);
+    fail_if(mock_neard_get_start_poll_loop_count(mock) != 1);
+
+    GBytes* payload = _encode_payload("someuser", "somesecret");
+    gchar* tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events[0].record_found) == FALSE, "No record found");
+    fail_if(_wait_for(_is_nonzero, &events[1].record_found) == FALSE, "No record found");
+    fail_if(g_strcmp0(events[1].username, "someuser") != 0);
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events[1].tag_lost) == FALSE, "Tag was not lost");
+    fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter was not re-armed");
+    g_free(tag_path);
+
+    // the engine stays up as long as one instance uses it, and an instance
+    // that has been shut down hears nothing more from it
+    GAsyncResult* result = NULL;
+    gtlm_nfc_shutdown_async(first, -1, NULL, _on_shutdown_done, &result);
+    fail_if(_wait_for(_is_not_null, &result) == FALSE, "Shutdown did not complete");
+    fail_if(gtlm_nfc_shutdown_finish(first, result, NULL) == FALSE);
+    g_clear_object(&result);
+    fail_if(mock_neard_agent_is_registered(mock) == FALSE, "Agent unregistered too early");
+    events[0].record_found = 0;
+    events[1].record_found = 0;
+    tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events[1].record_found) == FALSE, "No record found");
+    fail_if(events[0].record_found != 0);
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter was not re-armed");
+    g_free(tag_path);
+    _drop_tlm_nfc(first);
+    fail_if(mock_neard_agent_is_registered(mock) == FALSE, "Agent unregistered too early");
+    fail_if(mock_neard_get_agent_registration_count(mock) != 1);
+    events[1].record_found = 0;
+    tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events[1].record_found) == FALSE, "No record found");
+    g_free(tag_path);
+    _unref_tlm_nfc(second);
+
+    // by default, an instance talks to neard directly
+    GTlmNfc* standalone = _new_tlm_nfc();
+    fail_if(mock_neard_get_agent_registration_count(mock) != 2);
+    fail_if(mock_neard_agent_is_registered(mock) == FALSE);
+    _unref_tlm_nfc(standalone);
+
+    g_bytes_unref(payload);
+    _clear_events(&events[0]);
+    _clear_events(&events[1]);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_shared_new_during_async)
+{
+    GTlmNfc* first = NULL;
+    GError* error = NULL;
+
+    // a blocking setup waits for the asynchronous one that is still in
+    // flight in its own main context, and joins the same engine
+    g_async_initable_new_async(G_TYPE_TLM_NFC, G_PRIORITY_DEFAULT, NULL,
+                               _on_new_done, &first, "shared", TRUE, NULL);
+    GTlmNfc* second = g_initable_new(G_TYPE_TLM_NFC, NULL, &error, "shared", TRUE, NULL);
+    fail_if(second == NULL, "Failed to set up GTlmNfc: %s", error ? error->message : "");
+    fail_if(_wait_for(_is_not_null, &first) == FALSE, "Asynchronous setup timed out");
+    fail_if(mock_neard_get_agent_registration_count(mock) != 1);
+    fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter did not start polling");
+    fail_if(mock_neard_get_start_poll_loop_count(mock) != 1);
+
+    _drop_tlm_nfc(second);
+    fail_if(mock_neard_agent_is_registered(mock) == FALSE, "Agent unregistered too early");
+    _unref_tlm_nfc(first);
+}
+END_TEST
+
+typedef struct {
+    GTlmNfc* tlm_nfc;
+    GError* error;
+} SharedInit;
+
+static gpointer _init_shared_thread(gpointer data)
+{
+    SharedInit* init = data;
+    init->tlm_nfc = g_initable_new(G_TYPE_TLM_NFC, NULL, &init->error, "shared", TRUE, NULL);
+    return NULL;
+}
+
+START_TEST (test_tlm_nfc_shared_concurrent)
+{
+    GBytes* payload = _encode_payload("someuser", "somesecret");
+
+    // instances set up at the same time from two threads end up with one
+    // engine between them, whichever thread gets there first
+    for (guint round = 1; round <= 5; round++) {
+        SharedInit init[2] = { { NULL, NULL }, { NULL, NULL } };
+        GThread* threads[2];
+        Events events[2];
+
+        for (gint i = 0; i < 2; i++)
+            threads[i] = g_thread_new("shared-init", _init_shared_thread, &init[i]);
+        for (gint i = 0; i < 2; i++) {
+            g_thread_join(threads[i]);
+            fail_if(init[i].tlm_nfc == NULL, "Failed to set up GTlmNfc: %s",
+                    init[i].error ? init[i].error->message : "");
+            _connect_events(init[i].tlm_nfc, &events[i]);
+        }
+        fail_if(mock_neard_get_agent_registration_count(mock) != round);
+        for (gint i = 0; i < 2; i++)
+            fail_if(_wait_for(_is_nonzero, &events[i].adapters_ready) == FALSE, "Adapters not ready");
+        fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter did not start polling");
+        fail_if(mock_neard_get_start_poll_loop_count(mock) != round);
+
+        gchar* tag_path = mock_neard_place_tag(mock, payload);
+        for (gint i = 0; i < 2; i++)
+            fail_if(_wait_for(_is_nonzero, &events[i].record_found) == FALSE, "No record found");
+        mock_neard_remove_tag(mock, tag_path);
+        for (gint i = 0; i < 2; i++)
+            fail_if(_wait_for(_is_nonzero, &events[i].tag_lost) == FALSE, "Tag was not lost");
+        g_free(tag_path);
+        for (gint i = 0; i < 2; i++) {
+            fail_if(events[i].adapters_ready != 1);
+            fail_if(events[i].record_found != 1);
+        }
+
+        _drop_tlm_nfc(init[0].tlm_nfc);
+        _unref_tlm_nfc(init[1].tlm_nfc);
+        _clear_events(&events[0]);
+        _clear_events(&events[1]);
+    }
+    g_bytes_unref(payload);
+}
+END_TEST
+
+typedef struct {
+    const gchar* adapter_path;
+    const gchar* mode;
+} AdapterMode;
+
+static gboolean _is_in_mode(gpointer data)
+{
+    AdapterMode* expected = data;
+    gchar* mode = mock_neard_get_adapter_mode(mock, expected->adapter_path);
+    gboolean result = g_strcmp0(mode, expected->mode) == 0;
+    g_free(mode);
+    return result;
+}
+
+typedef struct {
+    guint poll_loop_count;
+    const gchar* mode;
+} PollLoop;
+
+/* Checks the poll loops the mock has seen rather than the adapter's current
+ * mode, which an idle timeout may already have reset
+ */
+static gboolean _has_polled_in_mode(gpointer data)
+{
+    PollLoop* expected = data;
+    gchar* mode = NULL;
+    gboolean result = mock_neard_get_poll_loop_count(mock, &mode) > expected->poll_loop_count &&
+                      g_strcmp0(mode, expected->mode) == 0;
+    g_free(mode);
+    return result;
+}
+
+START_TEST (test_tlm_nfc_poll_policy)
+{
+    Events events;
+    gchar* other_adapter_path = mock_neard_add_adapter(mock);
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _connect_events(tlm_nfc, &events);
+    fail_if(_wait_for(_is_nonzero, &events.adapters_ready) == FALSE, "Adapters not ready");
+
+    // switching the mode restarts the poll loop
+    PollLoop dual = { mock_neard_get_poll_loop_count(mock, NULL), "Dual" };
+    gtlm_nfc_set_poll_policy(tlm_nfc, MOCK_NEARD_ADAPTER_PATH, GTLM_NFC_POLL_MODE_DUAL, 1);
+    fail_if(_wait_for(_has_polled_in_mode, &dual) == FALSE, "Adapter not switched to Dual mode");
+
+    // only the adapter with an idle timeout stops polling
+    fail_if(_wait_for(_is_not_polling, mock) == FALSE, "Polling did not stop when idle");
+    fail_if(mock_neard_get_polling_adapter_count(mock) != 1);
+    AdapterMode initiator = { other_adapter_path, "Initiator" };
+    fail_if(_is_in_mode(&initiator) == FALSE);
+
+    gint64 polling_usec = 0, total_usec = 0;
+    fail_if(gtlm_nfc_get_polling_time(tlm_nfc, MOCK_NEARD_ADAPTER_PATH,
+                                      &polling_usec, &total_usec) == FALSE);
+    fail_if(polling_usec <= 0 || polling_usec > total_usec);
+    fail_if(gtlm_nfc_get_polling_time(tlm_nfc, "/org/neard/nonexistent", NULL, NULL));
+
+    dual.poll_loop_count = mock_neard_get_poll_loop_count(mock, NULL);
+    gtlm_nfc_activate(tlm_nfc);
+    fail_if(_wait_for(_has_polled_in_mode, &dual) == FALSE, "Adapter did not resume polling");
+    fail_if(_is_in_mode(&initiator) == FALSE);
+
+    g_free(other_adapter_path);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+typedef struct {
+    gchar* tag_path;
+    GThread* thread;
+    gboolean polling_during_handler;
+    gint record_found;
+} SlowHandler;
+
+static void _on_record_found_slowly(GTlmNfc* tlm_nfc,
+                                    const gchar* username,
+                                    const gchar* password,
+                                    gpointer user_data)
+{
+    SlowHandler* handler = user_data;
+
+    // the worker thread re-arms the adapter while the handler is still busy
+    handler->thread = g_thread_self();
+    mock_neard_remove_tag(mock, handler->tag_path);
+    handler->polling_during_handler = mock_neard_wait_for_polling(mock, WAIT_TIMEOUT_MSEC);
+    handler->record_found++;
+}
+
+START_TEST (test_tlm_nfc_worker_thread)
+{
+    Events events;
+    GError* error = NULL;
+    GTlmNfc* tlm_nfc = g_initable_new(G_TYPE_TLM_NFC, NULL, &error,
+                                      "worker-thread", TRUE, NULL);
+    fail_if(tlm_nfc == NULL, "Failed to set up GTlmNfc: %s", error ? error->message : "");
+    _connect_events(tlm_nfc, &events);
+    fail_if(_wait_for(_is_nonzero, &events.adapters_ready) == FALSE, "Adapters not ready");
+
+    SlowHandler handler = { NULL, NULL, FALSE, 0 };
+    g_signal_connect(tlm_nfc, "record-found", G_CALLBACK(_on_record_found_slowly), &handler);
+
+    GBytes* payload = _encode_payload("someuser", "somesecret");
+    handler.tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &handler.record_found) == FALSE, "No record found");
+    fail_if(handler.thread != g_thread_self(), "Signal emitted in another thread");
+    fail_if(handler.polling_during_handler == FALSE, "Adapter not re-armed");
+    fail_if(g_strcmp0(events.username, "someuser") != 0);
+    fail_if(g_strcmp0(events.password, "somesecret") != 0);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+    g_signal_handlers_disconnect_by_data(tlm_nfc, &handler);
+
+    // writes are passed to the worker thread and complete in this one
+    events.tag_found = 0;
+    gchar* tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &events.tag_found) == FALSE, "No tag found");
+    WriteResult result = { 0, FALSE, NULL };
+    gtlm_nfc_write_username_password_async(tlm_nfc, tag_path, "otheruser", "othersecret",
+                                           -1, NULL, _on_write_done, &result);
+    fail_if(_wait_for(_is_nonzero, &result.done) == FALSE, "Write timed out");
+    fail_if(result.written == FALSE, "Write failed: %s", result.error->message);
+    gtlm_nfc_write_username_password(tlm_nfc, tag_path, "otheruser", "othersecret", &error);
+    fail_if(error != NULL, "Write failed: %s", error ? error->message : "");
+
+    GTlmNfcStats stats;
+    gtlm_nfc_get_stats(tlm_nfc, &stats);
+    fail_if(stats.stages[GTLM_NFC_STAGE_TOTAL].count != 1);
+
+    g_free(tag_path);
+    g_free(handler.tag_path);
+    g_bytes_unref(payload);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_lazy)
+{
+    Events events;
+    GError* error = NULL;
+    GTlmNfc* tlm_nfc = g_initable_new(G_TYPE_TLM_NFC, NULL, &error,
+                                      "lazy", TRUE, "idle-timeout", 1, NULL);
+    fail_if(tlm_nfc == NULL, "Failed to set up GTlmNfc: %s", error ? error->message : "");
+    _connect_events(tlm_nfc, &events);
+    fail_if(mock_neard_agent_is_registered(mock), "Agent registered before first use");
+    fail_if(mock_neard_adapter_is_polling(mock), "Adapter polling before first use");
+
+    gtlm_nfc_activate(tlm_nfc);
+    fail_if(_wait_for(_is_nonzero, &events.adapters_ready) == FALSE, "Adapters not ready");
+    fail_if(mock_neard_agent_is_registered(mock) == FALSE, "Agent not registered");
+    fail_if(mock_neard_adapter_is_polling(mock) == FALSE, "Adapter not polling");
+
+    // tags are read as usual once active
+    GBytes* payload = _encode_payload("someuser", "somesecret");
+    gchar* tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_wait_for(_is_nonzero, &events.record_found) == FALSE, "No record found");
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_wait_for(_is_nonzero, &events.tag_lost) == FALSE, "Tag was not lost");
+    fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter was not re-armed");
+
+    fail_if(_wait_for(_is_not_polling, mock) == FALSE, "Polling did not stop when idle");
+    fail_if(mock_neard_agent_is_registered(mock) == FALSE, "Agent unregistered when idle");
+
+    events.adapters_ready = 0;
+    gtlm_nfc_activate(tlm_nfc);
+    fail_if(_wait_for(_is_nonzero, &events.adapters_ready) == FALSE, "Adapters not ready");
+    fail_if(mock_neard_adapter_is_polling(mock) == FALSE, "Adapter not polling");
+
+    g_free(tag_path);
+    g_bytes_unref(payload);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_lazy_worker_thread)
+{
+    GError* error = NULL;
+    GTlmNfc* tlm_nfc = g_initable_new(G_TYPE_TLM_NFC, NULL, &error,
+                                      "lazy", TRUE, "worker-thread", TRUE, NULL);
+    fail_if(tlm_nfc == NULL, "Failed to set up GTlmNfc: %s", error ? error->message : "");
+    fail_if(mock_neard_agent_is_registered(mock), "Agent registered before first use");
+
+    // the event fd counts as first use
+    fail_if(gtlm_nfc_get_event_fd(tlm_nfc) < 0);
+    fail_if(_wait_for(_is_agent_registered, mock) == FALSE, "Agent not registered");
+    fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter did not start polling");
+
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+/* Waits on the event fd alone, without iterating any main context, and
+ * returns the next event that is not an adapter re-arm
+ */
+static gboolean _next_event(GTlmNfc* tlm_nfc, GTlmNfcEvent* event)
+{
+    struct pollfd pfd = { gtlm_nfc_get_event_fd(tlm_nfc), POLLIN, 0 };
+    gint64 deadline = g_get_monotonic_time() + WAIT_TIMEOUT_MSEC * 1000;
+
+    while (g_get_monotonic_time() < deadline) {
+        while (gtlm_nfc_next_event(tlm_nfc, event)) {
+            if (event->type != GTLM_NFC_EVENT_ADAPTER_REARMED)
+                return TRUE;
+        }
+        poll(&pfd, 1, (deadline - g_get_monotonic_time()) / 1000);
+    }
+    return FALSE;
+}
+
+START_TEST (test_tlm_nfc_event_fd)
+{
+    GTlmNfcEvent event;
+    GError* error = NULL;
+    GTlmNfc* tlm_nfc = g_initable_new(G_TYPE_TLM_NFC, NULL, &error,
+                                      "worker-thread", TRUE, NULL);
+    fail_if(tlm_nfc == NULL, "Failed to set up GTlmNfc: %s", error ? error->message : "");
+    gint fd = gtlm_nfc_get_event_fd(tlm_nfc);
+    fail_if(fd < 0);
+    fail_if(gtlm_nfc_get_event_fd(tlm_nfc) != fd);
+    fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter did not start polling");
+    while (gtlm_nfc_next_event(tlm_nfc, &event));
+
+    GBytes* payload = _encode_payload("someuser", "somesecret");
+    gchar* tag_path = mock_neard_place_tag(mock, payload);
+    fail_if(_next_event(tlm_nfc, &event) == FALSE, "No event");
+    fail_if(event.type != GTLM_NFC_EVENT_TAG_FOUND);
+    fail_if(g_strcmp0(event.path, tag_path) != 0);
+    fail_if(_next_event(tlm_nfc, &event) == FALSE, "No event");
+    fail_if(event.type != GTLM_NFC_EVENT_TAG_READY);
+    fail_if(g_strcmp0(event.path, tag_path) != 0);
+    fail_if(_next_event(tlm_nfc, &event) == FALSE, "No event");
+    fail_if(event.type != GTLM_NFC_EVENT_RECORD_FOUND);
+    fail_if(g_strcmp0(event.username, "someuser") != 0);
+    fail_if(g_strcmp0(event.password, "somesecret") != 0);
+    fail_if(event.dropped != 0);
+    fail_if(event.flags != 0);
+    gtlm_nfc_event_clear(&event);
+    fail_if(event.password[0] != '\0' || event.username[0] != '\0' || event.time != 0);
+    mock_neard_remove_tag(mock, tag_path);
+    fail_if(_next_event(tlm_nfc, &event) == FALSE, "No event");
+    fail_if(event.type != GTLM_NFC_EVENT_TAG_LOST);
+    g_free(tag_path);
+
+    // a password that does not fit is truncated, and flagged as such; only
+    // tags in the legacy format can carry one that long
+    gchar* long_password = g_strnfill(GTLM_NFC_EVENT_FIELD_SIZE + 44, 'p');
+    GVariant* v = g_variant_ref_sink(g_variant_new("(msms)", "someuser", long_password));
+    gchar* encoded = g_base64_encode(g_variant_get_data(v), g_variant_get_size(v));
+    GBytes* long_payload = g_bytes_new(encoded, strlen(encoded) + 1);
+    tag_path = mock_neard_place_tag(mock, long_payload);
+    do {
+        fail_if(_next_event(tlm_nfc, &event) == FALSE, "No event");
+    } while (event.type != GTLM_NFC_EVENT_RECORD_FOUND);
+    fail_if(event.flags != GTLM_NFC_EVENT_PASSWORD_TRUNCATED);
+    fail_if(strlen(event.password) != GTLM_NFC_EVENT_FIELD_SIZE - 1);
+    fail_if(g_strcmp0(event.username, "someuser") != 0);
+    gtlm_nfc_event_clear(&event);
+    mock_neard_remove_tag(mock, tag_path);
+    do {
+        fail_if(_next_event(tlm_nfc, &event) == FALSE, "No event");
+    } while (event.type != GTLM_NFC_EVENT_TAG_LOST);
+    g_free(tag_path);
+    g_bytes_unref(long_payload);
+    g_free(encoded);
+    g_variant_unref(v);
+    g_free(long_password);
+
+    // a consumer that falls behind is told how many events it missed
+    Events events;
+    _connect_events(tlm_nfc, &events);
+    for (gint i = 1; i <= 40; i++) {
+        tag_path = mock_neard_place_tag(mock, NULL);
+        mock_neard_remove_tag(mock, tag_path);
+        fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter was not re-armed");
+        g_free(tag_path);
+    }
+    fail_if(_wait_for(_is_nonzero, &events.rearmed) == FALSE, "Adapter was not re-armed");
+    guint received = 0, dropped = 0;
+    while (gtlm_nfc_next_event(tlm_nfc, &event)) {
+        received++;
+        dropped += event.dropped;
+    }
+    fail_if(received == 0 || dropped == 0, "%u events, %u dropped", received, dropped);
+
+    g_bytes_unref(payload);
+    _clear_events(&events);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+#define STRESS_THREADS 8
+#define STRESS_WRITES 25
+
+typedef struct {
+    GTlmNfc* tlm_nfc;
+    const gchar* tag_path;
+    gint written;
+    gint failed;
+    gint finished;
+} Stress;
+
+typedef struct {
+    Stress* stress;
+    gint index;
+} StressThread;
+
+/* The getters never wait for the main context of the thread that talks to
+ * neard
+ */
+static void _stress_getters(GTlmNfc* tlm_nfc)
+{
+    GTlmNfcStats stats;
+    gint64 latency = 0;
+
+    gtlm_nfc_get_stats(tlm_nfc, &stats);
+    g_object_get(tlm_nfc, "average-latency", &latency, NULL);
+    gtlm_nfc_get_rearm_time(tlm_nfc, MOCK_NEARD_ADAPTER_PATH, NULL, NULL, NULL, NULL);
+    gtlm_nfc_get_polling_time(tlm_nfc, MOCK_NEARD_ADAPTER_PATH, NULL, NULL);
+}
+
+static gpointer _stress_getters_thread(gpointer data)
+{
+    for (gint i = 0; i < STRESS_WRITES; i++)
+        _stress_getters(data);
+    return NULL;
+}
+
+static gpointer _stress_thread(gpointer data)
+{
+    StressThread* thread = data;
+    Stress* stress = thread->stress;
+    gchar* username = g_strdup_printf("user%d", thread->index);
+
+    for (gint i = 0; i < STRESS_WRITES; i++) {
+        GError* error = NULL;
+
+        gtlm_nfc_write_username_password(stress->tlm_nfc, stress->tag_path,
+                                         username, "secret", &error);
+        if (error == NULL) {
+            g_atomic_int_inc(&stress->written);
+        } else {
+            g_atomic_int_inc(&stress->failed);
+            g_error_free(error);
+        }
+        _stress_getters(stress->tlm_nfc);
+    }
+
+    g_free(username);
+    g_atomic_int_inc(&stress->finished);
+    return NULL;
+}
+
+static gboolean _is_stress_finished(gpointer data)
+{
+    Stress* stress = data;
+    return g_atomic_int_get(&stress->finished) == STRESS_THREADS;
+}
+
+/* Writes to one tag from many threads at once, while this thread keeps
+ * the main context running.
+ */
+static void _stress_writes(GTlmNfc* tlm_nfc)
+{
+    Events events;
+    _connect_events(tlm_nfc, &events);
+
+    gchar* tag_path = mock_neard_place_tag(mock, NULL);
+    fail_if(_wait_for(_is_nonzero, &events.tag_found) == FALSE, "No tag found");
+
+    Stress stress = { tlm_nfc, tag_path, 0, 0, 0 };
+    StressThread threads[STRESS_THREADS];
+    GThread* thread_ids[STRESS_THREADS];
+    for (gint i = 0; i < STRESS_THREADS; i++) {
+        threads[i].stress = &stress;
+        threads[i].index = i;
+        thread_ids[i] = g_thread_new("stress", _stress_thread, &threads[i]);
+    }
+    fail_if(_wait_for(_is_stress_finished, &stress) == FALSE, "Writes timed out");
+    for (gint i = 0; i < STRESS_THREADS; i++)
+        g_thread_join(thread_ids[i]);
+
+    fail_if(stress.failed != 0, "%d writes failed", stress.failed);
+    fail_if(stress.written != STRESS_THREADS * STRESS_WRITES);
+
+    // this thread blocks without running the main context meanwhile
+    g_thread_join(g_thread_new("stress", _stress_getters_thread, tlm_nfc));
+
+    GTlmNfcPayload decoded;
+    GBytes* payload = mock_neard_get_tag_payload(mock, tag_path);
+    fail_if(payload == NULL);
+    fail_if(gtlm_nfc_payload_decode(&decoded,
+                                    g_bytes_get_data(payload, NULL),
+                                    g_bytes_get_size(payload)) == FALSE);
+    fail_if(g_str_has_prefix(decoded.username, "user") == FALSE);
+    gtlm_nfc_payload_clear(&decoded);
+    g_bytes_unref(payload);
+
+    g_free(tag_path);
+    _clear_events(&events);
+}
+
+START_TEST (test_tlm_nfc_stress)
+{
+    GTlmNfc* tlm_nfc = _new_tlm_nfc();
+    _stress_writes(tlm_nfc);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+START_TEST (test_tlm_nfc_stress_worker_thread)
+{
+    GError* error = NULL;
+    GTlmNfc* tlm_nfc = g_initable_new(G_TYPE_TLM_NFC, NULL, &error,
+                                      "worker-thread", TRUE, NULL);
+    fail_if(tlm_nfc == NULL, "Failed to set up GTlmNfc: %s", error ? error->message : "");
+    fail_if(_wait_for(_is_polling, mock) == FALSE, "Adapter did not start polling");
+    _stress_writes(tlm_nfc);
+    _unref_tlm_nfc(tlm_nfc);
+}
+END_TEST
+
+Suite* common_suite (void)
+{
+    Suite *s = suite_create ("TLM NFC mock");
+
+    TCase *tc_core = tcase_create ("Tests");
+    tcase_add_checked_fixture (tc_core, _setup, _teardown);
+    tcase_add_test (tc_core, test_tlm_nfc_new);
+    tcase_add_test (tc_core, test_tlm_nfc_new_async);
+    tcase_add_test (tc_core, test_tlm_nfc_object_new);
+    tcase_add_test (tc_core, test_tlm_nfc_new_no_neard);
+    tcase_add_test (tc_core, test_tlm_nfc_shutdown);
+    tcase_add_test (tc_core, test_tlm_nfc_read);
+    tcase_add_test (tc_core, test_tlm_nfc_read_legacy);
+    tcase_add_test (tc_core, test_tlm_nfc_read_garbage);
+    tcase_add_test (tc_core, test_tlm_nfc_read_deferred);
+    tcase_add_test (tc_core, test_tlm_nfc_read_direct);
+    tcase_add_test (tc_core, test_tlm_nfc_write);
+    tcase_add_test (tc_core, test_tlm_nfc_enroll);
+    tcase_add_test (tc_core, test_tlm_nfc_tag_ready);
+    tcase_add_test (tc_core, test_tlm_nfc_write_preflight);
+    tcase_add_test (tc_core, test_tlm_nfc_verify_write);
+    tcase_add_test (tc_core, test_tlm_nfc_write_no_tag);
+    tcase_add_test (tc_core, test_tlm_nfc_taps);
+    tcase_add_test (tc_core, test_tlm_nfc_stats);
+    tcase_add_test (tc_core, test_tlm_nfc_adapters_ready);
+    tcase_add_test (tc_core, test_tlm_nfc_rearm_powered_off);
+    tcase_add_test (tc_core, test_tlm_nfc_neard_restart);
+    tcase_add_test (tc_core, test_tlm_nfc_poll_policy);
+    tcase_add_test (tc_core, test_tlm_nfc_shared);
+    tcase_add_test (tc_core, test_tlm_nfc_shared_new_during_async);
+    tcase_add_test (tc_core, test_tlm_nfc_shared_concurrent);
+    tcase_add_test (tc_core, test_tlm_nfc_worker_thread);
+    tcase_add_test (tc_core, test_tlm_nfc_event_fd);
+    tcase_add_test (tc_core, test_tlm_nfc_lazy);
+    tcase_add_test (tc_core, test_tlm_nfc_lazy_worker_thread);
+    tcase_add_test (tc_core, test_tlm_nfc_stress);
+    tcase_add_test (tc_core, test_tlm_nfc_stress_worker_thread);
+    tcase_set_timeout(tc_core, 60);
+    suite_add_tcase (s, tc_core);
+    return s;
+}
+
+int main (void)
+{
+    int number_failed;
+
+#if !GLIB_CHECK_VERSION (2, 36, 0)
+    g_type_init ();
+#endif
+
+    // GTlmNfc talks to the system bus; point it at a private one
+    test_bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+    g_test_dbus_up(test_bus);
+    g_setenv("DBUS_SYSTEM_BUS_ADDRESS", g_test_dbus_get_bus_address(test_bus), TRUE);
+
+    Suite *s = common_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    g_test_dbus_down(test_bus);
+    g_object_unref(test_bus);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -25,7 +25,6 @@
 
 #include <check.h>
 #include <stdlib.h>
-#include <unistd.h>
 #include <fcntl.h>
 #include <glib.h>
 #include <glib-unix.h>
@@ -72,8 +71,9 @@ START_TEST (test_tlm_nfc_read)
     int tag_found_counter = 0;
     int tag_lost_counter = 0;
     GMainLoop* loop = g_main_loop_new(NULL, FALSE);
-    GTlmNfc* tlm_nfc = g_object_new(G_TYPE_TLM_NFC, NULL);
-    G_IS_TLM_NFC(tlm_nfc);
+    GError* error = NULL;
+    GTlmNfc* tlm_nfc = gtlm_nfc_new(NULL, &error);
+    fail_if(tlm_nfc == NULL, "Failed to set up GTlmNfc: %s", error ? error->message : "");
     g_print("Please place the tag on the reader, and then remove it, twice\n");
     g_signal_connect(tlm_nfc, "tag-found", G_CALLBACK(_read_test_tag_found_callback), &tag_found_counter);
     g_signal_connect(tlm_nfc, "tag-lost", G_CALLBACK(_read_test_tag_lost_callback), &tag_lost_counter);
@@ -99,10 +99,8 @@ static void write_plaintext_callback(GTlmNfc* tlm_nfc,
     GError* error = NULL;
     const gchar* username = (const gchar*)user_data;
     
-    g_print("Tag %s found\n", tag_path);
-
-    g_print("Waiting 5 seconds due to https://01.org/jira/browse/NFC-57\n");
-    sleep(5);
+    // neard has read the tag, so it can be written to right away (NFC-57)
+    g_print("Tag %s ready\n", tag_path);
 
     g_print("Writing username %s to tag\n", username);
 
@@ -154,15 +152,16 @@ START_TEST (test_tlm_nfc_write)
     int tag_lost_counter = 0;
     int record_found_counter = 0;
     GMainLoop* loop = g_main_loop_new(NULL, FALSE);
-    GTlmNfc* tlm_nfc = g_object_new(G_TYPE_TLM_NFC, NULL);
-    G_IS_TLM_NFC(tlm_nfc);
+    GError* error = NULL;
+    GTlmNfc* tlm_nfc = gtlm_nfc_new(NULL, &error);
+    fail_if(tlm_nfc == NULL, "Failed to set up GTlmNfc: %s", error ? error->message : "");
     g_print("WARNING: the following test will perform a destructive write on the tag.\n");
     g_print("Press Ctrl-C if you do not wish to continue.\n");
     g_print("Please place the tag on the reader, and then remove it\n");
 
     gchar* username = g_strdup_printf("user%d", g_random_int());
 
-    g_signal_connect(tlm_nfc, "tag-found", G_CALLBACK(write_plaintext_callback), username);
+    g_signal_connect(tlm_nfc, "tag-ready", G_CALLBACK(write_plaintext_callback), username);
     g_signal_connect(tlm_nfc, "tag-lost", G_CALLBACK(_read_test_tag_lost_callback), &tag_lost_counter);
 
     while (1) {